@@ -0,0 +1,505 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hyperscan/cpu.h"
+#include "hyperscan/io/ppukernels.h"
+#include "hyperscan/io/ppurenderer.h"
+#include "hyperscan/memory/sparsememoryregion.h"
+
+using namespace hyperscan;
+
+// Where programs are loaded and data streamed from
+static constexpr uint32_t CODE = 0xA0000000;
+static constexpr uint32_t DATA = 0xA0100000;
+
+// Instructions run before timing, to fill the block cache and JIT
+static constexpr uint32_t WARMUP = 100000;
+
+// Frames drawn per scene, after one to build the color tables
+static constexpr unsigned FRAMES = 200;
+
+/**
+ * Assembles S+core code, enough of it for the workloads below
+ */
+class Assembler {
+	public:
+		// Branch conditions
+		enum Condition {
+			CS, CC, GTU, LEU, EQ, NE, GT, LE, GE, LT, MI, PL, VS, VC, CNZ, AL,
+		};
+
+		uint32_t here() const {
+			return CODE + halves.size() * 2;
+		}
+
+		/**
+		 * A single 16bit instruction, paired with the next one in the same word
+		 */
+		void emit16(uint16_t insn) {
+			halves.push_back(insn & 0x7FFF);
+		}
+
+		/**
+		 * A pair of 16bit instructions, the one running is selected by T
+		 */
+		void parallel(uint16_t low, uint16_t high) {
+			align();
+			halves.push_back(low & 0x7FFF);
+			halves.push_back((high & 0x7FFF) | 0x8000);
+		}
+
+		void emit32(uint32_t insn) {
+			align();
+			halves.push_back((insn & 0x7FFF) | 0x8000);
+			halves.push_back(((insn >> 15) & 0x7FFF) | 0x8000);
+		}
+
+		// 32bit encodings, as laid out in CPU::Instruction32
+
+		void sp(uint8_t func6, uint8_t rD, uint8_t rA, uint8_t rB, bool CU = false) {
+			emit32((0x00 << 25) | (rD << 20) | (rA << 15) | (rB << 10) | (func6 << 1) | CU);
+		}
+
+		void i(uint8_t OP, uint8_t func3, uint8_t rD, uint16_t imm16, bool CU = false) {
+			emit32((OP << 25) | (rD << 20) | (func3 << 17) | (imm16 << 1) | CU);
+		}
+
+		void ri(uint8_t OP, uint8_t rD, uint8_t rA, uint16_t imm14, bool CU = false) {
+			emit32((OP << 25) | (rD << 20) | (rA << 15) | ((imm14 & 0x3FFF) << 1) | CU);
+		}
+
+		void rix(uint8_t OP, uint8_t func3, uint8_t rD, uint8_t rA, uint16_t imm12) {
+			emit32((OP << 25) | (rD << 20) | (rA << 15) | ((imm12 & 0xFFF) << 3) | func3);
+		}
+
+		void m(uint8_t OP, uint8_t rD, uint8_t rA, uint16_t imm15) {
+			emit32((OP << 25) | (rD << 20) | (rA << 15) | (imm15 & 0x7FFF));
+		}
+
+		void b(Condition condition, uint32_t target) {
+			align();
+			uint32_t disp = (target - here()) >> 1;
+			emit32((0x04 << 25) | (((disp >> 9) & 0x3FF) << 15) | (condition << 10) | ((disp & 0x1FF) << 1));
+		}
+
+		void j(uint32_t target) {
+			emit32((0x02 << 25) | (target & 0x01FFFFFE));
+		}
+
+		// Mnemonics
+
+		void add(uint8_t rD, uint8_t rA, uint8_t rB)    { sp(0x08, rD, rA, rB); }
+		void sub(uint8_t rD, uint8_t rA, uint8_t rB)    { sp(0x0A, rD, rA, rB); }
+		void and_(uint8_t rD, uint8_t rA, uint8_t rB)   { sp(0x10, rD, rA, rB); }
+		void or_(uint8_t rD, uint8_t rA, uint8_t rB)    { sp(0x11, rD, rA, rB); }
+		void xor_(uint8_t rD, uint8_t rA, uint8_t rB)   { sp(0x13, rD, rA, rB); }
+		void slli(uint8_t rD, uint8_t rA, uint8_t sa)   { sp(0x38, rD, rA, sa); }
+		void srli(uint8_t rD, uint8_t rA, uint8_t sa)   { sp(0x3A, rD, rA, sa); }
+		void addic(uint8_t rD, int16_t imm)             { i(0x01, 0, rD, imm, true); }
+		void ldi(uint8_t rD, int16_t imm)               { i(0x01, 6, rD, imm); }
+		void ldis(uint8_t rD, uint16_t imm)             { i(0x05, 6, rD, imm); }
+		void addri(uint8_t rD, uint8_t rA, int16_t imm) { ri(0x08, rD, rA, imm); }
+		void andri(uint8_t rD, uint8_t rA, uint16_t imm, bool CU = false) { ri(0x0C, rD, rA, imm, CU); }
+		void lw(uint8_t rD, uint8_t rA, int16_t imm)    { m(0x10, rD, rA, imm); }
+		void sw(uint8_t rD, uint8_t rA, int16_t imm)    { m(0x14, rD, rA, imm); }
+
+		// 16bit rform, OP 0x02 unless given
+		static uint16_t r16(uint8_t func4, uint8_t rD, uint8_t rA, uint8_t OP = 0x02) {
+			return (OP << 12) | (rD << 8) | (rA << 4) | func4;
+		}
+
+		/**
+		 * Loads a full 32bit constant
+		 */
+		void li(uint8_t rD, uint32_t value) {
+			ldis(rD, value >> 16);
+			ri(0x0D, rD, rD, 0);
+			if (value & 0xFFFF) {
+				// orri only takes 14 bits
+				ri(0x0D, rD, rD, value & 0x3FFF);
+				if (value & 0xC000) {
+					i(0x01, 5, rD, value & 0xC000);
+				}
+			}
+		}
+
+		/**
+		 * Writes the program to memory
+		 */
+		void load(memory::SegmentedMemoryRegion<8, 24> &miu) {
+			align();
+			for (size_t i = 0; i < halves.size(); i += 2) {
+				miu.writeU32(CODE + i * 2, halves[i] | (halves[i + 1] << 16));
+			}
+		}
+
+	private:
+		// Pads to a word boundary with nop!
+		void align() {
+			if (halves.size() & 1) {
+				halves.push_back(0x0000);
+			}
+		}
+
+		std::vector<uint16_t> halves;
+};
+
+struct Workload {
+	const char *name;
+
+	// Data memory accesses per loop iteration, and instructions per iteration
+	unsigned accesses;
+	unsigned instructions;
+
+	// Emits the program, which loops forever
+	std::function<void(Assembler &a)> program;
+};
+
+typedef Assembler A;
+
+static const Workload WORKLOADS[] = {
+	{ "alu", 0, 10, [](A &a) {
+		a.li(5, 0x12345678);
+		uint32_t loop = a.here();
+		a.add(4, 4, 5);
+		a.sub(7, 4, 5);
+		a.and_(8, 4, 7);
+		a.or_(9, 8, 5);
+		a.xor_(10, 9, 4);
+		a.slli(11, 10, 3);
+		a.srli(12, 11, 2);
+		a.addri(13, 12, 100);
+		a.addic(6, -1);
+		a.b(A::AL, loop);
+	} },
+	{ "alu flags", 0, 10, [](A &a) {
+		a.li(5, 0x12345678);
+		uint32_t loop = a.here();
+		// add.c, sub.c, and.c, or.c, xor.c, flags mostly overwritten before being read
+		a.sp(0x08, 4, 4, 5, true);
+		a.sp(0x0A, 7, 4, 5, true);
+		a.sp(0x10, 8, 4, 7, true);
+		a.sp(0x11, 9, 8, 5, true);
+		a.sp(0x13, 10, 9, 4, true);
+		a.sp(0x08, 11, 10, 4, true);
+		a.sp(0x0A, 12, 11, 5, true);
+		a.sp(0x08, 13, 12, 4, true);
+		a.addic(6, -1);
+		a.b(A::NE, loop);
+	} },
+	{ "load/store", 5, 11, [](A &a) {
+		a.li(20, DATA);
+		uint32_t loop = a.here();
+		a.addri(21, 21, 32);
+		a.andri(21, 21, 0x3FFF);
+		a.add(22, 20, 21);
+		a.lw(4, 22, 0);
+		a.lw(5, 22, 4);
+		a.add(4, 4, 5);
+		a.sw(4, 22, 8);
+		a.lw(7, 22, 12);
+		a.sw(7, 22, 16);
+		a.addic(6, -1);
+		a.b(A::AL, loop);
+	} },
+	{ "branch", 0, 7, [](A &a) {
+		uint32_t loop = a.here();
+		a.addic(6, -1);
+		// Taken every other iteration
+		a.andri(7, 6, 1, true);
+		uint32_t skip1 = a.here() + 4 + 4;
+		a.b(A::EQ, skip1);
+		a.addic(8, 1);
+		// Taken two iterations out of four
+		a.andri(7, 6, 2, true);
+		uint32_t skip2 = a.here() + 4 + 4;
+		a.b(A::NE, skip2);
+		a.addic(9, 1);
+		a.b(A::AL, loop);
+	} },
+	{ "16bit parallel", 0, 10, [](A &a) {
+		uint32_t loop = a.here();
+		a.parallel(A::r16(0x0, 4, 5), A::r16(0x1, 4, 5));
+		a.parallel(A::r16(0x4, 6, 4), A::r16(0x5, 6, 4));
+		a.emit16(A::r16(0x7, 7, 6));
+		a.emit16(A::r16(0x3, 8, 7, 0x00));
+		a.parallel(A::r16(0x0, 9, 8), A::r16(0x7, 9, 8));
+		a.emit16(A::r16(0x0, 10, 9));
+		a.emit16(A::r16(0x1, 11, 10));
+		a.parallel(A::r16(0x5, 12, 11), A::r16(0x4, 12, 11));
+		a.addic(3, -1);
+		a.b(A::AL, loop);
+	} },
+	{ "pre/post increment", 6, 11, [](A &a) {
+		a.li(20, DATA);
+		a.li(21, DATA + 0x8000);
+		uint32_t loop = a.here();
+		// lw rD, [rA, 4]+
+		a.rix(0x03, 0, 4, 22, 4);
+		a.rix(0x03, 0, 5, 22, 4);
+		// sw rD, [rA]+, 4
+		a.rix(0x07, 4, 4, 23, 4);
+		a.rix(0x07, 4, 5, 23, 4);
+		// lbu rD, [rA]+, 1
+		a.rix(0x07, 6, 7, 22, 1);
+		// sb rD, [rA, 1]+
+		a.rix(0x03, 7, 7, 23, 1);
+		// Keep both pointers within 16KiB of their base
+		a.andri(24, 22, 0x3FFF);
+		a.add(22, 20, 24);
+		a.andri(24, 23, 0x3FFF);
+		a.add(23, 21, 24);
+		a.b(A::AL, loop);
+	} },
+	{ "store to code page", 2, 7, [](A &a) {
+		// Past the code, but on a page watched for blocks
+		a.li(20, CODE + 0x800);
+		uint32_t loop = a.here();
+		a.addri(21, 21, 8);
+		a.andri(21, 21, 0x3FF);
+		a.add(22, 20, 21);
+		a.sw(4, 22, 0);
+		a.sw(5, 22, 4);
+		a.addic(6, -1);
+		a.b(A::AL, loop);
+	} },
+};
+
+using io::PPUState;
+
+struct Scene {
+	const char *name;
+
+	// Sets up the registers and fills DRAM, frames are drawn at VGA
+	std::function<void(PPUState &state, memory::SegmentedMemoryRegion<8, 24> &bus)> setup;
+};
+
+/**
+ * Enables text layer index with attribute and control, drawing from numbers and characters
+ */
+static void enable_text(PPUState &state, unsigned index, uint32_t attribute, uint32_t control, uint32_t numbers, uint32_t characters) {
+	uint32_t *text = state.registers + PPUState::TEXT + index * PPUState::TEXT_STRIDE;
+	text[PPUState::TEXT_ATTRIBUTE] = attribute;
+	text[PPUState::TEXT_CONTROL] = control | PPUState::TEXT_EN;
+	text[PPUState::TEXT_NUMBER] = numbers;
+	state.registers[PPUState::TEXT_BUFFER + index * 3] = characters;
+}
+
+/**
+ * A 128x64 number array of 16-color 8x8 characters 1 to 255, scrolled and offset line by line
+ */
+static void text_scene(PPUState &state, memory::SegmentedMemoryRegion<8, 24> &bus) {
+	for (uint32_t i = 0; i < 128 * 64; ++i) {
+		bus.writeU16(DATA + i * 2, i % 255 + 1);
+	}
+	for (uint32_t i = 0; i < 256 * 32; ++i) {
+		bus.writeU8(DATA + 0x10000 + i, i * 37);
+	}
+
+	enable_text(state, 0, 1 | 3u << 8, PPUState::TEXT_HMOVE, DATA, DATA + 0x10000);
+	state.registers[PPUState::TEXT] = 3;
+	for (unsigned i = 0; i < PPUState::LINE_COUNT; ++i) {
+		state.hoffset[i] = i & 7;
+	}
+}
+
+/**
+ * A 1024x512 RGB565 bitmap, blended at half
+ */
+static void bitmap_scene(PPUState &state, memory::SegmentedMemoryRegion<8, 24> &bus) {
+	for (uint32_t y = 0; y < 512; ++y) {
+		bus.writeU32(DATA + 0x20000 + y * 4, y * 2048);
+	}
+	for (uint32_t i = 0; i < 1024 * 512; ++i) {
+		bus.writeU16(DATA + 0x40000 + i * 2, i * 2654435761u >> 16);
+	}
+
+	enable_text(state, 1, 1u << 13, PPUState::TEXT_BITMAP | PPUState::TEXT_RGB565 | PPUState::TEXT_BLEND_EN, DATA + 0x20000, DATA + 0x40000);
+	state.registers[PPUState::TEXT + PPUState::TEXT_STRIDE + PPUState::TEXT_BLEND] = 32;
+}
+
+/**
+ * 256 sprites of 32x32 pixels in 256 colors spread over the screen, every fourth blended
+ */
+static void sprite_scene(PPUState &state, memory::SegmentedMemoryRegion<8, 24> &bus) {
+	for (uint32_t i = 0; i < 4 * 1024; ++i) {
+		bus.writeU8(DATA + 0x200000 + 1024 + i, i % 7 ? i : 0);
+	}
+
+	state.registers[PPUState::SPRITE_CONTROL] = PPUState::SPRITE_EN;
+	state.registers[PPUState::SPRITE_MAX] = 255;
+	state.registers[PPUState::SPRITE_BUFFER] = DATA + 0x200000;
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t attribute = 3 | 2u << 4 | 2u << 6 | 3u << 13 | (i % 4 ? 0 : PPUState::ATTRIBUTE_BLEND);
+		state.sprites[i * 2] = (1 + i % 4) | ((i * 37 % 600 - 300) & 0x3FF) << 16;
+		state.sprites[i * 2 + 1] = attribute | ((i * 53 % 440 - 220) & 0x3FF) << 16 | 40u << 26;
+	}
+}
+
+static const Scene SCENES[] = {
+	{ "text", text_scene },
+	{ "bitmap", bitmap_scene },
+	{ "sprites", sprite_scene },
+	{ "all", [](PPUState &state, memory::SegmentedMemoryRegion<8, 24> &bus) {
+		text_scene(state, bus);
+		bitmap_scene(state, bus);
+		sprite_scene(state, bus);
+	} },
+};
+
+/**
+ * Draws every scene at VGA, reporting frames per second against the 60 of the hardware
+ */
+static void benchmark_ppu() {
+	printf("\n%-20s %-12s %10s %12s %14s\n", "scene", "kernels", "frames/s", "ms/frame", "x realtime");
+	for (const Scene &scene : SCENES) {
+		auto bus = std::make_shared<memory::SegmentedMemoryRegion<8, 24>>();
+		auto dram = std::make_shared<memory::SparseMemoryRegion<24>>();
+		bus->setRegion(0x80, dram);
+		bus->setRegion(0xA0, dram);
+
+		auto state = std::make_unique<PPUState>();
+		state->registers[PPUState::PPU_CONTROL] = PPUState::RESOLUTION_VGA | PPUState::CONTROL_PPU_EN;
+		for (unsigned i = 0; i < PPUState::PALETTE_COUNT; ++i) {
+			state->palette[i] = i * 0x4D;
+		}
+		scene.setup(*state, *bus);
+
+		io::PPURenderer renderer;
+		io::Frame frame;
+		renderer.render(*state, *dram, frame);
+
+		auto start = std::chrono::steady_clock::now();
+		for (unsigned i = 0; i < FRAMES; ++i) {
+			renderer.render(*state, *dram, frame);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		double seconds = elapsed.count();
+		printf("%-20s %-12s %10.1f %12.3f %14.1f\n", scene.name, io::ppu_kernels().name,
+			   FRAMES / seconds, seconds * 1e3 / FRAMES, FRAMES / seconds / 60);
+	}
+}
+
+static const std::pair<const char*, CPU::Engine> ENGINES[] = {
+	{ "interpreter", CPU::Engine::INTERPRETER },
+	{ "cached",      CPU::Engine::CACHED },
+	{ "jit",         CPU::Engine::JIT },
+};
+
+/**
+ * Sets up cpu with DRAM holding program, to run from its start with engine
+ */
+static void load_program(CPU &cpu, CPU::Engine engine, const std::function<void(A &a)> &program) {
+	cpu.engine = engine;
+	cpu.miu = std::make_shared<memory::SegmentedMemoryRegion<8, 24>>();
+
+	auto dram = std::make_shared<memory::SparseMemoryRegion<24>>();
+	cpu.miu->setRegion(0x80, dram);
+	cpu.miu->setRegion(0xA0, dram);
+
+	Assembler assembler;
+	program(assembler);
+	assembler.load(*cpu.miu);
+
+	cpu.pc = CODE;
+}
+
+struct IdleLoop {
+	const char *name;
+
+	// Emits the loop, which counts CNT down to 0 and then spins at the end
+	std::function<void(Assembler &a)> program;
+};
+
+static const IdleLoop IDLE_LOOPS[] = {
+	{ "b{cnt} spin", [](A &a) {
+		uint32_t loop = a.here();
+		a.b(A::CNZ, loop);
+		a.j(a.here());
+	} },
+	{ "poll with timeout", [](A &a) {
+		a.li(20, DATA);
+		uint32_t loop = a.here();
+		a.lw(4, 20, 0);
+		a.andri(5, 4, 1, true);
+		a.b(A::CNZ, loop);
+		a.j(a.here());
+	} },
+};
+
+/**
+ * Runs loops idle skipping has to leave alone with skipping on and off, reporting CNT and PC when they end up apart
+ * Returns whether every loop ended up the same either way
+ */
+static bool check_idle() {
+	// Instructions run, enough for the loops to count down past the first look for an idle loop
+	static constexpr uint32_t COUNT = 1000000;
+	static constexpr uint32_t CNT = 100000;
+
+	bool agreed = true;
+	printf("\n%-20s %-12s %18s %18s\n", "idle loop", "engine", "CNT/PC skipping", "CNT/PC stepping");
+	for (const IdleLoop &loop : IDLE_LOOPS) {
+		for (const auto &[engine, mode] : ENGINES) {
+			uint32_t cnt[2], pc[2];
+			for (bool skip : { true, false }) {
+				CPU cpu;
+				load_program(cpu, mode, loop.program);
+				cpu.skipIdle = skip;
+				cpu.CNT = CNT;
+				cpu.run(COUNT);
+
+				cnt[skip] = cpu.CNT;
+				pc[skip] = cpu.pc;
+			}
+
+			bool same = cnt[0] == cnt[1] && pc[0] == pc[1];
+			agreed &= same;
+			printf("%-20s %-12s %9u/%08X %9u/%08X%s\n", loop.name, engine, cnt[1], pc[1], cnt[0], pc[0], same ? "" : "  MISMATCH");
+		}
+	}
+
+	return agreed;
+}
+
+int main(int argc, char *argv[]) {
+	uint32_t count = argc > 1 ? strtoul(argv[1], nullptr, 0) : 10000000;
+	const char *only = argc > 2 ? argv[2] : nullptr;
+
+	printf("%-20s %-12s %10s %12s %14s\n", "workload", "engine", "MIPS", "ns/insn", "Maccesses/s");
+	for (const Workload &workload : WORKLOADS) {
+		for (const auto &[engine, mode] : ENGINES) {
+			if (only && strcmp(only, engine)) {
+				continue;
+			}
+
+			CPU cpu;
+			load_program(cpu, mode, workload.program);
+			cpu.run(WARMUP);
+
+			auto start = std::chrono::steady_clock::now();
+			uint32_t executed = cpu.run(count);
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+			double seconds = elapsed.count();
+			double accesses = double(executed) * workload.accesses / workload.instructions;
+			printf("%-20s %-12s %10.2f %12.2f %14.2f\n", workload.name, engine,
+				   executed / seconds / 1e6, seconds * 1e9 / executed, accesses / seconds / 1e6);
+		}
+	}
+
+	if (only) {
+		return 0;
+	}
+
+	benchmark_ppu();
+
+	// Skipping through idle loops must not change where they end up
+	return check_idle() ? 0 : 1;
+}
@@ -0,0 +1,715 @@
+#include "hyperscan/blockcache.h"
+#include "hyperscan/cpu.h"
+#include "hyperscan/handlers.h"
+
+namespace hyperscan {
+
+// Longest run of instructions decoded into a single block
+static constexpr unsigned MAX_BLOCK_INSTRUCTIONS = 256;
+
+// Longest loop recognized as idle, polling loops are a handful of instructions
+static constexpr unsigned MAX_IDLE_INSTRUCTIONS = 16;
+
+typedef BlockCache::Handlers H;
+
+// Terminates every block, and is what fetch() starts from
+// It never matches a PC, but interprets the instruction should one land on it anyway
+static const DecodedInstruction SENTINEL = {
+	.handler = H::interpret,
+	.pc = 0xFFFFFFFF,
+	.imm = 0,
+	.rD = 0, .rA = 0, .rB = 0,
+	.CU = false,
+	.length = 0,
+};
+
+// Register operand instruction
+static DecodedInstruction regs(DecodedInstruction::Handler handler, uint32_t pc, uint8_t rD, uint8_t rA, uint8_t rB, bool CU = false) {
+	return { .handler = handler, .pc = pc, .imm = 0, .rD = rD, .rA = rA, .rB = rB, .CU = CU, .length = 1 };
+}
+
+// Immediate operand instruction
+static DecodedInstruction imm(DecodedInstruction::Handler handler, uint32_t pc, uint8_t rD, uint8_t rA, uint32_t imm, bool CU = false) {
+	return { .handler = handler, .pc = pc, .imm = imm, .rD = rD, .rA = rA, .rB = 0, .CU = CU, .length = 1 };
+}
+
+// Conditional control flow, cond is kept in rB
+static DecodedInstruction cond(DecodedInstruction::Handler handler, uint32_t pc, uint8_t cond, uint8_t rA, uint32_t target, bool link) {
+	return { .handler = handler, .pc = pc, .imm = target, .rD = 0, .rA = rA, .rB = cond, .CU = link, .length = 1 };
+}
+
+static bool is_terminator(const DecodedInstruction &insn) {
+	static const DecodedInstruction::Handler TERMINATORS[] = {
+		H::illegal, H::rte,
+		H::jump<16>, H::jump<32>,
+		H::branch<16>, H::branch<32>,
+		H::br<16>, H::br<32>,
+	};
+
+	return std::find(std::begin(TERMINATORS), std::end(TERMINATORS), insn.handler) != std::end(TERMINATORS);
+}
+
+// Cycles insn takes on top of the one every instruction takes
+static uint32_t stall(const DecodedInstruction &insn) {
+	if (insn.handler == H::mul || insn.handler == H::mulu) {
+		return CPU::MUL_STALL;
+	}
+
+	if (insn.handler == H::div || insn.handler == H::divu) {
+		return CPU::DIV_STALL;
+	}
+
+	return 0;
+}
+
+// Stands for the flags in register masks
+static constexpr uint64_t FLAGS = uint64_t(1) << 32;
+
+template <int I >
+bool BlockCache::pollingOperands(const DecodedInstruction &insn, Operands &operands) {
+	static const std::pair<DecodedInstruction::Handler, Operands> POLLING[] = {
+		{ H::nop<I>,                         Operands::NONE },
+		{ H::offset<I, H::LW>,               Operands::LOAD },
+		{ H::offset<I, H::LH>,               Operands::LOAD },
+		{ H::offset<I, H::LHU>,              Operands::LOAD },
+		{ H::offset<I, H::LB>,               Operands::LOAD },
+		{ H::offset<I, H::LBU>,              Operands::LOAD },
+		{ H::add<I>,                         Operands::REGISTERS },
+		{ H::sub<I>,                         Operands::REGISTERS },
+		{ H::neg<I>,                         Operands::REGISTERS },
+		{ H::bit_op<I, std::bit_and<>>,      Operands::REGISTERS },
+		{ H::bit_op<I, std::bit_or<>>,       Operands::REGISTERS },
+		{ H::bit_op<I, std::bit_xor<>>,      Operands::REGISTERS },
+		{ H::shift<I, &CPU::sll>,            Operands::REGISTERS },
+		{ H::shift<I, &CPU::srl>,            Operands::REGISTERS },
+		{ H::shift<I, &CPU::sra>,            Operands::REGISTERS },
+		{ H::addi<I>,                        Operands::IMMEDIATE },
+		{ H::bit_opi<I, std::bit_and<>>,     Operands::IMMEDIATE },
+		{ H::bit_opi<I, std::bit_or<>>,      Operands::IMMEDIATE },
+		{ H::bit_opi<I, std::bit_xor<>>,     Operands::IMMEDIATE },
+		{ H::shifti<I, &CPU::sll>,           Operands::IMMEDIATE },
+		{ H::shifti<I, &CPU::srl>,           Operands::IMMEDIATE },
+		{ H::shifti<I, &CPU::sra>,           Operands::IMMEDIATE },
+		{ H::cmp<I>,                         Operands::COMPARE },
+		{ H::cmpi<I>,                        Operands::COMPARE_IMMEDIATE },
+		{ H::tsti<I>,                        Operands::COMPARE_IMMEDIATE },
+		{ H::mv<I>,                          Operands::MOVE },
+		{ H::ldi<I>,                         Operands::LOAD_IMMEDIATE },
+	};
+
+	for (const auto &[handler, kind] : POLLING) {
+		if (handler == insn.handler) {
+			operands = kind;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool BlockCache::pollingOperands(const DecodedInstruction &insn, Operands &operands) {
+	return pollingOperands<16>(insn, operands) || pollingOperands<32>(insn, operands);
+}
+
+bool BlockCache::isIdleLoop(const Block &block) {
+	// The sentinel comes last
+	size_t count = block.instructions.size() - 1;
+	if (count > MAX_IDLE_INSTRUCTIONS) {
+		return false;
+	}
+
+	const DecodedInstruction &last = block.instructions[count - 1];
+	bool branches = last.handler == H::branch<16> || last.handler == H::branch<32>;
+	bool jumps = last.handler == H::jump<16> || last.handler == H::jump<32>;
+	if (!(branches || jumps) || last.CU || last.imm != block.start) {
+		return false;
+	}
+
+	// b{cnt} decrements CNT every iteration, skipping them would never get it to 0
+	if (branches && last.rB == 0xE) {
+		return false;
+	}
+
+	// What each instruction reads and writes, in order
+	uint64_t reads[MAX_IDLE_INSTRUCTIONS];
+	uint64_t writes[MAX_IDLE_INSTRUCTIONS];
+	uint64_t written = 0;
+	uint64_t writtenTwice = 0;
+
+	for (size_t i = 0; i < count - 1; ++i) {
+		const DecodedInstruction &insn = block.instructions[i];
+		uint64_t rD = uint64_t(1) << insn.rD;
+		uint64_t rA = uint64_t(1) << insn.rA;
+		uint64_t rB = uint64_t(1) << insn.rB;
+		uint64_t flags = insn.CU ? FLAGS : 0;
+
+		Operands operands;
+		if (!pollingOperands(insn, operands)) {
+			return false;
+		}
+
+		switch (operands) {
+			case Operands::NONE:              reads[i] = 0;       writes[i] = 0;          break;
+			case Operands::LOAD:              reads[i] = rA;      writes[i] = rD;         break;
+			case Operands::REGISTERS:         reads[i] = rA | rB; writes[i] = rD | flags; break;
+			case Operands::IMMEDIATE:         reads[i] = rA;      writes[i] = rD | flags; break;
+			// T may be set whether or not CU is
+			case Operands::COMPARE:           reads[i] = rA | rB; writes[i] = FLAGS;      break;
+			case Operands::COMPARE_IMMEDIATE: reads[i] = rA;      writes[i] = FLAGS;      break;
+			case Operands::MOVE:              reads[i] = rA;      writes[i] = rD;         break;
+			case Operands::LOAD_IMMEDIATE:    reads[i] = 0;       writes[i] = rD;         break;
+		}
+
+		writtenTwice |= written & writes[i];
+		written |= writes[i];
+	}
+
+	// The branch reads the flags
+	reads[count - 1] = branches ? FLAGS : 0;
+	writes[count - 1] = 0;
+
+	uint64_t writtenSoFar = 0;
+	for (size_t i = 0; i < count; ++i) {
+		// Anything read before being written in this iteration has to be left as it was by the last one
+		if (reads[i] & ~writtenSoFar & written) {
+			return false;
+		}
+
+		if (isLoad(block.instructions[i]) && (reads[i] & writtenTwice)) {
+			return false;
+		}
+
+		writtenSoFar |= writes[i];
+	}
+
+	return true;
+}
+
+BlockCache::BlockCache():
+	next(&SENTINEL) {
+
+}
+
+BlockCache::~BlockCache() {
+	if (watched) {
+		watched->setWatcher(nullptr);
+	}
+}
+
+BlockCache::Block* BlockCache::block(CPU &cpu, uint32_t pc) {
+	// Nothing can be running from retired blocks between instructions
+	retired.clear();
+
+	if (watched != cpu.miu) {
+		clear();
+		if (watched) {
+			watched->setWatcher(nullptr);
+		}
+
+		watched = cpu.miu;
+		watched->setWatcher([this](uint32_t address) {
+			invalidate(address);
+		});
+	}
+
+	auto it = blocks.find(pc);
+	if (it == blocks.end()) {
+		auto block = decode(cpu, pc);
+
+		cpu.miu->watch(block->start);
+		pages[block->start >> memory::PAGE_BITS].push_back(block->start);
+
+		it = blocks.emplace(pc, std::move(block)).first;
+	}
+
+	return it->second.get();
+}
+
+BlockCache::Block* BlockCache::idleLoop(CPU &cpu, uint32_t pc) {
+	// Runs up to where the loop branches back
+	const Block *from = block(cpu, pc);
+	const DecodedInstruction &last = from->instructions[from->instructions.size() - 2];
+
+	uint32_t start = last.imm;
+	if (!is_terminator(last) || start > pc || from->end - start > MAX_IDLE_INSTRUCTIONS * 4) {
+		return nullptr;
+	}
+
+	Block *loop = block(cpu, start);
+	return (loop->idle && loop->end == from->end) ? loop : nullptr;
+}
+
+bool BlockCache::isLoad(const DecodedInstruction &insn) {
+	Operands operands;
+	return pollingOperands(insn, operands) && operands == Operands::LOAD;
+}
+
+void BlockCache::invalidate(uint32_t address) {
+	// A word write may spill into the next page
+	for (uint32_t page : { address >> memory::PAGE_BITS, (address + 3) >> memory::PAGE_BITS }) {
+		auto it = pages.find(page);
+		if (it == pages.end()) {
+			continue;
+		}
+
+		std::erase_if(it->second, [&](uint32_t start) {
+			auto block = blocks.find(start);
+			if (address + 4 <= block->second->start || address >= block->second->end) {
+				return false;
+			}
+
+			retired.push_back(std::move(block->second));
+			blocks.erase(block);
+			next = &SENTINEL;
+			++invalidations;
+			return true;
+		});
+
+		if (it->second.empty()) {
+			pages.erase(it);
+
+			// Mirrors share the watch, keep it while blocks are left on any of them
+			bool used = false;
+			watched->forEachMirror(page << memory::PAGE_BITS, [&](uint32_t mirror) {
+				used |= pages.contains(mirror >> memory::PAGE_BITS);
+			});
+
+			if (!used) {
+				watched->unwatch(page << memory::PAGE_BITS);
+			}
+		}
+	}
+}
+
+void BlockCache::clear() {
+	for (auto &[start, block] : blocks) {
+		retired.push_back(std::move(block));
+	}
+
+	blocks.clear();
+	pages.clear();
+	next = &SENTINEL;
+	++invalidations;
+}
+
+std::unique_ptr<BlockCache::Block> BlockCache::decode(CPU &cpu, uint32_t pc) {
+	auto block = std::make_unique<Block>();
+	block->start = pc;
+	block->count = 0;
+	block->stalls = 0;
+
+	bool terminated = false;
+	do {
+		CPU::InstructionDecoder instruction = cpu.fetch(pc);
+		block->count++;
+
+		if (pc & 2) {
+			block->instructions.push_back(decode16<16>(instruction.low, pc));
+			pc += 2;
+		} else if (instruction.p0) {
+			block->instructions.push_back(decode32((instruction.high << 15) | instruction.low, pc));
+			block->stalls += stall(block->instructions.back());
+			pc += 4;
+		} else if (instruction.p1) {
+			// Both halves follow, parallel() picks one according to T
+			DecodedInstruction low = decode16<32>(instruction.low, pc);
+			DecodedInstruction high = decode16<32>(instruction.high, pc);
+
+			block->instructions.push_back({ .handler = H::parallel, .pc = pc, .imm = 0, .rD = 0, .rA = 0, .rB = 0, .CU = false, .length = 3 });
+			block->instructions.push_back(low);
+			block->instructions.push_back(high);
+			terminated = is_terminator(low) || is_terminator(high);
+			pc += 4;
+			continue;
+		} else {
+			block->instructions.push_back(decode16<16>(instruction.low, pc));
+			pc += 2;
+		}
+
+		terminated = is_terminator(block->instructions.back());
+	} while (!terminated &&
+			 (pc >> memory::PAGE_BITS) == (block->start >> memory::PAGE_BITS) &&
+			 block->instructions.size() < MAX_BLOCK_INSTRUCTIONS);
+
+	block->end = pc;
+	block->instructions.push_back(SENTINEL);
+	block->idle = isIdleLoop(*block);
+
+	return block;
+}
+
+DecodedInstruction BlockCache::decode32(uint32_t encoded, uint32_t pc) {
+	CPU::Instruction32 insn = encoded;
+	switch(insn.OP) {
+		case 0x00: {
+				uint8_t rD = insn.spform.rD;
+				uint8_t rA = insn.spform.rA;
+				uint8_t rB = insn.spform.rB;
+				bool CU = insn.spform.CU;
+				switch(insn.spform.func6) {
+					// nop
+					case 0x00: return regs(H::nop<32>, pc, 0, 0, 0);
+
+					// br{cond}[l] rA
+					case 0x04: return cond(H::br<32>, pc, rB, rA, 0, CU);
+
+					// add[.c] rD, rA, rB
+					case 0x08: return regs(H::add<32>, pc, rD, rA, rB, CU);
+					// addc[.c] rD, rA, rB
+					case 0x09: return regs(H::addc<32>, pc, rD, rA, rB, CU);
+					// sub[.c] rD, rA, rB
+					case 0x0A: return regs(H::sub<32>, pc, rD, rA, rB, CU);
+					// subc[.c] rD, rA, rB
+					case 0x0B: return regs(H::subc<32>, pc, rD, rA, rB, CU);
+					// cmp{tcs}.c rA, rB
+					case 0x0C: return regs(H::cmp<32>, pc, rD & 0x03, rA, rB, CU);
+					// cmpz{tcs}.c rA
+					case 0x0D: return imm(H::cmpi<32>, pc, rD & 0x03, rA, 0, CU);
+
+					// neg[.c] rD, rA
+					case 0x0F: return regs(H::neg<32>, pc, rD, rA, rB, CU);
+					// and[.c] rD, rA, rB
+					case 0x10: return regs(H::bit_op<32, std::bit_and<>>, pc, rD, rA, rB, CU);
+					// or[.c] rD, rA, rB
+					case 0x11: return regs(H::bit_op<32, std::bit_or<>>, pc, rD, rA, rB, CU);
+					// not[.c] rD, rA
+					case 0x12: return imm(H::bit_opi<32, std::bit_xor<>>, pc, rD, rA, ~0, CU);
+					// xor[.c] rD, rA, rB
+					case 0x13: return regs(H::bit_op<32, std::bit_xor<>>, pc, rD, rA, rB, CU);
+					// bitclr[.c] rD, rA, imm5
+					case 0x14: return imm(H::bit_opi<32, std::bit_and<>>, pc, rD, rA, ~(1 << rB), CU);
+					// bitset[.c] rD, rA, imm5
+					case 0x15: return imm(H::bit_opi<32, std::bit_or<>>, pc, rD, rA, 1 << rB, CU);
+					// bittst.c rA, imm5
+					case 0x16: return imm(H::tsti<32>, pc, 0, rA, 1 << rB, CU);
+					// bittgl[.c] rA, imm5
+					case 0x17: return imm(H::bit_opi<32, std::bit_xor<>>, pc, rD, rA, 1 << rB, CU);
+					// sll[.c] rA, imm5
+					case 0x18: return regs(H::shift<32, &CPU::sll>, pc, rD, rA, rB, CU);
+					// srl[.c] rA, imm5
+					case 0x1A: return regs(H::shift<32, &CPU::srl>, pc, rD, rA, rB, CU);
+					// sra[.c] rA, imm5
+					case 0x1B: return regs(H::shift<32, &CPU::sra>, pc, rD, rA, rB, CU);
+
+					// mul rA, rB
+					case 0x20: return regs(H::mul, pc, 0, rA, rB);
+					// mulu rA, rB
+					case 0x21: return regs(H::mulu, pc, 0, rA, rB);
+					// div rA, rB
+					case 0x22: return regs(H::div, pc, 0, rA, rB);
+					// divu rA, rB
+					case 0x23: return regs(H::divu, pc, 0, rA, rB);
+
+					// mfce{hl} rD[, rA]
+					case 0x24:
+							switch(rB) {
+								case 0x01: return regs(H::mfcel<32>, pc, rD, 0, 0);
+								case 0x02: return regs(H::mfceh<32>, pc, rD, 0, 0);
+								case 0x03: return regs(H::mfcehl, pc, rD, rA, 0);
+							}
+						return regs(H::nop<32>, pc, 0, 0, 0);
+					// mtce{hl} rD[, rA]
+					case 0x25:
+							switch(rB) {
+								case 0x01: return regs(H::mtcel<32>, pc, rD, 0, 0);
+								case 0x02: return regs(H::mtceh<32>, pc, rD, 0, 0);
+								case 0x03: return regs(H::mtcehl, pc, rD, rA, 0);
+							}
+						return regs(H::nop<32>, pc, 0, 0, 0);
+
+					// mfsr rD srB
+					case 0x28: return regs(H::mfsr, pc, rD, 0, rB);
+					// mtsr rA, srB
+					case 0x29: return regs(H::mtsr, pc, 0, rA, rB);
+					// t{cond}
+					case 0x2A: return regs(H::tcond<32>, pc, 0, 0, rB);
+					// mv{cond} rD, rA
+					case 0x2B: return regs(H::mvcond, pc, rD, rA, rB);
+					// extsb[.c] rD, rA
+					case 0x2C: return regs(H::exts<8>, pc, rD, rA, 0, CU);
+					// extsh[.c] rD, rA
+					case 0x2D: return regs(H::exts<16>, pc, rD, rA, 0, CU);
+					// extzb[.c] rD, rA
+					case 0x2E: return imm(H::bit_opi<32, std::bit_and<>>, pc, rD, rA, 0x000000FF, CU);
+					// extzh[.c] rD, rA
+					case 0x2F: return imm(H::bit_opi<32, std::bit_and<>>, pc, rD, rA, 0x0000FFFF, CU);
+
+					// slli[.c] rD, rA, imm5
+					case 0x38: return imm(H::shifti<32, &CPU::sll>, pc, rD, rA, rB, CU);
+
+					// srli[.c] rD, rA, imm5
+					case 0x3A: return imm(H::shifti<32, &CPU::srl>, pc, rD, rA, rB, CU);
+					// srai[.c] rD, rA, imm5
+					case 0x3B: return imm(H::shifti<32, &CPU::sra>, pc, rD, rA, rB, CU);
+				}
+			} break;
+		case 0x01: {
+				uint8_t rD = insn.iform.rD;
+				int32_t imm16 = sign_extend(insn.iform.Imm16, 16);
+				bool CU = insn.iform.CU;
+				switch(insn.iform.func3) {
+					// addi[.c] rD, imm16
+					case 0x00: return imm(H::addi<32>, pc, rD, rD, imm16, CU);
+					// cmpi.c rD, imm16
+					case 0x02: return imm(H::cmpi<32>, pc, 3, rD, imm16, CU);
+					// andi.c rD, imm16
+					case 0x04: return imm(H::bit_opi<32, std::bit_and<>>, pc, rD, rD, insn.iform.Imm16, CU);
+					// ori.c rD, imm16
+					case 0x05: return imm(H::bit_opi<32, std::bit_or<>>, pc, rD, rD, insn.iform.Imm16, CU);
+					// ldi rD, imm16
+					case 0x06: return imm(H::ldi<32>, pc, rD, 0, imm16);
+				}
+			} break;
+		case 0x02:
+				// j[l] imm24
+				return cond(H::jump<32>, pc, 0, 0, (pc & 0xFE000000) | (insn.jform.Disp24 << 1), insn.jform.LK);
+		case 0x03: {
+				uint8_t rD = insn.rixform.rD;
+				uint8_t rA = insn.rixform.rA;
+				int32_t imm12 = sign_extend(insn.rixform.Imm12, 12);
+				switch(insn.rixform.func3) {
+					// lw rD, [rA, imm12]+
+					case 0x00: return imm(H::pre<32, H::LW>, pc, rD, rA, imm12);
+					// lh rD, [rA, imm12]+
+					case 0x01: return imm(H::pre<32, H::LH>, pc, rD, rA, imm12);
+					// lhu rD, [rA, imm12]+
+					case 0x02: return imm(H::pre<32, H::LHU>, pc, rD, rA, imm12);
+					// lb rD, [rA, imm12]+
+					case 0x03: return imm(H::pre<32, H::LB>, pc, rD, rA, imm12);
+					// sw rD, [rA, imm12]+
+					case 0x04: return imm(H::pre<32, H::SW>, pc, rD, rA, imm12);
+					// sh rD, [rA, imm12]+
+					case 0x05: return imm(H::pre<32, H::SH>, pc, rD, rA, imm12);
+					// lbu rD, [rA, imm12]+
+					case 0x06: return imm(H::pre<32, H::LBU>, pc, rD, rA, imm12);
+					// sb rD, [rA, imm12]+
+					case 0x07: return imm(H::pre<32, H::SB>, pc, rD, rA, imm12);
+				}
+			} break;
+		case 0x04: {
+				// b{cond}[l]
+				int32_t disp = sign_extend(((insn.bcform.Disp18_9 << 9) | insn.bcform.Disp8_0) << 1, 20);
+				return cond(H::branch<32>, pc, insn.bcform.BC, 0, pc + disp, insn.bcform.LK);
+			}
+		case 0x05: {
+				uint8_t rD = insn.iform.rD;
+				uint32_t imm16 = insn.iform.Imm16 << 16;
+				bool CU = insn.iform.CU;
+				switch(insn.iform.func3) {
+					// addis[.c] rD, imm16
+					case 0x00: return imm(H::addi<32>, pc, rD, rD, imm16, CU);
+					// cmpis.c rD, imm16
+					case 0x02: return imm(H::cmpi<32>, pc, 3, rD, imm16, CU);
+					// andis.c rD, imm16
+					case 0x04: return imm(H::bit_opi<32, std::bit_and<>>, pc, rD, rD, imm16, CU);
+					// oris.c rD, imm16
+					case 0x05: return imm(H::bit_opi<32, std::bit_or<>>, pc, rD, rD, imm16, CU);
+					// ldis rD, imm16
+					case 0x06: return imm(H::ldi<32>, pc, rD, 0, imm16);
+				}
+			} break;
+		case 0x06: {
+				uint8_t rD = insn.crform.rD;
+				uint8_t crA = insn.crform.crA;
+				switch(insn.crform.CR_OP) {
+					// mtcr rD, crA
+					case 0x00: return regs(H::mtcr, pc, rD, 0, crA);
+					// mfcr rD, crA
+					case 0x01: return regs(H::mfcr, pc, rD, 0, crA);
+					// rte
+					case 0x84: return regs(H::rte, pc, 0, 0, 0);
+				}
+			} break;
+		case 0x07: {
+				uint8_t rD = insn.rixform.rD;
+				uint8_t rA = insn.rixform.rA;
+				int32_t imm12 = sign_extend(insn.rixform.Imm12, 12);
+				switch(insn.rixform.func3) {
+					// lw rD, [rA]+, imm12
+					case 0x00: return imm(H::post<32, H::LW>, pc, rD, rA, imm12);
+					// lh rD, [rA]+, imm12
+					case 0x01: return imm(H::post<32, H::LH>, pc, rD, rA, imm12);
+					// lhu rD, [rA]+, imm12
+					case 0x02: return imm(H::post<32, H::LHU>, pc, rD, rA, imm12);
+					// lb rD, [rA]+, imm12
+					case 0x03: return imm(H::post<32, H::LB>, pc, rD, rA, imm12);
+					// sw rD, [rA]+, imm12
+					case 0x04: return imm(H::post<32, H::SW>, pc, rD, rA, imm12);
+					// sh rD, [rA]+, imm12
+					case 0x05: return imm(H::post<32, H::SH>, pc, rD, rA, imm12);
+					// lbu rD, [rA]+, imm12
+					case 0x06: return imm(H::post<32, H::LBU>, pc, rD, rA, imm12);
+					// sb rD, [rA]+, imm12
+					case 0x07: return imm(H::post<32, H::SB>, pc, rD, rA, imm12);
+				}
+			} break;
+		case 0x08:
+				// addri[.c] rD, rA, imm14
+				return imm(H::addi<32>, pc, insn.riform.rD, insn.riform.rA, sign_extend(insn.riform.Imm14, 14), insn.riform.CU);
+		case 0x0C:
+				// andri[.c] rD, rA, imm14
+				return imm(H::bit_opi<32, std::bit_and<>>, pc, insn.riform.rD, insn.riform.rA, insn.riform.Imm14, insn.riform.CU);
+		case 0x0D:
+				// orri[.c] rD, rA, imm14
+				return imm(H::bit_opi<32, std::bit_or<>>, pc, insn.riform.rD, insn.riform.rA, insn.riform.Imm14, insn.riform.CU);
+		case 0x10 ... 0x17: {
+				uint8_t rD = insn.mform.rD;
+				uint8_t rA = insn.mform.rA;
+				int32_t imm15 = sign_extend(insn.mform.Imm15, 15);
+				switch(insn.OP) {
+					// lw rD, [rA, imm15]
+					case 0x10: return imm(H::offset<32, H::LW>, pc, rD, rA, imm15);
+					// lh rD, [rA, imm15]
+					case 0x11: return imm(H::offset<32, H::LH>, pc, rD, rA, imm15);
+					// lhu rD, [rA, imm15]
+					case 0x12: return imm(H::offset<32, H::LHU>, pc, rD, rA, imm15);
+					// lb rD, [rA, imm15]
+					case 0x13: return imm(H::offset<32, H::LB>, pc, rD, rA, imm15);
+					// sw rD, [rA, imm15]
+					case 0x14: return imm(H::offset<32, H::SW>, pc, rD, rA, imm15);
+					// sh rD, [rA, imm15]
+					case 0x15: return imm(H::offset<32, H::SH>, pc, rD, rA, imm15);
+					// lbu rD, [rA, imm15]
+					case 0x16: return imm(H::offset<32, H::LBU>, pc, rD, rA, imm15);
+					// sb rD, [rA, imm15]
+					case 0x17: return imm(H::offset<32, H::SB>, pc, rD, rA, imm15);
+				}
+			} break;
+		case 0x18:
+				// cache op, [rA, imm15]
+				return regs(H::nop<32>, pc, 0, 0, 0);
+	}
+
+	return regs(H::illegal, pc, 0, 0, 0);
+}
+
+template <int I >
+DecodedInstruction BlockCache::decode16(uint16_t encoded, uint32_t pc) {
+	CPU::Instruction16 insn = encoded;
+	switch(insn.OP) {
+		case 0x00: {
+				uint8_t rD = insn.rform.rD;
+				uint8_t rA = insn.rform.rA;
+				switch(insn.rform.func4) {
+					// nop!
+					case 0x00: return regs(H::nop<I>, pc, 0, 0, 0);
+					// mlfh! rDg0, rAg1
+					case 0x01: return regs(H::mv<I>, pc, rD, 16 + rA, 0);
+					// mhfl! rDg1, rAg0
+					case 0x02: return regs(H::mv<I>, pc, 16 + rD, rA, 0);
+					// mv! rDg0, rAg0
+					case 0x03: return regs(H::mv<I>, pc, rD, rA, 0);
+					// br{cond}! rAg0
+					case 0x04: return cond(H::br<I>, pc, rD, rA, 0, false);
+					// t{cond}!
+					case 0x05: return regs(H::tcond<I>, pc, 0, 0, rD);
+					// br{cond}l! rAg0
+					case 0x0C: return cond(H::br<I>, pc, rD, rA, 0, true);
+				}
+			} break;
+		case 0x01: {
+				uint8_t rA = insn.rform.rA;
+				switch(insn.rform.func4) {
+					// mtce{lh}! rA
+					case 0x00:
+							switch(insn.rform.rD) {
+								case 0x00: return regs(H::mtcel<I>, pc, rA, 0, 0);
+								case 0x01: return regs(H::mtceh<I>, pc, rA, 0, 0);
+							}
+						return regs(H::nop<I>, pc, 0, 0, 0);
+					// mfce{lh}! rA
+					case 0x01:
+							switch(insn.rform.rD) {
+								case 0x00: return regs(H::mfcel<I>, pc, rA, 0, 0);
+								case 0x01: return regs(H::mfceh<I>, pc, rA, 0, 0);
+							}
+						return regs(H::nop<I>, pc, 0, 0, 0);
+				}
+			} break;
+		case 0x02: {
+				uint8_t rA = insn.rform.rA;
+				uint8_t rD = insn.rform.rD;
+				uint8_t rAh = insn.rhform.rA;
+				uint8_t rDh = insn.rhform.H * 16 + insn.rhform.rD;
+				switch(insn.rform.func4) {
+					// add! rDg0, rAg0
+					case 0x00: return regs(H::add<I>, pc, rD, rD, rA, true);
+					// sub! rDg0, rAg0
+					case 0x01: return regs(H::sub<I>, pc, rD, rD, rA, true);
+					// neg! rDg0, rAg0
+					case 0x02: return regs(H::neg<I>, pc, rD, 0, rA, true);
+					// cmp! rDg0, rAg0
+					case 0x03: return regs(H::cmp<I>, pc, 3, rD, rA, true);
+					// and! rDg0, rAg0
+					case 0x04: return regs(H::bit_op<I, std::bit_and<>>, pc, rD, rD, rA, true);
+					// or! rDg0, rAg0
+					case 0x05: return regs(H::bit_op<I, std::bit_or<>>, pc, rD, rD, rA, true);
+					// not! rDg0, rAg0
+					case 0x06: return imm(H::bit_opi<I, std::bit_xor<>>, pc, rD, rA, ~0, true);
+					// xor! rDg0, rAg0
+					case 0x07: return regs(H::bit_op<I, std::bit_xor<>>, pc, rD, rD, rA, true);
+					// lw! rDg0, [rAg0]
+					case 0x08: return imm(H::offset<I, H::LW>, pc, rD, rA, 0);
+					// lh! rDg0, [rAg0]
+					case 0x09: return imm(H::offset<I, H::LH>, pc, rD, rA, 0);
+					// pop! rDgh, [rAg0]
+					case 0x0A: return imm(H::post<I, H::LW>, pc, rDh, rAh, 4);
+					// lbu! rDg0, [rAg0]
+					case 0x0B: return imm(H::offset<I, H::LBU>, pc, rD, rA, 0);
+					// sw! rDg0, [rAg0]
+					case 0x0C: return imm(H::offset<I, H::SW>, pc, rD, rA, 0);
+					// sh! rDg0, [rAg0]
+					case 0x0D: return imm(H::offset<I, H::SH>, pc, rD, rA, 0);
+					// push! rDgh, [rAg0]
+					case 0x0E: return imm(H::push<I>, pc, rDh, rAh, -4);
+					// sb! rDg0, [rAg0]
+					case 0x0F: return imm(H::offset<I, H::SB>, pc, rD, rA, 0);
+				}
+			} break;
+		case 0x03:
+				// j[l]! imm11
+				return cond(H::jump<I>, pc, 0, 0, (pc & 0xFFFFF000) | (insn.jform.Disp11 << 1), insn.jform.LK);
+		case 0x04:
+				// b{cond}! imm8
+				return cond(H::branch<I>, pc, insn.bxform.EC, 0, pc + (sign_extend(insn.bxform.Imm8, 8) << 1), false);
+		case 0x05:
+				// ldiu! rD, imm8
+				return imm(H::ldi<I>, pc, insn.iform2.rD, 0, insn.iform2.Imm8);
+		case 0x06: {
+				uint8_t rD = insn.iform1.rD;
+				uint32_t imm5 = 1 << insn.iform1.Imm5;
+				switch(insn.iform1.func3) {
+					// srli! rD, imm5
+					case 0x03: return imm(H::shifti<I, &CPU::srl>, pc, rD, rD, insn.iform1.Imm5, true);
+					// bitclr! rD, imm5
+					case 0x04: return imm(H::bit_opi<I, std::bit_and<>>, pc, rD, rD, ~imm5, true);
+					// bitset! rD, imm5
+					case 0x05: return imm(H::bit_opi<I, std::bit_or<>>, pc, rD, rD, imm5, true);
+					// bittst! rD, imm5
+					case 0x06: return imm(H::tsti<I>, pc, 0, rD, imm5, true);
+				}
+			} break;
+		case 0x07: {
+				uint8_t rD = insn.iform1.rD;
+				uint32_t imm5 = insn.iform1.Imm5;
+				switch(insn.iform1.func3) {
+					// lwp! rDg0, imm
+					case 0x00: return imm(H::offset<I, H::LW>, pc, rD, 2, imm5 << 2);
+					// lhp! rDg0, imm
+					case 0x01: return imm(H::offset<I, H::LHU>, pc, rD, 2, imm5 << 1);
+					// lbup! rDg0, imm
+					case 0x03: return imm(H::offset<I, H::LBU>, pc, rD, 2, imm5);
+					// swp! rDg0, imm
+					case 0x04: return imm(H::offset<I, H::SW>, pc, rD, 2, imm5 << 2);
+					// shp! rDg0, imm
+					case 0x05: return imm(H::offset<I, H::SH>, pc, rD, 2, imm5 << 1);
+					// sbp! rDg0, imm
+					case 0x07: return imm(H::offset<I, H::SB>, pc, rD, 2, imm5);
+				}
+			} break;
+	}
+
+	return regs(H::illegal, pc, 0, 0, 0);
+}
+
+}
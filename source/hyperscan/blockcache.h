@@ -0,0 +1,191 @@
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "hyperscan/memory/segmentedmemoryregion.h"
+
+#ifndef __HYPERSCAN_BLOCKCACHE_H__
+#define __HYPERSCAN_BLOCKCACHE_H__
+
+namespace hyperscan {
+
+class CPU;
+
+/**
+ * A single instruction decoded ahead of time
+ * Operands are pre-extracted so the handler never looks at the encoding again
+ */
+struct DecodedInstruction {
+	typedef uint32_t (*Handler)(CPU &cpu, const DecodedInstruction &insn);
+
+	// Executes the instruction, returns how much PC advances (0 when jumping)
+	Handler handler;
+
+	// Address of the instruction
+	uint32_t pc;
+
+	// Sign extended immediate, branch target or memory offset
+	uint32_t imm;
+
+	// Register indexes, 16bit instructions are mapped onto the full register file
+	uint8_t rD, rA, rB;
+
+	// Flag update (.c) or link bit
+	bool CU;
+
+	// Entries occupied by this instruction (parallel pairs carry both halves after them)
+	uint8_t length;
+};
+
+/**
+ * Caches basic blocks of decoded instructions, keyed by PC
+ * Blocks are invalidated through the MIU write watcher when their code is modified
+ */
+class BlockCache {
+	public:
+		struct Block {
+			// Guest address range covered by the block [start, end)
+			uint32_t start, end;
+
+			// Instructions executed when running through the whole block
+			uint32_t count;
+
+			// Cycles the multiply and divide unit adds when running through the whole block, on top of count
+			uint32_t stalls;
+
+			// Decoded instructions, terminated by an entry that never matches a PC
+			std::vector<DecodedInstruction> instructions;
+
+			// Native translation, owned by the JIT engine
+			const void *native = nullptr;
+
+			// Loops back to its start without changing anything the next iteration depends on, but what it loads
+			// Set when decoded, see isIdleLoop()
+			bool idle = false;
+		};
+
+		BlockCache();
+
+		~BlockCache();
+
+		BlockCache(const BlockCache&) = delete;
+
+		BlockCache& operator=(const BlockCache&) = delete;
+
+		/**
+		 * Returns the decoded instruction at pc
+		 * Sequential fetches within a block are a single compare
+		 */
+		const DecodedInstruction* fetch(CPU &cpu, uint32_t pc) {
+			const DecodedInstruction *insn = next;
+			if (insn->pc != pc) {
+				insn = lookup(cpu, pc);
+			}
+
+			next = insn + insn->length;
+			return insn;
+		}
+
+		/**
+		 * Returns the first instruction of the block starting at pc, decoding it if needed
+		 */
+		const DecodedInstruction* lookup(CPU &cpu, uint32_t pc) {
+			return block(cpu, pc)->instructions.data();
+		}
+
+		/**
+		 * Returns the block starting at pc, decoding it if needed
+		 */
+		Block* block(CPU &cpu, uint32_t pc);
+
+		/**
+		 * Returns the idle loop pc is in, decoding from pc to find where it loops back to, nullptr when there is none
+		 */
+		Block* idleLoop(CPU &cpu, uint32_t pc);
+
+		/**
+		 * Whether insn loads from memory at r[rA] + imm, and does nothing else with memory
+		 */
+		[[nodiscard]]
+		static bool isLoad(const DecodedInstruction &insn);
+
+		/**
+		 * Drops every block containing address
+		 */
+		void invalidate(uint32_t address);
+
+		/**
+		 * Drops every block
+		 */
+		void clear();
+
+		// Instruction implementations
+		struct Handlers;
+
+		// Incremented every time blocks are dropped
+		uint32_t invalidations = 0;
+
+	private:
+		// How an instruction allowed in an idle loop uses its operands
+		enum class Operands {
+			// Touches nothing
+			NONE,
+			// rD = [rA + imm]
+			LOAD,
+			// rD = rA op rB, flags when CU
+			REGISTERS,
+			// rD = rA op imm, flags when CU
+			IMMEDIATE,
+			// Flags from rA op rB
+			COMPARE,
+			// Flags from rA op imm
+			COMPARE_IMMEDIATE,
+			// rD = rA
+			MOVE,
+			// rD = imm
+			LOAD_IMMEDIATE,
+		};
+
+		/**
+		 * Sets how insn uses its operands, returns false for anything not allowed in an idle loop
+		 */
+		static bool pollingOperands(const DecodedInstruction &insn, Operands &operands);
+
+		template <int I >
+		static bool pollingOperands(const DecodedInstruction &insn, Operands &operands);
+
+		/**
+		 * Whether block loops back to its start running only instructions whose results depend on nothing
+		 * but registers it does not write, registers it wrote earlier in the same iteration, and memory it loads
+		 *
+		 * Every iteration then does the same as the one before, unless what it loads changed
+		 * Registers loads are based on are written at most once, so their address is the same from one iteration to the next
+		 */
+		static bool isIdleLoop(const Block &block);
+
+		std::unique_ptr<Block> decode(CPU &cpu, uint32_t pc);
+
+		template <int I >
+		static DecodedInstruction decode16(uint16_t encoded, uint32_t pc);
+
+		static DecodedInstruction decode32(uint32_t encoded, uint32_t pc);
+
+		// Next instruction expected to run
+		const DecodedInstruction *next;
+
+		std::unordered_map<uint32_t, std::unique_ptr<Block>> blocks;
+
+		// Page -> start of every block inside the page
+		std::unordered_map<uint32_t, std::vector<uint32_t>> pages;
+
+		// Invalidated blocks may still be executing, they are freed on the next lookup
+		std::vector<std::unique_ptr<Block>> retired;
+
+		// MIU whose writes invalidate this cache
+		std::shared_ptr<memory::SegmentedMemoryRegion<8, 24>> watched;
+};
+
+}
+
+#endif
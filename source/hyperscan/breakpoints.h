@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hyperscan/memory/memoryregion.h"
+
+#ifndef __HYPERSCAN_BREAKPOINTS_H__
+#define __HYPERSCAN_BREAKPOINTS_H__
+
+namespace hyperscan {
+
+/**
+ * Set of addresses execution stops at, indexed without hashing
+ * A bitmap tells which pages hold breakpoints, each of those pages has a bit per half-word
+ */
+class Breakpoints {
+	public:
+		static constexpr unsigned PAGE_COUNT        = (1 << (32 - memory::PAGE_BITS));
+
+		// Half-words in a page, instructions are always half-word aligned
+		static constexpr unsigned SLOT_COUNT        = memory::PAGE_SIZE / 2;
+
+		// Pages are found through a table per 16MiB segment
+		static constexpr unsigned SEGMENT_BITS      = 8;
+		static constexpr unsigned SEGMENT_PAGES     = PAGE_COUNT >> SEGMENT_BITS;
+
+		void add(uint32_t address) {
+			auto &page = table(address)[index(address) & (SEGMENT_PAGES - 1)];
+			if (!page) {
+				page = std::make_unique<Page>();
+				pages[index(address)] = true;
+			}
+
+			count += !page->test(slot(address));
+			page->set(slot(address));
+		}
+
+		void remove(uint32_t address) {
+			if (!contains(address)) {
+				return;
+			}
+
+			auto &page = table(address)[index(address) & (SEGMENT_PAGES - 1)];
+			page->reset(slot(address));
+			--count;
+
+			if (page->none()) {
+				page.reset();
+				pages[index(address)] = false;
+			}
+		}
+
+		void clear() {
+			for (auto &segment : segments) {
+				segment.reset();
+			}
+
+			std::fill(pages.begin(), pages.end(), false);
+			count = 0;
+		}
+
+		[[nodiscard]]
+		bool empty() const {
+			return count == 0;
+		}
+
+		/**
+		 * Whether the page containing address holds any breakpoint
+		 */
+		[[nodiscard]]
+		bool page(uint32_t address) const {
+			return pages[index(address)];
+		}
+
+		[[nodiscard]]
+		bool contains(uint32_t address) const {
+			return page(address) && find(address)->test(slot(address));
+		}
+
+		/**
+		 * Whether any breakpoint lies in [start, end), which must not span more than a page
+		 */
+		[[nodiscard]]
+		bool any(uint32_t start, uint32_t end) const {
+			for (uint32_t address = start; address < end; address += 2) {
+				if (contains(address)) {
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+	private:
+		typedef std::bitset<SLOT_COUNT> Page;
+		typedef std::array<std::unique_ptr<Page>, SEGMENT_PAGES> Segment;
+
+		static constexpr uint32_t index(uint32_t address) {
+			return address >> memory::PAGE_BITS;
+		}
+
+		static constexpr uint32_t slot(uint32_t address) {
+			return (address & memory::PAGE_MASK) >> 1;
+		}
+
+		Segment& table(uint32_t address) {
+			auto &segment = segments[address >> (32 - SEGMENT_BITS)];
+			if (!segment) {
+				segment = std::make_unique<Segment>();
+			}
+
+			return *segment;
+		}
+
+		const Page* find(uint32_t address) const {
+			return (*segments[address >> (32 - SEGMENT_BITS)])[index(address) & (SEGMENT_PAGES - 1)].get();
+		}
+
+		std::vector<bool> pages = std::vector<bool>(PAGE_COUNT);
+		std::array<std::unique_ptr<Segment>, (1 << SEGMENT_BITS)> segments;
+		size_t count = 0;
+};
+
+}
+
+#endif
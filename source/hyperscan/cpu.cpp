@@ -1,6 +1,8 @@
 #include "cpu.h"
+#include "tracer.h"
 
 #include <cstdio>
+#include <vector>
 
 // Sign extends x to the size of b bits
 static int32_t sign_extend(uint32_t x, uint8_t b) {
@@ -12,6 +14,12 @@ static int32_t sign_extend(uint32_t x, uint8_t b) {
 
 namespace hyperscan {
 
+// Cycles between looks for an idle loop, while not in one already
+static constexpr uint64_t IDLE_PROBE_INTERVAL = 1 << 16;
+
+// Never a cycle count an iteration of the idle loop ends at
+static constexpr uint64_t IDLE_UNARMED = ~uint64_t(0);
+
 CPU::CPU() {
 	reset();
 }
@@ -24,32 +32,218 @@ void CPU::reset() {
 	CEH = 0;
 	CEL = 0;
 
+	lazy.nz = false;
+	lazy.cv = lazy.NONE;
+
 	pc = 0;
+
+	cycles = 0;
+	events.clear();
+}
+
+void CPU::forkFrom(CPU &parent) {
+	std::copy(parent.r, parent.r + 32, r);
+	std::copy(parent.cr, parent.cr + 32, cr);
+	std::copy(parent.sr, parent.sr + 32, sr);
+
+	CE = parent.CE;
+	lazy = parent.lazy;
+	pc = parent.pc;
+	cycles = parent.cycles;
+
+	miu->share(*parent.miu);
+	blocks.clear();
 }
 
 uint32_t CPU::step() {
+	run(1);
+	return pc;
+}
+
+uint32_t CPU::run(uint32_t count) {
+	uint32_t remaining = count;
+	while (remaining) {
+		if (cycles >= events.next()) [[unlikely]] {
+			events.dispatch(cycles);
+		}
+
+		// Idle loops take a cycle per instruction, skipping through them stops right on the next event
+		uint32_t slice = std::min<uint64_t>(remaining, events.next() - cycles);
+
+		// Traces have to show every instruction
+		if (skipIdle && !tracer) {
+			if (cycles >= idle.probe) [[unlikely]] {
+				probeIdle();
+			}
+
+			if (pc - idle.start < idle.end - idle.start) [[unlikely]] {
+				uint32_t skipped = spin(slice);
+				cycles += skipped;
+				remaining -= skipped;
+				if (skipped) {
+					continue;
+				}
+			}
+		}
+
+		// Stops after the instruction the next event comes due on, however large the slice is
+		remaining -= execute(slice);
+		if (breakpoints.contains(pc)) [[unlikely]] {
+			break;
+		}
+	}
+
+	return count - remaining;
+}
+
+void CPU::probeIdle() {
+	idle.probe = cycles + IDLE_PROBE_INTERVAL;
+
+	if (BlockCache::Block *loop = blocks.idleLoop(*this, pc)) {
+		idle.start = loop->start;
+		idle.end = loop->end;
+		idle.armed = IDLE_UNARMED;
+	}
+}
+
+uint32_t CPU::spin(uint32_t &slice) {
+	// The loop may have been overwritten since it was found
+	BlockCache::Block *loop = blocks.block(*this, idle.start);
+	if (!loop->idle || loop->end != idle.end) {
+		idle.start = idle.end = 0;
+		return 0;
+	}
+
+	if (pc != idle.start) {
+		idle.armed = IDLE_UNARMED;
+		slice = 1;
+		return 0;
+	}
+
+	// Loads have to be run once, what they read may have changed since the loop last ran, e.g. in an interrupt
+	if (idle.armed != cycles) {
+		idle.armed = cycles + loop->count;
+		slice = std::min(slice, loop->count);
+		return 0;
+	}
+
+	idle.armed = IDLE_UNARMED;
+	for (const DecodedInstruction &insn : loop->instructions) {
+		if (insn.length && breakpoints.contains(insn.pc)) {
+			return 0;
+		}
+
+		if (BlockCache::isLoad(insn) && !miu->steady(r[insn.rA] + insn.imm)) {
+			return 0;
+		}
+	}
+
+	// Whole iterations only, an event due in the middle of one has to fire in the middle of it
+	return slice / loop->count * loop->count;
+}
+
+uint32_t CPU::execute(uint32_t count) {
+	if (tracer) [[unlikely]] {
+		return traced(count);
+	}
+
+#if defined(HYPERSCAN_THREADED)
+	if (engine == Engine::INTERPRETER) {
+		return threaded(count);
+	}
+#endif
+
+	uint32_t remaining = count;
+	while (remaining) {
+		// Whole blocks run natively, whatever does not fit or holds a breakpoint is stepped
+		uint32_t executed = 0;
+		if (engine == Engine::JIT) {
+			executed = jit.run(*this, remaining);
+		}
+
+		if (!executed) {
+			if (engine != Engine::INTERPRETER) {
+				const DecodedInstruction *insn = blocks.fetch(*this, pc);
+				pc += insn->handler(*this, *insn);
+			} else {
+				pc += interpret();
+			}
+
+			++cycles;
+			executed = 1;
+		}
+
+		remaining -= executed;
+		if (cycles >= events.next() || breakpoints.contains(pc)) [[unlikely]] {
+			break;
+		}
+	}
+
+	return count - remaining;
+}
+
+uint32_t CPU::traced(uint32_t count) {
+	materializeFlags();
+	tracer->resume(*this);
+
+	// Journaling sends every write through the MIU, where the tracer gets to see it
+	miu->setJournal(&tracer->writes);
+
+	uint32_t executed = 0;
+	while (executed < count) {
+		uint32_t address = pc;
+		uint32_t word = fetch(pc);
+		if (engine != Engine::INTERPRETER) {
+			const DecodedInstruction *insn = blocks.fetch(*this, pc);
+			pc += insn->handler(*this, *insn);
+		} else {
+			pc += interpret();
+		}
+
+		++cycles;
+		++executed;
+		materializeFlags();
+		tracer->record(*this, address, word);
+		if (cycles >= events.next() || breakpoints.contains(pc)) [[unlikely]] {
+			break;
+		}
+	}
+
+	miu->setJournal(nullptr);
+	return executed;
+}
+
+uint32_t CPU::interpret() {
 	// Decode into a 32bit instruction or sequential/parallel 16bit instructions
-	InstructionDecoder instruction = miu->readU32(pc);
+	InstructionDecoder instruction = fetch(pc);
 
 	// We can only run a 16bit instruction when PC is non-word aligned
 	if (pc & 2) {
-		return pc += exec16<16>(instruction.low);
+		return exec16<16>(instruction.low);
 	}
 
 	// XXX: (p0 & p1) vs p0?
 	if (instruction.p0) {
-		return pc += exec32((instruction.high << 15) | instruction.low);
+		return exec32((instruction.high << 15) | instruction.low);
 	}
 
 	Instruction16 insn16 = instruction.low;
 	if (instruction.p1) {
-		return pc += exec16<32>(T ? instruction.low : instruction.high);
+		return exec16<32>(T ? instruction.low : instruction.high);
 	}
 
-	return pc += exec16<16>(insn16);
+	return exec16<16>(insn16);
 }
 
 void CPU::exception(uint8_t cause) {
+	materializeFlags();
+
+	// Save IEc and UMc into IEs and UMs, then disable interrupts in kernel mode
+	cr0 = (cr0 & ~0x0000000F) | ((cr0 << 2) & 0x0000000C);
+
+	// Save the condition flags
+	cr1 = (cr1 & ~0x000003E0) | ((cr1 << 5) & 0x000003E0);
+
 	// Set cause in cr2
 	cr2 &= ~0x00FC0000;
 	cr2 |= (cause & 0x3F) << 18;
@@ -69,6 +263,13 @@ void CPU::interrupt(uint8_t cause) {
 	exception((63 - cause) + 128);
 }
 
+void CPU::returnFromException() {
+	materializeFlags();
+
+	cr0 = (cr0 & ~0x00000003) | ((cr0 >> 2) & 0x00000003);
+	cr1 = (cr1 & ~0x0000001F) | ((cr1 >> 5) & 0x0000001F);
+}
+
 template <int I>
 uint32_t CPU::branch(uint8_t condition, uint32_t address, bool link) {
 	if (conditional(condition, true)) {
@@ -140,13 +341,13 @@ uint32_t CPU::exec32(const Instruction32 &insn) {
 					case 0x1B: rD = sra(rA, rB, insn.spform.CU); break;
 
 					// mul rA, rB
-					case 0x20: CE = std::multiplies<int64_t>()(rA, rB); break;
+					case 0x20: CE = std::multiplies<int64_t>()(rA, rB); cycles += MUL_STALL; break;
 					// mulu rA, rB
-					case 0x21: CE = std::multiplies<uint64_t>()(rA, rB); break;
+					case 0x21: CE = std::multiplies<uint64_t>()(rA, rB); cycles += MUL_STALL; break;
 					// div rA, rB
-					case 0x22: CEL = std::divides<int64_t>()(rA, rB); CEH = std::modulus<int64_t>()(rA, rB); break;
+					case 0x22: CEL = std::divides<int64_t>()(rA, rB); CEH = std::modulus<int64_t>()(rA, rB); cycles += DIV_STALL; break;
 					// divu rA, rB
-					case 0x23: CEL = std::divides<uint64_t>()(rA, rB); CEH = std::modulus<uint64_t>()(rA, rB); break;
+					case 0x23: CEL = std::divides<uint64_t>()(rA, rB); CEH = std::modulus<uint64_t>()(rA, rB); cycles += DIV_STALL; break;
 
 					// mfce{hl} rD[, rA]
 					case 0x24:
@@ -264,6 +465,7 @@ uint32_t CPU::exec32(const Instruction32 &insn) {
 				}
 			} break;
 		case 0x06: {
+				materializeFlags();
 				uint32_t &rD = r[insn.crform.rD];
 				uint32_t &crA = cr[insn.crform.crA];
 				switch(insn.crform.CR_OP) {
@@ -272,7 +474,7 @@ uint32_t CPU::exec32(const Instruction32 &insn) {
 					// mfcr rD, crA
 					case 0x01: rD = crA; break;
 					// rte
-					case 0x84: return jump<32>(cr5, false); /* TODO: missing PSR */
+					case 0x84: returnFromException(); return jump<32>(cr5, false);
 
 					default: debugDump();
 				}
@@ -479,8 +681,8 @@ uint32_t CPU::exec16(const Instruction16 &insn) {
 					case 0x0C: miu->writeU32(rA, rD); break;
 					// sh! rDg0, [rAg0]
 					case 0x0D: miu->writeU16(rA, rD); break;
-					// push! rDgh, [rAg0]
-					case 0x0E: miu->writeU32(rAh -= 4, rDh); break;
+					// push! rDgh, [rAg0] - stores rDgh as it was before rAg0 is decremented
+					case 0x0E: { uint32_t value = rDh; miu->writeU32(rAh -= 4, value); } break;
 					// sb! rDg0, [rAg0]
 					case 0x0F: miu->writeU8(rA, rD); break;
 				}
@@ -537,6 +739,7 @@ uint32_t CPU::exec16(const Instruction16 &insn) {
 }
 
 bool CPU::conditional(uint8_t pattern, bool cnt) {
+	materializeFlags();
 	switch(pattern) {
 		case 0x0: return  C;
 		case 0x1: return !C;
@@ -559,19 +762,33 @@ bool CPU::conditional(uint8_t pattern, bool cnt) {
 	return false;
 }
 
+void CPU::materializeCarry() {
+	uint32_t a = lazy.a;
+	uint32_t b = lazy.b;
+	if (lazy.cv == lazy.ADD) {
+		C = (b > (0xFFFFFFFFU - a));
+		V = (~(a ^ b) & (a ^ (a + b))) >> 31;
+	} else {
+		C = (a >= b);
+		V = ((a ^ b) & ~((a - b) ^ b)) >> 31;
+	}
+
+	lazy.cv = lazy.NONE;
+}
+
 void CPU::basic_flags(uint32_t res) {
-	N = (res >> 31);
-	Z = (res == 0);
+	lazy.result = res;
+	lazy.nz = true;
 }
 
 void CPU::cmp(uint32_t a, uint32_t b, int tcs, bool flags) {
 	if(!flags)
 		return;
 
-	sub(a, b, true);
+	uint32_t res = sub(a, b, true);
 	switch(tcs) {
-		case 0x00: T = Z; break;
-		case 0x01: T = N; break;
+		case 0x00: T = (res == 0); break;
+		case 0x01: T = (res >> 31); break;
 	}
 }
 
@@ -579,14 +796,16 @@ uint32_t CPU::add(uint32_t a, uint32_t b, bool flags) {
 	uint32_t res = a + b;
 	if(flags) {
 		basic_flags(res);
-		C = (b > (0xFFFFFFFFU - a));
-		V = (~(a ^ b) & (a ^ res)) >> 31;
+		lazy.cv = lazy.ADD;
+		lazy.a = a;
+		lazy.b = b;
 	}
 
 	return res;
 }
 
 uint32_t CPU::addc(uint32_t a, uint32_t b, bool flags) {
+	materializeFlags();
 	return add(add(a, b, false), C, flags);
 }
 
@@ -594,14 +813,16 @@ uint32_t CPU::sub(uint32_t a, uint32_t b, bool flags) {
 	uint32_t res = a - b;
 	if(flags) {
 		basic_flags(res);
-		C = (a >= b);
-	    V = ((a ^ b) & ~(res ^ b)) >> 31;
+		lazy.cv = lazy.SUB;
+		lazy.a = a;
+		lazy.b = b;
 	}
 
 	return res;
 }
 
 uint32_t CPU::subc(uint32_t a, uint32_t b, bool flags) {
+	materializeFlags();
 	return sub(sub(a, b, false), !C, flags);
 }
 
@@ -618,6 +839,7 @@ uint32_t CPU::bit_op(uint32_t a, uint32_t b, bool flags, Op op) {
 uint32_t CPU::sll(uint32_t a, uint8_t sa, bool flags) {
 	uint32_t res = a << sa;
 	if(flags) {
+		materializeFlags();
 		basic_flags(res);
 		C = a & (1 << (32 - sa));
 	}
@@ -628,6 +850,7 @@ uint32_t CPU::sll(uint32_t a, uint8_t sa, bool flags) {
 uint32_t CPU::srl(uint32_t a, uint8_t sa, bool flags) {
 	uint32_t res = a >> sa;
 	if(flags) {
+		materializeFlags();
 		basic_flags(res);
 		C = a & (1 << (sa - 1)); // XXX: Docs say this is right, but what if sa is 0?
 	}
@@ -638,6 +861,7 @@ uint32_t CPU::srl(uint32_t a, uint8_t sa, bool flags) {
 uint32_t CPU::sra(uint32_t a, uint8_t sa, bool flags) {
 	uint32_t res = int32_t(a) >> sa;
 	if(flags) {
+		materializeFlags();
 		basic_flags(res);
 		C = a & (1 << (sa - 1)); // XXX: Docs say this is right, but what if sa is 0?
 	}
@@ -646,6 +870,7 @@ uint32_t CPU::sra(uint32_t a, uint8_t sa, bool flags) {
 }
 
 void CPU::debugDump() {
+	materializeFlags();
 	printf("PC = 0x%08X                N[%c] Z[%c] C[%c] V[%c] T[%c]\n",
 		pc,
 		N ? 'x' : ' ',
@@ -662,12 +887,23 @@ void CPU::debugDump() {
 		printf("\n");
 	}
 
+	std::vector<uint8_t> dram(0x01000000);
+	miu->readBlock(0xA0000000, dram.data(), dram.size());
+
 	FILE* memdump = fopen("MEMDUMP", "wb");
-	for(int i=0; i<0x01000000; ++i)
-		fputc(miu->readU8(0xA0000000 + i), memdump);
+	fwrite(dram.data(), 1, dram.size(), memdump);
 	fclose(memdump);
 
 	exit(1);
 }
 
+// Used by the block cache handlers, which are compiled elsewhere
+template uint32_t CPU::branch<16>(uint8_t, uint32_t, bool);
+template uint32_t CPU::branch<32>(uint8_t, uint32_t, bool);
+template uint32_t CPU::jump<16>(uint32_t, bool);
+template uint32_t CPU::jump<32>(uint32_t, bool);
+template uint32_t CPU::bit_op(uint32_t, uint32_t, bool, std::bit_and<>);
+template uint32_t CPU::bit_op(uint32_t, uint32_t, bool, std::bit_or<>);
+template uint32_t CPU::bit_op(uint32_t, uint32_t, bool, std::bit_xor<>);
+
 }
@@ -1,15 +1,36 @@
 #include <cstdint>
 #include <algorithm>
 
-#include "memory/segmentedmemoryregion.h"
+#include "hyperscan/blockcache.h"
+#include "hyperscan/breakpoints.h"
+#include "hyperscan/jit/translator.h"
+#include "hyperscan/memory/segmentedmemoryregion.h"
+#include "hyperscan/scheduler.h"
 
 #ifndef __HYPERSCAN_CPU_H__
 #define __HYPERSCAN_CPU_H__
 
 namespace hyperscan {
 
+class Tracer;
+
 class CPU {
+	friend class BlockCache;
+	friend class jit::Translator;
+
 	public:
+		// Core clock of the SPG290 in a HyperScan, in cycles per second
+		static constexpr uint64_t CLOCK_RATE = 108'000'000;
+
+		enum class Engine {
+			// Fetch, decode and dispatch every instruction from memory
+			INTERPRETER,
+			// Run pre-decoded instructions from the block cache
+			CACHED,
+			// Run blocks translated to native code, falling back to the block cache
+			JIT,
+		};
+
 		union Instruction32 {
 			Instruction32(uint32_t encoded): encoded(encoded) {}
 
@@ -150,6 +171,11 @@ class CPU {
 			uint16_t encoded;
 		};
 
+		// Cycles taken by the multiply and divide unit on top of the one every instruction takes
+		// Estimates: the multiplier is pipelined, the divider makes a quotient bit per cycle
+		static constexpr uint32_t MUL_STALL = 2;
+		static constexpr uint32_t DIV_STALL = 32;
+
 		union InstructionDecoder {
 			InstructionDecoder(uint32_t encoded): encoded(encoded) {}
 
@@ -170,6 +196,13 @@ class CPU {
 		 */
 		void reset();
 
+		/**
+		 * Turns this CPU into a copy of parent, which keeps running on its own
+		 * Memory is shared copy-on-write, so the MIU has to be laid out like the parent's, e.g. built by the same code
+		 * Breakpoints, events and the selected engine are left alone, peripherals schedule their own events
+		 */
+		void forkFrom(CPU &parent);
+
 		/**
 		 * Runs a single instruction from PC
 		 * Advances PC and updates flags according to instruction
@@ -178,17 +211,113 @@ class CPU {
 		 */
 		uint32_t step();
 
+		/**
+		 * Runs up to count instructions with the selected engine, firing events as they come due
+		 * Loops polling memory are skipped through when skipIdle is set
+		 * Stops early when reaching a breakpoint, other than one at the starting PC
+		 *
+		 * Returns the number of instructions executed
+		 */
+		uint32_t run(uint32_t count);
+
 		/**
 		 * Causes an exception to fire
+		 * Interrupts are disabled and the CPU enters kernel mode, the previous mode and the flags are saved for rte
 		 */
 		void exception(uint8_t cause);
 
 		/**
-		 * Causes an interrupt to fire
+		 * Causes an interrupt to fire, unless interrupts are disabled
 		 */
 		void interrupt(uint8_t cause);
 
+		/**
+		 * Restores the mode and the flags exception() saved, as rte does before jumping back
+		 */
+		void returnFromException();
+
+		/**
+		 * Computes N, Z, C and V into cr1 from the last flag setting operation
+		 * Anything reading cr1 or the flag fields directly has to call this first
+		 */
+		void materializeFlags() {
+			if (lazy.nz) {
+				N = (lazy.result >> 31);
+				Z = (lazy.result == 0);
+				lazy.nz = false;
+			}
+
+			if (lazy.cv) {
+				materializeCarry();
+			}
+		}
+
+		/**
+		 * Reads the instruction word at address, like miu->readU32() does
+		 * Reads host memory directly while address stays in the page of the last fetch
+		 * The page is looked up again on leaving it, or once the MIU moved host memory around, e.g. on a write allocating a page
+		 */
+		[[nodiscard]]
+		uint32_t fetch(uint32_t address) {
+			if ((address & ~memory::PAGE_MASK) != code.page || code.layout != miu->layout()) [[unlikely]] {
+				code.page = address & ~memory::PAGE_MASK;
+				code.host = miu->readablePage(address);
+				code.layout = miu->layout();
+			}
+
+			uint32_t offset = address & memory::PAGE_MASK;
+			if (code.host && offset <= memory::PAGE_SIZE - 4) [[likely]] {
+				return memory::load32(code.host + offset);
+			}
+
+			return miu->readU32(address);
+		}
+
 	protected:
+		/**
+		 * Runs up to count instructions, advancing cycles as each retires
+		 * Stops at breakpoints like run(), and after the instruction the next event comes due on, without firing it
+		 *
+		 * Returns the number of instructions executed
+		 */
+		uint32_t execute(uint32_t count);
+
+		/**
+		 * Fetches, decodes and runs the instruction at PC
+		 *
+		 * Returns how much PC should advance
+		 */
+		uint32_t interpret();
+
+#if defined(HYPERSCAN_THREADED)
+		/**
+		 * Runs up to count instructions from PC through a handler table, stopping like execute()
+		 * Replaces interpret() for the interpreter engine in threaded builds
+		 *
+		 * Returns the number of instructions executed
+		 */
+		uint32_t threaded(uint32_t count);
+#endif
+
+		/**
+		 * Runs up to count instructions one at a time, recording each with the tracer, stopping like execute()
+		 * Replaces every engine while a tracer is set, native blocks would hide what each instruction did
+		 *
+		 * Returns the number of instructions executed
+		 */
+		uint32_t traced(uint32_t count);
+
+		/**
+		 * Looks for an idle loop around PC, for run() to skip through
+		 */
+		void probeIdle();
+
+		/**
+		 * Called by run() with PC in the idle loop, returns how many of up to slice instructions were skipped
+		 * Until PC is at the start of the loop, having just run a whole iteration, skips nothing and lowers slice to get there
+		 */
+		uint32_t spin(uint32_t &slice);
+
 		template <int I>
 		uint32_t exec16(const Instruction16 &insn);
 
@@ -224,6 +353,8 @@ class CPU {
 		uint32_t sra(uint32_t a, uint8_t sa, bool flags);
 
 	private:
+		void materializeCarry();
+
 		void debugDump();
 
 	public:
@@ -305,11 +436,67 @@ class CPU {
 			};
 		};
 
+		// Flags not yet computed into cr1, see materializeFlags()
+		struct {
+			// N and Z come from result
+			bool nz = false;
+
+			// C and V come from the operands of an add or sub
+			enum : uint8_t { NONE, ADD, SUB } cv = NONE;
+
+			uint32_t result, a, b;
+		} lazy;
+
 		// Program Counter
 		uint32_t pc;
 
+		// Page of the last instruction fetch, see fetch()
+		struct {
+			// Never page aligned until the first fetch
+			uint32_t page = 1;
+			const uint8_t *host = nullptr;
+			uint64_t layout = 0;
+		} code;
+
+		// Loop polling memory found by probeIdle(), see spin()
+		struct {
+			// Address range of the loop, empty when there is none
+			uint32_t start = 0, end = 0;
+
+			// Cycle count once the iteration running from the start of the loop is done, all ones when none is running
+			uint64_t armed = ~uint64_t(0);
+
+			// Cycle count of the next probe
+			uint64_t probe = 0;
+		} idle;
+
+		// Cycles elapsed since reset, advanced by the engines as each instruction retires
+		uint64_t cycles;
+
+		// Deadlines peripherals registered, in cycles
+		Scheduler events;
+
 		// Memory interfacing unit
 		std::shared_ptr<memory::SegmentedMemoryRegion<8, 24>> miu;
+
+		// Execution engine used by step() and run()
+		Engine engine = Engine::CACHED;
+
+		// Lets run() skip ahead through loops that only poll memory, to the next event or as far as it may run
+		// Skipped iterations count as executed, and leave the CPU as running them would have
+		bool skipIdle = true;
+
+		// Decoded basic blocks
+		BlockCache blocks;
+
+		// Native translations of blocks
+		jit::Translator jit;
+
+		// Addresses run() stops at
+		Breakpoints breakpoints;
+
+		// Records every instruction run when set, outlives the CPU or is unset first
+		Tracer *tracer = nullptr;
 };
 
 }
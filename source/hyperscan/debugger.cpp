@@ -10,12 +10,10 @@
 
 #include "hyperscan/debugger.h"
 #include "hyperscan/disasm.h"
+#include "hyperscan/savestate.h"
 
 using namespace hyperscan;
 
-bool debugger = false;
-uint32_t memory_view_address = 0xa0000000;
-std::unordered_map<uint32_t, bool> breakpoints = {};
 std::unordered_map<uint32_t, std::string> aliases = {};
 
 uint32_t parse_address(const std::string &str, CPU* cpu) {
@@ -30,60 +28,68 @@ uint32_t parse_address(const std::string &str, CPU* cpu) {
 	}
 }
 
-const std::map<const std::string, std::function<void(std::vector<std::string>, CPU*)> > COMMAND_TABLE
-		{{"",[](auto, auto cpu) {
+const std::map<const std::string, std::function<void(std::vector<std::string>, Debugger*, CPU*)> > COMMAND_TABLE
+		{{"",[](auto, auto, auto cpu) {
 			cpu->step();
 		}},
-		{"c", [](auto, auto) {
-			debugger_disable();
+		{"c", [](auto, auto debugger, auto) {
+			debugger_disable(*debugger);
 		}},
-		{"r", [](auto arguments, auto cpu) {
+		{"r", [](auto arguments, auto, auto cpu) {
 			uint32_t cycles = std::stol(arguments[0]);
 			while (cycles--) {
 				cpu->step();
 			}
 		}},
-		{"b",  [](auto arguments, auto cpu) {
+		{"b",  [](auto arguments, auto debugger, auto cpu) {
 			if (arguments.empty()) {
-				return debugger_breakpoint_toggle(cpu->pc, false);
+				return debugger_breakpoint_toggle(*debugger, *cpu, cpu->pc, false);
 			}
 
 			for (const auto& arg : arguments) {
-				debugger_breakpoint_toggle(parse_address(arg, cpu), false);
+				debugger_breakpoint_toggle(*debugger, *cpu, parse_address(arg, cpu), false);
 			}
 		}},
-		{"j",  [](auto arguments, auto cpu) {
-			debugger_breakpoint_add(parse_address(arguments[0], cpu), true);
-			debugger_disable();
+		{"j",  [](auto arguments, auto debugger, auto cpu) {
+			debugger_breakpoint_add(*debugger, *cpu, parse_address(arguments[0], cpu), true);
+			debugger_disable(*debugger);
 		}},
-		{"m", [](auto arguments, auto cpu) {
-			debugger_view_memory(parse_address(arguments[0], cpu));
+		{"m", [](auto arguments, auto debugger, auto cpu) {
+			debugger_view_memory(*debugger, parse_address(arguments[0], cpu));
 		}},
-		{"i", [](auto arguments, auto cpu) {
+		{"i", [](auto arguments, auto, auto cpu) {
 			cpu->interrupt(std::stol(arguments[0]));
 		}},
-		{"so", [](auto, auto cpu) {
-			CPU::InstructionDecoder instruction = cpu->miu->readU32(cpu->pc - (cpu->pc & 2));
+		{"so", [](auto, auto debugger, auto cpu) {
+			CPU::InstructionDecoder instruction = cpu->fetch(cpu->pc - (cpu->pc & 2));
 
-			debugger_breakpoint_add(cpu->pc + (instruction.p0 * 2) + 2, true);
-			debugger_disable();
+			debugger_breakpoint_add(*debugger, *cpu, cpu->pc + (instruction.p0 * 2) + 2, true);
+			debugger_disable(*debugger);
 		}},
-		{"sb", [](auto arguments, auto cpu) {
+		{"sb", [](auto arguments, auto, auto cpu) {
 			cpu->miu->writeU8(parse_address(arguments[0], cpu), parse_address(arguments[1], cpu));
 		}},
-		{"sh", [](auto arguments, auto cpu) {
+		{"sh", [](auto arguments, auto, auto cpu) {
 			cpu->miu->writeU16(parse_address(arguments[0], cpu), parse_address(arguments[1], cpu));
 		}},
-		{"sw", [](auto arguments, auto cpu) {
+		{"sw", [](auto arguments, auto, auto cpu) {
 			cpu->miu->writeU32(parse_address(arguments[0], cpu), parse_address(arguments[1], cpu));
 		}},
-		{"dump", [](auto arguments, auto cpu) {
+		{"dump", [](auto arguments, auto, auto cpu) {
+			std::vector<uint8_t> dram(0x01000000);
+			cpu->miu->readBlock(0xA0000000, dram.data(), dram.size());
+
 			FILE* memdump = fopen(arguments[0].c_str(), "wb");
-			for(int i=0; i<0x01000000; ++i)
-				fputc(cpu->miu->readU8(0xA0000000 + i), memdump);
+			fwrite(dram.data(), 1, dram.size(), memdump);
 			fclose(memdump);
 		}},
-		{"q", [](auto, auto) {
+		{"save", [](auto arguments, auto, auto cpu) {
+			savestate_save(*cpu, arguments[0].c_str());
+		}},
+		{"load", [](auto arguments, auto, auto cpu) {
+			savestate_load(*cpu, arguments[0].c_str());
+		}},
+		{"q", [](auto, auto, auto) {
 			exit(0);
 		}},
 };
@@ -146,19 +152,22 @@ void draw_memory(int x, int y, int h, const CPU &cpu, uint32_t startAddress) {
 	for (int i = 0; i < h; ++i) {
 		move(x, y + i);
 
+		uint8_t row[16];
+		cpu.miu->readBlock(startAddress + (i * 16), row, sizeof(row));
+
 		printf("\033[37m%08x\033[39m:  ", startAddress + (i * 16));
 		for (int ii = 0; ii < 16; ++ii) {
 			if (ii == 8) {
 				printf(" ");
 			}
 
-			uint8_t byte = cpu.miu->readU8(startAddress + (i * 16) + ii);
+			uint8_t byte = row[ii];
 			printf("%s%02x\033[39m ", get_byte_color(byte), byte);
 		}
 
 		printf(" ");
 		for (int ii = 0; ii < 16; ++ii) {
-			uint8_t byte = cpu.miu->readU8(startAddress + (i * 16) + ii);
+			uint8_t byte = row[ii];
 			printf("%s%c\033[39m", get_byte_color(byte), (byte > 0x19 && byte < 0x7E) ? byte : '.');
 		}
 	}
@@ -188,7 +197,7 @@ void draw_stack(size_t x, size_t y, size_t h, const CPU &cpu) {
 	}
 }
 
-void draw_code(int x, int y, int lines, const CPU &cpu, uint32_t address, int lookback = 0) {
+void draw_code(int x, int y, int lines, CPU &cpu, uint32_t address, int lookback = 0) {
 	while (lookback--) {
 		address -= 4;
 		if ((~cpu.miu->readU16(address) & 0x8000) || (address & 2) >> 1) {
@@ -199,11 +208,11 @@ void draw_code(int x, int y, int lines, const CPU &cpu, uint32_t address, int lo
 	for (int i = 0; i < lines; ++i) {
 		move(x, y + i);
 
-		CPU::InstructionDecoder instruction = cpu.miu->readU32(address - (address & 2));
+		CPU::InstructionDecoder instruction = cpu.fetch(address - (address & 2));
 
 		if (address == cpu.pc || (address - (address & 2) == cpu.pc && instruction.p1)) {
 			printf("▶ \033[44m");
-		} else if (breakpoints.contains(address)) {
+		} else if (cpu.breakpoints.contains(address)) {
 			printf("\033[31m●\033[39m \033[41m");
 		} else {
 			printf("  ");
@@ -223,30 +232,44 @@ void draw_code(int x, int y, int lines, const CPU &cpu, uint32_t address, int lo
 	}
 }
 
-void debugger_breakpoint_add(uint32_t address, bool one_shot) {
-	breakpoints.insert({address, one_shot});
+void debugger_breakpoint_add(Debugger &debugger, CPU &cpu, uint32_t address, bool one_shot) {
+	if (cpu.breakpoints.contains(address)) {
+		return;
+	}
+
+	cpu.breakpoints.add(address);
+	if (one_shot) {
+		debugger.oneShots.add(address);
+	}
 }
 
-void debugger_breakpoint_toggle(uint32_t address, bool one_shot) {
-	if (!breakpoints.insert({address, one_shot}).second) {
-		debugger_breakpoint_remove(address);
+void debugger_breakpoint_toggle(Debugger &debugger, CPU &cpu, uint32_t address, bool one_shot) {
+	if (cpu.breakpoints.contains(address)) {
+		debugger_breakpoint_remove(debugger, cpu, address);
+	} else {
+		debugger_breakpoint_add(debugger, cpu, address, one_shot);
 	}
 }
 
-void debugger_breakpoint_remove(uint32_t address) {
-	breakpoints.erase(address);
+void debugger_breakpoint_remove(Debugger &debugger, CPU &cpu, uint32_t address) {
+	cpu.breakpoints.remove(address);
+	debugger.oneShots.remove(address);
+}
+
+void debugger_enable(Debugger &debugger) {
+	debugger.attached = true;
 }
 
-void debugger_enable() {
-	debugger = true;
+void debugger_disable(Debugger &debugger) {
+	debugger.attached = false;
 }
 
-void debugger_disable() {
-	debugger = false;
+bool debugger_attached(const Debugger &debugger) {
+	return debugger.attached;
 }
 
-void debugger_view_memory(uint32_t address) {
-	memory_view_address = address;
+void debugger_view_memory(Debugger &debugger, uint32_t address) {
+	debugger.memoryView = address;
 }
 
 void debugger_load_mapping(const char *filename) {
@@ -287,15 +310,15 @@ std::string debugger_get_alias(uint32_t address) {
 	return aliases[address];
 }
 
-void debugger_loop(CPU &cpu) {
-	if (!debugger) {
-		if (!breakpoints.contains(cpu.pc)) {
+void debugger_loop(Debugger &debugger, CPU &cpu) {
+	if (!debugger.attached) {
+		if (!cpu.breakpoints.contains(cpu.pc)) {
 			return;
 		}
 
-		debugger_enable();
-		if (breakpoints[cpu.pc]) {
-			debugger_breakpoint_remove(cpu.pc);
+		debugger_enable(debugger);
+		if (debugger.oneShots.contains(cpu.pc)) {
+			debugger_breakpoint_remove(debugger, cpu, cpu.pc);
 		}
 	}
 
@@ -305,10 +328,11 @@ void debugger_loop(CPU &cpu) {
 	atexit([](){ printf("\033[?1049l"); });
 
 	draw_border();
-	while (debugger) {
+	while (debugger.attached) {
+		cpu.materializeFlags();
 		draw_stack(145, 2, 40, cpu);
 		draw_registers(2, 33, cpu);
-		draw_memory(65, 2, 40, cpu, memory_view_address);
+		draw_memory(65, 2, 40, cpu, debugger.memoryView);
 
 		draw_code(3, 2, 31, cpu, cpu.pc, 31 / 2);
 
@@ -327,7 +351,7 @@ void debugger_loop(CPU &cpu) {
 		std::copy(iter, std::istream_iterator<std::string>(), std::back_inserter(arguments));
 
 		if (COMMAND_TABLE.contains(cmd)) {
-			COMMAND_TABLE.at(cmd)(arguments, &cpu);
+			COMMAND_TABLE.at(cmd)(arguments, &debugger, &cpu);
 		}
 	}
 
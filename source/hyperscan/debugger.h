@@ -1,19 +1,47 @@
+#include <cstdint>
+#include <string>
+
+#include "hyperscan/breakpoints.h"
 #include "hyperscan/cpu.h"
 
-void debugger_breakpoint_add(uint32_t address, bool one_shot);
+#ifndef __HYPERSCAN_DEBUGGER_H__
+#define __HYPERSCAN_DEBUGGER_H__
+
+/**
+ * Debugger state of a single machine
+ */
+struct Debugger {
+	// Whether the debugger needs to see every instruction
+	bool attached = false;
+
+	// Start of the memory view
+	uint32_t memoryView = 0xa0000000;
+
+	// Breakpoints themselves live in the CPU, these are removed when hit
+	hyperscan::Breakpoints oneShots;
+};
 
-void debugger_breakpoint_toggle(uint32_t address, bool one_shot);
+void debugger_breakpoint_add(Debugger &debugger, hyperscan::CPU &cpu, uint32_t address, bool one_shot);
 
-void debugger_breakpoint_remove(uint32_t address);
+void debugger_breakpoint_toggle(Debugger &debugger, hyperscan::CPU &cpu, uint32_t address, bool one_shot);
 
-void debugger_enable();
+void debugger_breakpoint_remove(Debugger &debugger, hyperscan::CPU &cpu, uint32_t address);
 
-void debugger_disable();
+void debugger_enable(Debugger &debugger);
 
-void debugger_loop(hyperscan::CPU &cpu);
+void debugger_disable(Debugger &debugger);
 
-void debugger_view_memory(uint32_t address);
+// Whether the debugger needs to see every instruction
+// Otherwise it only has to be given a look when CPU::run() stops at a breakpoint
+bool debugger_attached(const Debugger &debugger);
 
+void debugger_loop(Debugger &debugger, hyperscan::CPU &cpu);
+
+void debugger_view_memory(Debugger &debugger, uint32_t address);
+
+// Aliases name addresses of the firmware, they are shared by every machine
 void debugger_load_mapping(const char *filename);
 
 std::string debugger_get_alias(uint32_t address);
+
+#endif
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cstdio>
+
+#include "hyperscan/differential.h"
+#include "hyperscan/disasm.h"
+#include "hyperscan/io/uart.h"
+
+namespace hyperscan {
+
+static const char* engine_name(CPU::Engine engine) {
+	switch (engine) {
+		case CPU::Engine::INTERPRETER:
+			return "interpreter";
+		case CPU::Engine::CACHED:
+			return "cached";
+		case CPU::Engine::JIT:
+			return "jit";
+	}
+
+	return "?";
+}
+
+Differential::Differential(Machine &reference, CPU::Engine engine, uint32_t interval):
+	reference(reference), candidate(reference.fork()), interval(std::max(1u, interval)) {
+	candidate->cpu.engine = engine;
+	candidate->io->uart->setSink([](uint8_t) {});
+}
+
+uint32_t Differential::run(uint32_t count) {
+	CPU &ours = reference.cpu;
+	CPU &theirs = candidate->cpu;
+
+	// Writes go to both the journal and memory
+	ours.miu->setJournal(&referenceWrites);
+	theirs.miu->setJournal(&candidateWrites);
+
+	uint32_t done = 0;
+	while (done < count && !divergence) {
+		uint32_t slice = std::min(interval, count - done);
+
+		pcs.clear();
+		bool stopped = false;
+		while (pcs.size() < slice && !stopped) {
+			pcs.push_back(ours.pc);
+			ours.run(1);
+			stopped = ours.breakpoints.contains(ours.pc);
+		}
+
+		theirs.run(pcs.size());
+		done += pcs.size();
+
+		divergence = !compare();
+		agreed += divergence ? 0 : pcs.size();
+
+		referenceWrites.clear();
+		candidateWrites.clear();
+		if (stopped) {
+			break;
+		}
+	}
+
+	ours.miu->setJournal(nullptr);
+	theirs.miu->setJournal(nullptr);
+
+	return done;
+}
+
+/**
+ * Reports every register of a file that differs
+ */
+static void compare_file(const char *name, const uint32_t *ours, const uint32_t *theirs, unsigned count,
+						 const char *reference, const char *candidate) {
+	for (unsigned i = 0; i < count; ++i) {
+		if (ours[i] != theirs[i]) {
+			fprintf(stderr, "  %s%-2u %s[%08X] %s[%08X]\n", name, i, reference, ours[i], candidate, theirs[i]);
+		}
+	}
+}
+
+bool Differential::compare() {
+	CPU &ours = reference.cpu;
+	CPU &theirs = candidate->cpu;
+
+	ours.materializeFlags();
+	theirs.materializeFlags();
+
+	if (std::equal(ours.r, ours.r + 32, theirs.r) && std::equal(ours.cr, ours.cr + 32, theirs.cr) &&
+		std::equal(ours.sr, ours.sr + 3, theirs.sr) && ours.CE == theirs.CE &&
+		ours.pc == theirs.pc && ours.cycles == theirs.cycles && referenceWrites == candidateWrites) {
+		return true;
+	}
+
+	const char *oursName = engine_name(ours.engine);
+	const char *theirsName = engine_name(theirs.engine);
+
+	fprintf(stderr, "differential: %s and %s diverge after %llu instructions, in the last %zu:\n",
+			oursName, theirsName, (unsigned long long) agreed, pcs.size());
+	fflush(stderr);
+
+	for (uint32_t address : pcs) {
+		CPU::InstructionDecoder instruction = ours.fetch(address - (address & 2));
+
+		printf("%08X: ", address);
+		if (instruction.p0 && !(address & 2)) {
+			disasm32((instruction.high << 15) | instruction.low, address);
+		} else {
+			disasm16((address & 2) ? instruction.high : instruction.low, address);
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+
+	compare_file("r", ours.r, theirs.r, 32, oursName, theirsName);
+	compare_file("cr", ours.cr, theirs.cr, 32, oursName, theirsName);
+	compare_file("sr", ours.sr, theirs.sr, 3, oursName, theirsName);
+	compare_file("pc", &ours.pc, &theirs.pc, 1, oursName, theirsName);
+
+	if (ours.CE != theirs.CE) {
+		fprintf(stderr, "  CE %s[%016llX] %s[%016llX]\n",
+				oursName, (unsigned long long) ours.CE, theirsName, (unsigned long long) theirs.CE);
+	}
+
+	if (ours.cycles != theirs.cycles) {
+		fprintf(stderr, "  cycles %s[%llu] %s[%llu]\n",
+				oursName, (unsigned long long) ours.cycles, theirsName, (unsigned long long) theirs.cycles);
+	}
+
+	for (size_t i = 0; i < std::max(referenceWrites.size(), candidateWrites.size()); ++i) {
+		if (i >= referenceWrites.size() || i >= candidateWrites.size() || referenceWrites[i] != candidateWrites[i]) {
+			fprintf(stderr, "  write #%zu differs (%s %zu writes, %s %zu writes)\n",
+					i, oursName, referenceWrites.size(), theirsName, candidateWrites.size());
+
+			if (i < referenceWrites.size()) {
+				fprintf(stderr, "    %s [%08X]=%08X\n", oursName, referenceWrites[i].address, referenceWrites[i].value);
+			}
+			if (i < candidateWrites.size()) {
+				fprintf(stderr, "    %s [%08X]=%08X\n", theirsName, candidateWrites[i].address, candidateWrites[i].value);
+			}
+			break;
+		}
+	}
+
+	return false;
+}
+
+}
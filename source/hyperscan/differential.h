@@ -0,0 +1,71 @@
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "hyperscan/cpu.h"
+#include "hyperscan/machine.h"
+
+#ifndef __HYPERSCAN_DIFFERENTIAL_H__
+#define __HYPERSCAN_DIFFERENTIAL_H__
+
+namespace hyperscan {
+
+/**
+ * Runs a machine alongside a fork of itself using another engine, comparing the two as they go
+ * The machine is the reference, run an instruction at a time with its own engine
+ * The fork is the candidate, run as far at once as the interval allows, so faster engines get to run whole blocks
+ *
+ * After every interval, registers, flags, PC, cycles and the memory written are compared
+ * The first difference is reported along with the instructions run since the last comparison
+ */
+class Differential {
+	public:
+		typedef memory::SegmentedMemoryRegion<8, 24>::Write Write;
+
+		/**
+		 * Forks reference into a candidate running engine, comparing every interval instructions
+		 * The candidate's UART goes nowhere, what it sends is compared as writes
+		 */
+		Differential(Machine &reference, CPU::Engine engine, uint32_t interval = 1);
+
+		/**
+		 * Runs up to count instructions on both machines
+		 * Stops early on a difference, or when the reference reaches a breakpoint
+		 *
+		 * Returns the number of instructions executed
+		 */
+		uint32_t run(uint32_t count);
+
+		/**
+		 * Whether the machines went different ways, they are left as they were when found out
+		 */
+		[[nodiscard]]
+		bool diverged() const {
+			return divergence;
+		}
+
+	private:
+		/**
+		 * Returns whether both machines agree, reporting what does not otherwise
+		 */
+		bool compare();
+
+		Machine &reference;
+		std::unique_ptr<Machine> candidate;
+		uint32_t interval;
+
+		// Instructions both machines agreed on so far
+		uint64_t agreed = 0;
+
+		// Where the reference went since the last comparison
+		std::vector<uint32_t> pcs;
+
+		std::vector<Write> referenceWrites;
+		std::vector<Write> candidateWrites;
+
+		bool divergence = false;
+};
+
+}
+
+#endif
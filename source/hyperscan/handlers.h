@@ -0,0 +1,313 @@
+#include <functional>
+
+#include "hyperscan/blockcache.h"
+#include "hyperscan/cpu.h"
+
+#ifndef __HYPERSCAN_HANDLERS_H__
+#define __HYPERSCAN_HANDLERS_H__
+
+// Sign extends x to the size of b bits
+static inline int32_t sign_extend(uint32_t x, uint8_t b) {
+	uint32_t m = 1UL << (b - 1);
+
+	x = x & ((1UL << b) - 1);
+	return (x ^ m) - m;
+}
+
+namespace hyperscan {
+
+/**
+ * Instruction handlers
+ * I is the width of the encoding being executed, as with CPU::exec16
+ */
+struct BlockCache::Handlers {
+	enum Access { LW, LH, LHU, LB, LBU, SW, SH, SB };
+
+	template <Access A >
+	static void access(CPU &cpu, uint32_t address, uint32_t &rD) {
+		if constexpr (A == LW)  rD = cpu.miu->readU32(address);
+		if constexpr (A == LH)  rD = sign_extend(cpu.miu->readU16(address), 16);
+		if constexpr (A == LHU) rD = cpu.miu->readU16(address);
+		if constexpr (A == LB)  rD = sign_extend(cpu.miu->readU8(address), 8);
+		if constexpr (A == LBU) rD = cpu.miu->readU8(address);
+		if constexpr (A == SW)  cpu.miu->writeU32(address, rD);
+		if constexpr (A == SH)  cpu.miu->writeU16(address, rD);
+		if constexpr (A == SB)  cpu.miu->writeU8(address, rD);
+	}
+
+	static uint32_t interpret(CPU &cpu, const DecodedInstruction &) {
+		return cpu.interpret();
+	}
+
+	static uint32_t illegal(CPU &cpu, const DecodedInstruction &) {
+		cpu.debugDump();
+		return 0;
+	}
+
+	static uint32_t parallel(CPU &cpu, const DecodedInstruction &insn) {
+		const DecodedInstruction &half = (&insn)[cpu.T ? 1 : 2];
+		return half.handler(cpu, half);
+	}
+
+	template <int I >
+	static uint32_t nop(CPU &, const DecodedInstruction &) {
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t jump(CPU &cpu, const DecodedInstruction &insn) {
+		return cpu.jump<I>(insn.imm, insn.CU);
+	}
+
+	template <int I >
+	static uint32_t branch(CPU &cpu, const DecodedInstruction &insn) {
+		return cpu.branch<I>(insn.rB, insn.imm, insn.CU);
+	}
+
+	template <int I >
+	static uint32_t br(CPU &cpu, const DecodedInstruction &insn) {
+		return cpu.branch<I>(insn.rB, cpu.r[insn.rA], insn.CU);
+	}
+
+	static uint32_t rte(CPU &cpu, const DecodedInstruction &) {
+		cpu.returnFromException();
+		return cpu.jump<32>(cpu.cr5, false);
+	}
+
+	template <int I >
+	static uint32_t add(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.add(cpu.r[insn.rA], cpu.r[insn.rB], insn.CU);
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t addi(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.add(cpu.r[insn.rA], insn.imm, insn.CU);
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t addc(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.addc(cpu.r[insn.rA], cpu.r[insn.rB], insn.CU);
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t sub(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.sub(cpu.r[insn.rA], cpu.r[insn.rB], insn.CU);
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t subc(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.subc(cpu.r[insn.rA], cpu.r[insn.rB], insn.CU);
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t neg(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.sub(0, cpu.r[insn.rB], insn.CU);
+		return I / 8;
+	}
+
+	// rD holds the T condition select
+	template <int I >
+	static uint32_t cmp(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.cmp(cpu.r[insn.rA], cpu.r[insn.rB], insn.rD, insn.CU);
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t cmpi(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.cmp(cpu.r[insn.rA], insn.imm, insn.rD, insn.CU);
+		return I / 8;
+	}
+
+	template <int I, typename Op >
+	static uint32_t bit_op(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.bit_op(cpu.r[insn.rA], cpu.r[insn.rB], insn.CU, Op());
+		return I / 8;
+	}
+
+	template <int I, typename Op >
+	static uint32_t bit_opi(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.bit_op(cpu.r[insn.rA], insn.imm, insn.CU, Op());
+		return I / 8;
+	}
+
+	// bittst, flags only
+	template <int I >
+	static uint32_t tsti(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.bit_op(cpu.r[insn.rA], insn.imm, insn.CU, std::bit_and());
+		return I / 8;
+	}
+
+	// Shift amount from register rB
+	template <int I, uint32_t (CPU::*Shift)(uint32_t, uint8_t, bool) >
+	static uint32_t shift(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = (cpu.*Shift)(cpu.r[insn.rA], cpu.r[insn.rB], insn.CU);
+		return I / 8;
+	}
+
+	// Shift amount from imm
+	template <int I, uint32_t (CPU::*Shift)(uint32_t, uint8_t, bool) >
+	static uint32_t shifti(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = (cpu.*Shift)(cpu.r[insn.rA], insn.imm, insn.CU);
+		return I / 8;
+	}
+
+	static uint32_t mul(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.CE = std::multiplies<int64_t>()(cpu.r[insn.rA], cpu.r[insn.rB]);
+		cpu.cycles += CPU::MUL_STALL;
+		return 32 / 8;
+	}
+
+	static uint32_t mulu(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.CE = std::multiplies<uint64_t>()(cpu.r[insn.rA], cpu.r[insn.rB]);
+		cpu.cycles += CPU::MUL_STALL;
+		return 32 / 8;
+	}
+
+	static uint32_t div(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.CEL = std::divides<int64_t>()(cpu.r[insn.rA], cpu.r[insn.rB]);
+		cpu.CEH = std::modulus<int64_t>()(cpu.r[insn.rA], cpu.r[insn.rB]);
+		cpu.cycles += CPU::DIV_STALL;
+		return 32 / 8;
+	}
+
+	static uint32_t divu(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.CEL = std::divides<uint64_t>()(cpu.r[insn.rA], cpu.r[insn.rB]);
+		cpu.CEH = std::modulus<uint64_t>()(cpu.r[insn.rA], cpu.r[insn.rB]);
+		cpu.cycles += CPU::DIV_STALL;
+		return 32 / 8;
+	}
+
+	template <int I >
+	static uint32_t mfcel(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.CEL;
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t mfceh(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.CEH;
+		return I / 8;
+	}
+
+	static uint32_t mfcehl(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.CEH;
+		cpu.r[insn.rA] = cpu.CEL;
+		return 32 / 8;
+	}
+
+	template <int I >
+	static uint32_t mtcel(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.CEL = cpu.r[insn.rD];
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t mtceh(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.CEH = cpu.r[insn.rD];
+		return I / 8;
+	}
+
+	static uint32_t mtcehl(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.CEH = cpu.r[insn.rD];
+		cpu.CEL = cpu.r[insn.rA];
+		return 32 / 8;
+	}
+
+	static uint32_t mfsr(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.sr[insn.rB];
+		return 32 / 8;
+	}
+
+	static uint32_t mtsr(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.sr[insn.rB] = cpu.r[insn.rA];
+		return 32 / 8;
+	}
+
+	// rB holds the crA index
+	static uint32_t mtcr(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.materializeFlags();
+		cpu.cr[insn.rB] = cpu.r[insn.rD];
+		return 32 / 8;
+	}
+
+	static uint32_t mfcr(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.materializeFlags();
+		cpu.r[insn.rD] = cpu.cr[insn.rB];
+		return 32 / 8;
+	}
+
+	template <int I >
+	static uint32_t tcond(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.T = cpu.conditional(insn.rB);
+		return I / 8;
+	}
+
+	static uint32_t mvcond(CPU &cpu, const DecodedInstruction &insn) {
+		if (cpu.conditional(insn.rB)) cpu.r[insn.rD] = cpu.r[insn.rA];
+		return 32 / 8;
+	}
+
+	template <int I >
+	static uint32_t mv(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = cpu.r[insn.rA];
+		return I / 8;
+	}
+
+	template <int I >
+	static uint32_t ldi(CPU &cpu, const DecodedInstruction &insn) {
+		cpu.r[insn.rD] = insn.imm;
+		return I / 8;
+	}
+
+	template <uint8_t bits >
+	static uint32_t exts(CPU &cpu, const DecodedInstruction &insn) {
+		uint32_t &rD = cpu.r[insn.rD];
+		rD = sign_extend(cpu.r[insn.rA], bits);
+		if (insn.CU) cpu.basic_flags(rD);
+		return 32 / 8;
+	}
+
+	// [rA, imm]+
+	template <int I, Access A >
+	static uint32_t pre(CPU &cpu, const DecodedInstruction &insn) {
+		uint32_t &rA = cpu.r[insn.rA];
+		rA += insn.imm;
+		access<A>(cpu, rA, cpu.r[insn.rD]);
+		return I / 8;
+	}
+
+	// [rA]+, imm
+	template <int I, Access A >
+	static uint32_t post(CPU &cpu, const DecodedInstruction &insn) {
+		uint32_t &rA = cpu.r[insn.rA];
+		access<A>(cpu, rA, cpu.r[insn.rD]);
+		rA += insn.imm;
+		return I / 8;
+	}
+
+	// push!, rD is read before rA is decremented
+	template <int I >
+	static uint32_t push(CPU &cpu, const DecodedInstruction &insn) {
+		uint32_t value = cpu.r[insn.rD];
+		uint32_t &rA = cpu.r[insn.rA];
+		rA += insn.imm;
+		access<SW>(cpu, rA, value);
+		return I / 8;
+	}
+
+	// [rA, imm]
+	template <int I, Access A >
+	static uint32_t offset(CPU &cpu, const DecodedInstruction &insn) {
+		access<A>(cpu, cpu.r[insn.rA] + insn.imm, cpu.r[insn.rD]);
+		return I / 8;
+	}
+};
+
+}
+
+#endif
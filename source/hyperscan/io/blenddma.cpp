@@ -0,0 +1,222 @@
+#include "hyperscan/cpu.h"
+#include "hyperscan/io/blenddma.h"
+#include "hyperscan/io/interruptcontroller.h"
+
+namespace hyperscan::io {
+
+// Register indices
+static constexpr unsigned SRCA_ADDR = 0x0000 / 4;
+static constexpr unsigned DEST_ADDR = 0x0008 / 4;
+static constexpr unsigned WIDTH_HEIGH = 0x000C / 4;
+static constexpr unsigned FILL_PAT = 0x0010 / 4;
+static constexpr unsigned CONTROL_1 = 0x0014 / 4;
+static constexpr unsigned IRQ_CONTROL = 0x0018 / 4;
+static constexpr unsigned TRANSPARENT = 0x0020 / 4;
+
+BlendDMA::BlendDMA(CPU &cpu, InterruptController &interrupts):
+	cpu(cpu), interrupts(interrupts), registers(), busy(false), busyUntil(0), completion(0), flagged(false) {
+
+}
+
+void BlendDMA::start() {
+	uint32_t control = registers[CONTROL_1];
+	uint32_t dest = ADDRESS_BASE | (registers[DEST_ADDR] & ADDRESS_MASK);
+	uint32_t source = ADDRESS_BASE | (registers[SRCA_ADDR] & ADDRESS_MASK);
+
+	// Both in words
+	uint32_t width = registers[WIDTH_HEIGH] & 0xFFF;
+	uint32_t height = (registers[WIDTH_HEIGH] >> 16) & 0xFFF;
+	size_t count = size_t(width) * height;
+
+	switch(control & CONTROL_OP_MODE) {
+		case MODE_COPY:
+			if (control & CONTROL_FILTER_MODE) {
+				filter(dest, source, count);
+			} else {
+				cpu.miu->copyWords(dest, source, count);
+			}
+			break;
+		case MODE_FILL:
+			cpu.miu->fillWords(dest, registers[FILL_PAT], count);
+			break;
+		// Idle and the reserved mode move nothing
+		default:
+			count = 0;
+			break;
+	}
+
+	busy = true;
+	busyUntil = cpu.cycles + count * CYCLES_PER_WORD;
+	schedule();
+}
+
+void BlendDMA::filter(uint32_t dest, uint32_t source, size_t count) {
+	uint16_t key = registers[TRANSPARENT] & 0xFFFF;
+
+	for (size_t i = 0; i < count; ++i, dest += 4, source += 4) {
+		uint32_t pixels = cpu.miu->readU32(source);
+		bool low = (pixels & 0xFFFF) != key;
+		bool high = (pixels >> 16) != key;
+
+		if (low && high) {
+			cpu.miu->writeU32(dest, pixels);
+		} else if (low) {
+			cpu.miu->writeU16(dest, pixels);
+		} else if (high) {
+			cpu.miu->writeU16(dest + 2, pixels >> 16);
+		}
+	}
+}
+
+void BlendDMA::schedule() {
+	completion = cpu.events.schedule(busyUntil, [this](uint64_t) {
+		complete();
+	});
+}
+
+void BlendDMA::complete() {
+	busy = false;
+	registers[CONTROL_1] &= ~CONTROL_START;
+
+	flagged = true;
+	updateInterrupt();
+}
+
+void BlendDMA::updateInterrupt() {
+	interrupts.set(InterruptController::SOURCE_BLN_DMA, flagged && (registers[IRQ_CONTROL] & IRQ_EN));
+}
+
+uint8_t BlendDMA::readU8(uint32_t address) const {
+	if (address < REGISTERS_END) {
+		return MemoryRegion::readU8(address);
+	}
+
+	return SparseMemoryRegion::readU8(address);
+}
+
+uint16_t BlendDMA::readU16(uint32_t address) const {
+	if (address < REGISTERS_END) {
+		return MemoryRegion::readU16(address);
+	}
+
+	return SparseMemoryRegion::readU16(address);
+}
+
+uint32_t BlendDMA::readU32(uint32_t address) const {
+	if (address >= REGISTERS_END) {
+		return SparseMemoryRegion::readU32(address);
+	}
+
+	// P_BLNDMA_IRQ_CONTROL, DMA_STATUS is set while busy
+	if (address / 4 == IRQ_CONTROL) {
+		return (registers[IRQ_CONTROL] & IRQ_EN) | (busy ? IRQ_STATUS : 0);
+	}
+
+	return registers[address / 4];
+}
+
+// Registers are written whole, like on the UART
+void BlendDMA::writeU8(uint32_t address, uint8_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU8(address, value);
+}
+
+void BlendDMA::writeU16(uint32_t address, uint16_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU16(address, value);
+}
+
+void BlendDMA::writeU32(uint32_t address, uint32_t value) {
+	if (address >= REGISTERS_END) {
+		return SparseMemoryRegion::writeU32(address, value);
+	}
+
+	switch(address / 4) {
+		// P_BLNDMA_CONTROL_1, setting DMA_START while idle starts a transfer
+		case CONTROL_1:
+			if (busy) {
+				return;
+			}
+
+			registers[CONTROL_1] = value;
+			if (value & CONTROL_START) {
+				start();
+			}
+			return;
+		// P_BLNDMA_IRQ_CONTROL, DMA_INT_CLEAR drops the interrupt
+		case IRQ_CONTROL:
+			registers[IRQ_CONTROL] = value & IRQ_EN;
+			if (value & IRQ_CLEAR) {
+				flagged = false;
+			}
+
+			updateInterrupt();
+			return;
+	}
+
+	registers[address / 4] = value;
+}
+
+void BlendDMA::save(memory::StateWriter &writer) const {
+	SparseMemoryRegion::save(writer);
+
+	for (uint32_t value : registers) {
+		writer.write32(value);
+	}
+
+	writer.write8(busy);
+	writer.write64(busyUntil);
+	writer.write8(flagged);
+}
+
+void BlendDMA::load(memory::StateReader &reader) {
+	SparseMemoryRegion::load(reader);
+
+	// The completion scheduled before belongs to another cycle count
+	if (busy) {
+		cpu.events.cancel(completion);
+	}
+
+	for (uint32_t &value : registers) {
+		value = reader.read32();
+	}
+
+	busy = reader.read8();
+	busyUntil = reader.read64();
+	flagged = reader.read8();
+
+	if (busy) {
+		schedule();
+	}
+
+	updateInterrupt();
+}
+
+void BlendDMA::share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) {
+	SparseMemoryRegion::share(source);
+
+	if (busy) {
+		cpu.events.cancel(completion);
+	}
+
+	BlendDMA &other = sameKind<BlendDMA>(source);
+	std::copy(other.registers, other.registers + REGISTER_COUNT, registers);
+	busy = other.busy;
+	busyUntil = other.busyUntil;
+	flagged = other.flagged;
+
+	// Events are not forked, the completion has to be scheduled on this CPU
+	if (busy) {
+		schedule();
+	}
+
+	updateInterrupt();
+}
+
+}
@@ -0,0 +1,133 @@
+#include <cstdint>
+
+#include "hyperscan/io/io.h"
+#include "hyperscan/memory/sparsememoryregion.h"
+#include "hyperscan/scheduler.h"
+
+#ifndef __HYPERSCAN_IO_BLENDDMA_H__
+#define __HYPERSCAN_IO_BLENDDMA_H__
+
+namespace hyperscan {
+
+class CPU;
+
+}
+
+namespace hyperscan::io {
+
+class InterruptController;
+
+/**
+ * The BITBLT DMA (BLNDMA), moving words between linear ranges of the bus for the CPU
+ *
+ * A transfer is carried out through the MIU as soon as it is started, host memory to host memory where it can,
+ * then stays busy for as long as the hardware would take to move it, and completes with an interrupt if enabled
+ *
+ * Only the linear copy, fill and transparent filter modes are emulated, blending is ignored and copies plainly
+ */
+class BlendDMA : public memory::SparseMemoryRegion<IOMemoryRegion::DATA_BITS> {
+	public:
+		// P_BLNDMA_CONTROL_1 bits
+		static constexpr uint32_t CONTROL_OP_MODE     = 3u << 0;
+		static constexpr uint32_t CONTROL_BLEND_EN    = 1u << 8;
+		static constexpr uint32_t CONTROL_FILTER_MODE = 1u << 16;
+		static constexpr uint32_t CONTROL_START       = 1u << 24;
+
+		// OP_MODE values
+		static constexpr uint32_t MODE_IDLE = 0;
+		static constexpr uint32_t MODE_COPY = 1;
+		static constexpr uint32_t MODE_FILL = 3;
+
+		// P_BLNDMA_IRQ_CONTROL bits
+		static constexpr uint32_t IRQ_STATUS = 1u << 8;
+		static constexpr uint32_t IRQ_EN     = 1u << 16;
+		static constexpr uint32_t IRQ_CLEAR  = 1u << 24;
+
+		// Bus cycles per word moved, a read into the FIFO and a write out of it
+		static constexpr uint64_t CYCLES_PER_WORD = 2;
+
+		BlendDMA(CPU &cpu, InterruptController &interrupts);
+
+		[[nodiscard]]
+		uint8_t readU8(uint32_t address) const override;
+
+		[[nodiscard]]
+		uint16_t readU16(uint32_t address) const override;
+
+		[[nodiscard]]
+		uint32_t readU32(uint32_t address) const override;
+
+		void writeU8(uint32_t address, uint8_t value) override;
+
+		void writeU16(uint32_t address, uint16_t value) override;
+
+		void writeU32(uint32_t address, uint32_t value) override;
+
+		// Registers have side effects, every access has to go through the methods above
+		[[nodiscard]]
+		const uint8_t* readPage(uint32_t) const override {
+			return nullptr;
+		}
+
+		[[nodiscard]]
+		uint8_t* writePage(uint32_t) override {
+			return nullptr;
+		}
+
+		void save(memory::StateWriter &writer) const override;
+
+		void load(memory::StateReader &reader) override;
+
+		void share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) override;
+
+	private:
+		// P_BLNDMA_SRCA_ADDR ~ P_BLNDMA_D_BG, past them is plain memory
+		static constexpr uint32_t REGISTERS_END = 0x005C;
+		static constexpr unsigned REGISTER_COUNT = REGISTERS_END / 4;
+
+		// Addresses are 28 bits, reached through the cached mirror of the bus
+		static constexpr uint32_t ADDRESS_MASK = 0x0FFFFFFF;
+		static constexpr uint32_t ADDRESS_BASE = 0x80000000;
+
+		/**
+		 * Carries out the transfer set up in the registers, then schedules its completion
+		 */
+		void start();
+
+		/**
+		 * Copies count words from source to dest, leaving the pixels of dest alone where source has the color key
+		 */
+		void filter(uint32_t dest, uint32_t source, size_t count);
+
+		/**
+		 * Schedules the completion of the transfer running until busyUntil
+		 */
+		void schedule();
+
+		/**
+		 * Leaves the busy state, flagging the interrupt when enabled
+		 */
+		void complete();
+
+		/**
+		 * Asserts the BLNDMA interrupt while flagged and enabled
+		 */
+		void updateInterrupt();
+
+		CPU &cpu;
+		InterruptController &interrupts;
+
+		uint32_t registers[REGISTER_COUNT];
+
+		// Set while a transfer runs, until the cycle count reaches busyUntil and completion fires
+		bool busy;
+		uint64_t busyUntil;
+		Scheduler::Event completion;
+
+		// Set on completion until cleared through DMA_INT_CLEAR
+		bool flagged;
+};
+
+}
+
+#endif
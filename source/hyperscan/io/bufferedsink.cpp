@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "hyperscan/io/bufferedsink.h"
+
+namespace hyperscan::io {
+
+// Every sink alive, flushed at exit
+static std::mutex registry;
+static std::vector<BufferedSink*> sinks;
+
+static void flush_sinks() {
+	std::lock_guard<std::mutex> guard(registry);
+	for (BufferedSink *sink : sinks) {
+		sink->flush();
+	}
+}
+
+/**
+ * Opens path for writing, exits when it cannot be
+ */
+static FILE* open_output(const char *path) {
+	FILE *file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+
+	return file;
+}
+
+BufferedSink::BufferedSink(FILE *file, bool background):
+	file(file), owned(false), ring(new uint8_t[CAPACITY]), head(0), tail(0),
+	background(background), requested(false), stopping(false) {
+	std::lock_guard<std::mutex> guard(registry);
+	static bool registered = false;
+	if (!registered) {
+		atexit(flush_sinks);
+		registered = true;
+	}
+
+	sinks.push_back(this);
+}
+
+BufferedSink::BufferedSink(const char *path, bool background):
+	BufferedSink(open_output(path), background) {
+	owned = true;
+}
+
+BufferedSink::~BufferedSink() {
+	{
+		std::lock_guard<std::mutex> guard(registry);
+		std::erase(sinks, this);
+	}
+
+	if (thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+
+		wake.notify_one();
+		thread.join();
+	} else {
+		drain();
+	}
+
+	if (owned) {
+		fclose(file);
+	}
+}
+
+void BufferedSink::put(uint8_t value) {
+	size_t position = head.load(std::memory_order_relaxed);
+	if (position - tail.load(std::memory_order_acquire) == CAPACITY) [[unlikely]] {
+		flush();
+	}
+
+	ring[position % CAPACITY] = value;
+	head.store(position + 1, std::memory_order_release);
+
+	size_t pending = position + 1 - tail.load(std::memory_order_acquire);
+	if (!background) {
+		auto now = std::chrono::steady_clock::now();
+		if (pending == 1) {
+			oldest = now;
+		}
+
+		if (value == '\n' || pending >= THRESHOLD || now - oldest >= INTERVAL) {
+			drain();
+		}
+
+		return;
+	}
+
+	// Started on the first byte, devices that never send anything cost no thread
+	if (!thread.joinable()) [[unlikely]] {
+		thread = std::thread(&BufferedSink::writer, this);
+	}
+
+	if (value == '\n' || pending >= THRESHOLD) {
+		request();
+	}
+}
+
+void BufferedSink::flush() {
+	if (!background) {
+		return drain();
+	}
+
+	// Nothing was ever put
+	if (!thread.joinable()) {
+		return;
+	}
+
+	size_t target = head.load(std::memory_order_relaxed);
+	std::unique_lock<std::mutex> guard(lock);
+	requested = true;
+	wake.notify_one();
+
+	drained.wait(guard, [this, target]() {
+		return tail.load(std::memory_order_acquire) >= target;
+	});
+}
+
+void BufferedSink::drain() {
+	std::lock_guard<std::mutex> guard(writing);
+	size_t position = tail.load(std::memory_order_relaxed);
+	size_t end = head.load(std::memory_order_acquire);
+	if (position == end) {
+		return;
+	}
+
+	while (position != end) {
+		size_t offset = position % CAPACITY;
+		size_t chunk = std::min(end - position, CAPACITY - offset);
+		fwrite(ring.get() + offset, 1, chunk, file);
+		position += chunk;
+	}
+
+	fflush(file);
+	tail.store(position, std::memory_order_release);
+}
+
+void BufferedSink::request() {
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		requested = true;
+	}
+
+	wake.notify_one();
+}
+
+void BufferedSink::writer() {
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		// Wakes up every INTERVAL anyway, for bytes still waiting on a newline
+		wake.wait_for(guard, INTERVAL, [this]() {
+			return requested || stopping;
+		});
+
+		requested = false;
+		bool stop = stopping;
+
+		guard.unlock();
+		drain();
+		guard.lock();
+
+		drained.notify_all();
+		if (stop) {
+			return;
+		}
+	}
+}
+
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifndef __HYPERSCAN_IO_BUFFEREDSINK_H__
+#define __HYPERSCAN_IO_BUFFEREDSINK_H__
+
+namespace hyperscan::io {
+
+/**
+ * Collects bytes sent by a device in a ring buffer and writes them out in bulk
+ * Pending bytes are written on a newline, once THRESHOLD of them are pending, or once the oldest waited INTERVAL
+ *
+ * Without a background writer, bytes are written by put() itself, so the timer only fires on the next byte
+ * With one, a thread does the writing and the timer fires on its own, partial lines show up even when the device goes quiet
+ * Either way, a single thread may put() at a time
+ *
+ * exit() skips destructors, sinks still alive then are flushed by an atexit() handler, so output leading up to e.g. a crash report is not lost
+ */
+class BufferedSink {
+	public:
+		// Bytes the ring holds, put() waits for the writer once it is full
+		static constexpr size_t CAPACITY = 1 << 16;
+
+		// Pending bytes that get written without waiting for a newline
+		static constexpr size_t THRESHOLD = 4096;
+
+		// Longest a byte stays pending
+		static constexpr std::chrono::milliseconds INTERVAL{50};
+
+		/**
+		 * Writes to file, which is left open
+		 */
+		explicit BufferedSink(FILE *file, bool background = false);
+
+		/**
+		 * Writes to path, a file truncated first, or a named pipe
+		 * Exits when it cannot be opened
+		 */
+		explicit BufferedSink(const char *path, bool background = true);
+
+		BufferedSink(const BufferedSink&) = delete;
+
+		BufferedSink& operator=(const BufferedSink&) = delete;
+
+		/**
+		 * Writes whatever is pending and stops the writer
+		 */
+		~BufferedSink();
+
+		void put(uint8_t value);
+
+		/**
+		 * Returns once everything put so far is written
+		 */
+		void flush();
+
+	private:
+		/**
+		 * Writes out the ring up to what was put so far, only called by whoever does the writing
+		 */
+		void drain();
+
+		/**
+		 * Asks the background writer to drain now
+		 */
+		void request();
+
+		/**
+		 * Body of the background writer
+		 */
+		void writer();
+
+		FILE *file;
+		bool owned;
+
+		std::unique_ptr<uint8_t[]> ring;
+
+		// Bytes ever put and ever written, the ring holds those in between
+		std::atomic<size_t> head;
+		std::atomic<size_t> tail;
+
+		// When the oldest pending byte was put, without a background writer
+		std::chrono::steady_clock::time_point oldest;
+
+		bool background;
+		std::thread thread;
+		std::mutex lock;
+
+		// Held by drain(), a flush at exit may write from another thread
+		std::mutex writing;
+
+		// Signals the writer, and those waiting for it to drain
+		std::condition_variable wake;
+		std::condition_variable drained;
+		bool requested;
+		bool stopping;
+};
+
+}
+
+#endif
@@ -0,0 +1,205 @@
+#include "hyperscan/cpu.h"
+#include "hyperscan/io/interruptcontroller.h"
+
+namespace hyperscan::io {
+
+InterruptController::InterruptController(CPU &cpu):
+	cpu(cpu), lines(0), softwareInterrupt(false), groupPriority(0), sourcePriority(), scheduled(false), check(0) {
+
+}
+
+void InterruptController::set(unsigned source, bool asserted) {
+	uint64_t mask = uint64_t(1) << source;
+	lines = asserted ? (lines | mask) : (lines & ~mask);
+
+	update();
+}
+
+void InterruptController::update() {
+	if (!pending() || scheduled) {
+		return;
+	}
+
+	// Due right away, so it goes off once the instructions running now are done
+	scheduled = true;
+	check = cpu.events.schedule(cpu.cycles, [this](uint64_t deadline) {
+		deliver(deadline);
+	});
+}
+
+void InterruptController::deliver(uint64_t) {
+	scheduled = false;
+
+	uint64_t sources = pending();
+	if (!sources) {
+		return;
+	}
+
+	// Ignored while the CPU has interrupts disabled, e.g. while it handles the one raised last time
+	cpu.interrupt(highest(sources));
+
+	// Sources are level sensitive, they go off again until their device is acknowledged
+	scheduled = true;
+	check = cpu.events.schedule(cpu.cycles + POLL_INTERVAL, [this](uint64_t deadline) {
+		deliver(deadline);
+	});
+}
+
+unsigned InterruptController::highest(uint64_t sources) const {
+	unsigned best = 0;
+	unsigned bestPriority = ~0u;
+
+	for (uint64_t mask = sources; mask; mask &= mask - 1) {
+		unsigned source = __builtin_ctzll(mask);
+		unsigned group = source / 8;
+
+		unsigned priority = source;
+		if (group < GROUP_COUNT) {
+			priority |= ((groupPriority >> (group * 2)) & 3) << 9;
+			priority |= ((sourcePriority[group] >> (source % 8 * 3)) & 7) << 6;
+		} else {
+			priority |= GROUP_COUNT << 9;
+		}
+
+		if (priority < bestPriority) {
+			best = source;
+			bestPriority = priority;
+		}
+	}
+
+	return best;
+}
+
+uint8_t InterruptController::readU8(uint32_t address) const {
+	if (address < REGISTERS_END) {
+		return MemoryRegion::readU8(address);
+	}
+
+	return SparseMemoryRegion::readU8(address);
+}
+
+uint16_t InterruptController::readU16(uint32_t address) const {
+	if (address < REGISTERS_END) {
+		return MemoryRegion::readU16(address);
+	}
+
+	return SparseMemoryRegion::readU16(address);
+}
+
+uint32_t InterruptController::readU32(uint32_t address) const {
+	switch(address) {
+		// P_INTPND
+		case 0x0000:
+			return pending();
+		// P_INTPND_H
+		case 0x0004:
+			return (pending() >> 32) & 0xFF;
+		// P_I_PMST
+		case 0x0008:
+			return groupPriority;
+		// P_I_GPUSWI
+		case 0x000C:
+			return softwareInterrupt;
+		// P_I_PSLV0 ~ P_I_PSLV3
+		case 0x0010:
+		case 0x0014:
+		case 0x0018:
+		case 0x001C:
+			return sourcePriority[(address - 0x0010) / 4];
+	}
+
+	return SparseMemoryRegion::readU32(address);
+}
+
+// Registers are written whole, like on the UART
+void InterruptController::writeU8(uint32_t address, uint8_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU8(address, value);
+}
+
+void InterruptController::writeU16(uint32_t address, uint16_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU16(address, value);
+}
+
+void InterruptController::writeU32(uint32_t address, uint32_t value) {
+	switch(address) {
+		// P_INTPND, P_INTPND_H are read only
+		case 0x0000:
+		case 0x0004:
+			return;
+		// P_I_PMST
+		case 0x0008:
+			groupPriority = value & 0xFF;
+			return;
+		// P_I_GPUSWI, clearing wins over setting
+		case 0x000C:
+			if (value & (1 << 8)) {
+				softwareInterrupt = false;
+			} else if (value & (1 << 0)) {
+				softwareInterrupt = true;
+				update();
+			}
+			return;
+		// P_I_PSLV0 ~ P_I_PSLV3
+		case 0x0010:
+		case 0x0014:
+		case 0x0018:
+		case 0x001C:
+			sourcePriority[(address - 0x0010) / 4] = value & 0xFFFFFF;
+			return;
+	}
+
+	SparseMemoryRegion::writeU32(address, value);
+}
+
+void InterruptController::save(memory::StateWriter &writer) const {
+	SparseMemoryRegion::save(writer);
+
+	writer.write64(lines);
+	writer.write8(softwareInterrupt);
+	writer.write32(groupPriority);
+	for (uint32_t priority : sourcePriority) {
+		writer.write32(priority);
+	}
+}
+
+void InterruptController::load(memory::StateReader &reader) {
+	SparseMemoryRegion::load(reader);
+
+	lines = reader.read64();
+	softwareInterrupt = reader.read8();
+	groupPriority = reader.read32();
+	for (uint32_t &priority : sourcePriority) {
+		priority = reader.read32();
+	}
+
+	// The check scheduled before may be far off, the state comes with its own cycle count
+	if (scheduled) {
+		cpu.events.cancel(check);
+		scheduled = false;
+	}
+
+	update();
+}
+
+void InterruptController::share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) {
+	SparseMemoryRegion::share(source);
+
+	InterruptController &controller = sameKind<InterruptController>(source);
+	lines = controller.lines;
+	softwareInterrupt = controller.softwareInterrupt;
+	groupPriority = controller.groupPriority;
+	std::copy(controller.sourcePriority, controller.sourcePriority + GROUP_COUNT, sourcePriority);
+
+	// Events are not forked, the check has to be scheduled on this CPU
+	update();
+}
+
+}
@@ -0,0 +1,125 @@
+#include <cstdint>
+
+#include "hyperscan/io/io.h"
+#include "hyperscan/memory/sparsememoryregion.h"
+#include "hyperscan/scheduler.h"
+
+#ifndef __HYPERSCAN_IO_INTERRUPTCONTROLLER_H__
+#define __HYPERSCAN_IO_INTERRUPTCONTROLLER_H__
+
+namespace hyperscan {
+
+class CPU;
+
+}
+
+namespace hyperscan::io {
+
+/**
+ * Peripheral interrupt controller, combining 40 level sensitive sources into the IRQ of the CPU
+ * Sources are numbered as in the SPG290 programming guide, source N enters the CPU through vector 63 - N
+ *
+ * While any source is asserted, the controller checks every POLL_INTERVAL cycles whether the CPU takes interrupts,
+ * and raises the one of highest priority when it does
+ */
+class InterruptController : public memory::SparseMemoryRegion<IOMemoryRegion::DATA_BITS> {
+	public:
+		static constexpr unsigned SOURCE_COUNT = 40;
+
+		// Sources devices assert
+		static constexpr unsigned SOURCE_TIMER = 7;
+		static constexpr unsigned SOURCE_PPU_VBLANK = 10;
+		static constexpr unsigned SOURCE_BLN_DMA = 29;
+
+		// The GPU software interrupt enters through the PPU vblank source
+		static constexpr unsigned SOURCE_GPU_SWI = SOURCE_PPU_VBLANK;
+
+		// Cycles between checks while an interrupt waits for the CPU to enable them
+		static constexpr uint64_t POLL_INTERVAL = 256;
+
+		explicit InterruptController(CPU &cpu);
+
+		/**
+		 * Asserts or releases source, as a device does with its interrupt line
+		 */
+		void set(unsigned source, bool asserted);
+
+		/**
+		 * Bit N is set while source N is asserted
+		 */
+		[[nodiscard]]
+		uint64_t pending() const {
+			return lines | uint64_t(softwareInterrupt) << SOURCE_GPU_SWI;
+		}
+
+		[[nodiscard]]
+		uint8_t readU8(uint32_t address) const override;
+
+		[[nodiscard]]
+		uint16_t readU16(uint32_t address) const override;
+
+		[[nodiscard]]
+		uint32_t readU32(uint32_t address) const override;
+
+		void writeU8(uint32_t address, uint8_t value) override;
+
+		void writeU16(uint32_t address, uint16_t value) override;
+
+		void writeU32(uint32_t address, uint32_t value) override;
+
+		// Registers have side effects, every access has to go through the methods above
+		[[nodiscard]]
+		const uint8_t* readPage(uint32_t) const override {
+			return nullptr;
+		}
+
+		[[nodiscard]]
+		uint8_t* writePage(uint32_t) override {
+			return nullptr;
+		}
+
+		void save(memory::StateWriter &writer) const override;
+
+		void load(memory::StateReader &reader) override;
+
+		void share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) override;
+
+	private:
+		// Addresses past the registers are plain memory
+		static constexpr uint32_t REGISTERS_END = 0x0020;
+
+		// Slave groups of 8 sources each, the last one is not covered by the priority registers
+		static constexpr unsigned GROUP_COUNT = 4;
+
+		/**
+		 * Schedules a check when a source is asserted and none is scheduled yet
+		 */
+		void update();
+
+		/**
+		 * Raises the interrupt of highest priority if the CPU takes it, then checks again later while any is asserted
+		 */
+		void deliver(uint64_t deadline);
+
+		/**
+		 * Source to raise among those pending, ordered by group priority, then source priority, then number
+		 */
+		[[nodiscard]]
+		unsigned highest(uint64_t sources) const;
+
+		CPU &cpu;
+
+		uint64_t lines;
+		bool softwareInterrupt;
+
+		// P_I_PMST and P_I_PSLV0 to 3, lower values come first
+		uint32_t groupPriority;
+		uint32_t sourcePriority[GROUP_COUNT];
+
+		bool scheduled;
+		Scheduler::Event check;
+};
+
+}
+
+#endif
@@ -1,11 +1,23 @@
+#include "hyperscan/io/blenddma.h"
+#include "hyperscan/io/interruptcontroller.h"
 #include "hyperscan/io/io.h"
+#include "hyperscan/io/ppu.h"
+#include "hyperscan/io/timers.h"
 #include "hyperscan/io/uart.h"
 
 namespace hyperscan::io {
 
-IOMemoryRegion::IOMemoryRegion() {
-	// 0x0815_0000 ~ 0x0815_FFFF
-	setRegion(0x15, std::make_shared<UART>());
+IOMemoryRegion::IOMemoryRegion(CPU &cpu):
+	interrupts(std::make_shared<InterruptController>(cpu)),
+	ppu(std::make_shared<PPU>(cpu, *interrupts)),
+	dma(std::make_shared<BlendDMA>(cpu, *interrupts)),
+	uart(std::make_shared<UART>()),
+	timers(std::make_shared<Timers>(cpu, *interrupts)) {
+	setRegion(0x0A, interrupts);
+	setRegion(0x01, ppu);
+	setRegion(0x0D, dma);
+	setRegion(0x15, uart);
+	setRegion(0x16, timers);
 }
 
 }
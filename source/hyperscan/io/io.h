@@ -1,13 +1,45 @@
+#include <memory>
+
 #include "hyperscan/memory/segmentedmemoryregion.h"
 
 #ifndef __HYPERSCAN_IO_IOMEMORYREGION_H__
 #define __HYPERSCAN_IO_IOMEMORYREGION_H__
 
+namespace hyperscan {
+
+class CPU;
+
+}
+
 namespace hyperscan::io {
 
+class BlendDMA;
+class InterruptController;
+class PPU;
+class Timers;
+class UART;
+
 class IOMemoryRegion : public memory::SegmentedMemoryRegion<8, 16> {
 	public:
-		IOMemoryRegion();
+		/**
+		 * Builds the peripherals of cpu, which raise its interrupts and schedule their events on it
+		 */
+		explicit IOMemoryRegion(CPU &cpu);
+
+		// 0x080A_0000 ~ 0x080A_FFFF, built first as the other devices raise their interrupts through it
+		std::shared_ptr<InterruptController> interrupts;
+
+		// 0x0801_0000 ~ 0x0801_FFFF
+		std::shared_ptr<PPU> ppu;
+
+		// 0x080D_0000 ~ 0x080D_FFFF
+		std::shared_ptr<BlendDMA> dma;
+
+		// 0x0815_0000 ~ 0x0815_FFFF
+		std::shared_ptr<UART> uart;
+
+		// 0x0816_0000 ~ 0x0816_5FFF
+		std::shared_ptr<Timers> timers;
 };
 
 }
@@ -0,0 +1,167 @@
+#include "hyperscan/cpu.h"
+#include "hyperscan/io/interruptcontroller.h"
+#include "hyperscan/io/ppu.h"
+
+namespace hyperscan::io {
+
+static constexpr uint64_t FRAME_CYCLES = CPU::CLOCK_RATE / PPU::FRAME_RATE;
+
+// Cycles into a frame blanking starts at
+static constexpr uint64_t BLANK_CYCLES = FRAME_CYCLES * PPU::VISIBLE_LINES / PPU::LINES;
+
+// Frames are drawn from DRAM as mapped here
+static constexpr uint8_t DRAM_SEGMENT = 0x80;
+
+// Registers are in the first page, the palette, line offsets and sprites past it are plain memory
+static constexpr uint32_t REGISTERS_END = memory::PAGE_SIZE;
+
+PPU::PPU(CPU &cpu, InterruptController &interrupts):
+	cpu(cpu), interrupts(interrupts), scheduled(false) {
+
+}
+
+void PPU::setSink(Sink function) {
+	renderer = function ? std::make_unique<RenderThread>(std::move(function)) : nullptr;
+}
+
+void PPU::flush() {
+	if (renderer) {
+		renderer->flush();
+	}
+}
+
+void PPU::capture(PPUState &state) const {
+	for (unsigned i = 0; i < PPUState::REGISTER_COUNT; ++i) {
+		state.registers[i] = SparseMemoryRegion::readU32(PPUState::REGISTERS + i * 4);
+	}
+
+	// A word each, only the low half is used
+	for (unsigned i = 0; i < PPUState::PALETTE_COUNT; ++i) {
+		state.palette[i] = SparseMemoryRegion::readU32(PPUState::PALETTE + i * 4);
+	}
+
+	for (unsigned i = 0; i < PPUState::LINE_COUNT; ++i) {
+		state.hoffset[i] = SparseMemoryRegion::readU32(PPUState::HOFFSET + i * 4);
+	}
+
+	for (unsigned i = 0; i < PPUState::SPRITE_COUNT * 2; ++i) {
+		state.sprites[i] = SparseMemoryRegion::readU32(PPUState::SPRITES + i * 4);
+	}
+}
+
+void PPU::reschedule() {
+	if (scheduled) {
+		cpu.events.cancel(boundary);
+		scheduled = false;
+	}
+
+	if (!(SparseMemoryRegion::readU32(PPUState::REGISTERS + PPUState::PPU_CONTROL * 4) & PPUState::CONTROL_PPU_EN)) {
+		return;
+	}
+
+	// Frames are laid on the cycle count, so every machine agrees on where they start
+	uint64_t start = cpu.cycles - cpu.cycles % FRAME_CYCLES;
+	uint64_t deadline = cpu.cycles <= start + BLANK_CYCLES ? start + BLANK_CYCLES : start + FRAME_CYCLES;
+
+	scheduled = true;
+	boundary = cpu.events.schedule(deadline, [this](uint64_t deadline) {
+		scheduled = false;
+		blank(deadline);
+	});
+}
+
+void PPU::blank(uint64_t deadline) {
+	uint32_t flag = deadline % FRAME_CYCLES == BLANK_CYCLES ? PPUState::IRQ_VBLANK_START : PPUState::IRQ_VBLANK_END;
+	uint32_t status = SparseMemoryRegion::readU32(PPUState::REGISTERS + PPUState::IRQ_STATUS * 4);
+	SparseMemoryRegion::writeU32(PPUState::REGISTERS + PPUState::IRQ_STATUS * 4, status | flag);
+
+	if (flag == PPUState::IRQ_VBLANK_START && renderer) {
+		capture(state);
+		renderer->submit(state, *cpu.miu->region(DRAM_SEGMENT), deadline / FRAME_CYCLES);
+
+		// Pages written directly until now are shared with the frame, writes have to copy them first from here on
+		cpu.miu->unmapWritable(DRAM_SEGMENT);
+	}
+
+	// The next boundary is scheduled from the one just passed, however late the event fired
+	uint64_t next = flag == PPUState::IRQ_VBLANK_START ? deadline - BLANK_CYCLES + FRAME_CYCLES : deadline + BLANK_CYCLES;
+	scheduled = true;
+	boundary = cpu.events.schedule(next, [this](uint64_t deadline) {
+		scheduled = false;
+		blank(deadline);
+	});
+
+	updateInterrupt();
+}
+
+void PPU::updateInterrupt() {
+	uint32_t control = SparseMemoryRegion::readU32(PPUState::REGISTERS + PPUState::IRQ_CONTROL * 4);
+	uint32_t status = SparseMemoryRegion::readU32(PPUState::REGISTERS + PPUState::IRQ_STATUS * 4);
+
+	interrupts.set(InterruptController::SOURCE_PPU_VBLANK, control & status & (PPUState::IRQ_VBLANK_START | PPUState::IRQ_VBLANK_END));
+}
+
+// Registers are written whole, like on the UART
+void PPU::writeU8(uint32_t address, uint8_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU8(address, value);
+}
+
+void PPU::writeU16(uint32_t address, uint16_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU16(address, value);
+}
+
+void PPU::writeU32(uint32_t address, uint32_t value) {
+	if (address >= REGISTERS_END) {
+		return SparseMemoryRegion::writeU32(address, value);
+	}
+
+	switch(address / 4) {
+		// P_PPU_Control, frames only run while PPU_EN is set
+		case PPUState::PPU_CONTROL: {
+			uint32_t before = SparseMemoryRegion::readU32(address);
+			SparseMemoryRegion::writeU32(address, value);
+			if ((before ^ value) & PPUState::CONTROL_PPU_EN) {
+				reschedule();
+			}
+			return;
+		}
+		// P_IRQ_Control
+		case PPUState::IRQ_CONTROL:
+			SparseMemoryRegion::writeU32(address, value);
+			updateInterrupt();
+			return;
+		// P_IRQ_Status, writing 1 to a flag clears it
+		case PPUState::IRQ_STATUS:
+			SparseMemoryRegion::writeU32(address, SparseMemoryRegion::readU32(address) & ~value);
+			updateInterrupt();
+			return;
+	}
+
+	SparseMemoryRegion::writeU32(address, value);
+}
+
+void PPU::load(memory::StateReader &reader) {
+	SparseMemoryRegion::load(reader);
+
+	// Everything else follows from the registers and the cycle count
+	reschedule();
+	updateInterrupt();
+}
+
+void PPU::share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) {
+	SparseMemoryRegion::share(source);
+
+	// Events are not forked, blanking has to be scheduled on this CPU
+	reschedule();
+	updateInterrupt();
+}
+
+}
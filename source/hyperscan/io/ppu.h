@@ -0,0 +1,108 @@
+#include <cstdint>
+#include <memory>
+
+#include "hyperscan/io/io.h"
+#include "hyperscan/io/ppurenderer.h"
+#include "hyperscan/io/renderthread.h"
+#include "hyperscan/memory/sparsememoryregion.h"
+#include "hyperscan/scheduler.h"
+
+#ifndef __HYPERSCAN_IO_PPU_H__
+#define __HYPERSCAN_IO_PPU_H__
+
+namespace hyperscan {
+
+class CPU;
+
+}
+
+namespace hyperscan::io {
+
+class InterruptController;
+
+/**
+ * The picture processing unit: three text layers and 512 sprites over DRAM, see PPUState for the register map
+ *
+ * While enabled, frames run at FRAME_RATE from the cycle count, with vertical blanking over the lines past the visible ones
+ * Drawing is only done when a sink is set, the frame is captured as blanking starts and drawn on a RenderThread
+ */
+class PPU : public memory::SparseMemoryRegion<IOMemoryRegion::DATA_BITS> {
+	public:
+		// Receives every frame drawn
+		typedef RenderThread::Sink Sink;
+
+		static constexpr uint64_t FRAME_RATE = 60;
+
+		// Lines per frame, the ones past VISIBLE_LINES are blanked
+		static constexpr unsigned LINES = 525;
+		static constexpr unsigned VISIBLE_LINES = 480;
+
+		PPU(CPU &cpu, InterruptController &interrupts);
+
+		/**
+		 * Sets where drawn frames go, nothing is drawn without one
+		 * Frames reach it a frame or more late, on the thread running the CPU
+		 */
+		void setSink(Sink function);
+
+		/**
+		 * Returns once every frame captured so far has reached the sink
+		 */
+		void flush();
+
+		void writeU8(uint32_t address, uint8_t value) override;
+
+		void writeU16(uint32_t address, uint16_t value) override;
+
+		void writeU32(uint32_t address, uint32_t value) override;
+
+		// Registers have side effects, the palette, line offsets and sprites are plain memory
+		[[nodiscard]]
+		const uint8_t* readPage(uint32_t address) const override {
+			return address < memory::PAGE_SIZE ? nullptr : SparseMemoryRegion::readPage(address);
+		}
+
+		[[nodiscard]]
+		uint8_t* writePage(uint32_t address) override {
+			return address < memory::PAGE_SIZE ? nullptr : SparseMemoryRegion::writePage(address);
+		}
+
+		void load(memory::StateReader &reader) override;
+
+		void share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) override;
+
+	private:
+		/**
+		 * Copies what the next frame is drawn from out of the registers
+		 */
+		void capture(PPUState &state) const;
+
+		/**
+		 * Schedules the next start or end of blanking while enabled, dropping the one scheduled before
+		 */
+		void reschedule();
+
+		/**
+		 * Flags the start or end of blanking due at deadline, drawing the frame at its start
+		 */
+		void blank(uint64_t deadline);
+
+		/**
+		 * Asserts the vblank interrupt while a status bit is both flagged and enabled
+		 */
+		void updateInterrupt();
+
+		CPU &cpu;
+		InterruptController &interrupts;
+
+		bool scheduled;
+		Scheduler::Event boundary;
+
+		// Draws frames while a sink is set
+		std::unique_ptr<RenderThread> renderer;
+		PPUState state;
+};
+
+}
+
+#endif
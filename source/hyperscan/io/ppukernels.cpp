@@ -0,0 +1,176 @@
+#include <algorithm>
+
+#include "hyperscan/io/ppukernels.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace hyperscan::io {
+
+static constexpr uint32_t ALPHA = 0xFF000000;
+
+static void lookup_scalar(const uint32_t *table, const uint32_t *indices, uint32_t *out, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		out[i] = table[indices[i]];
+	}
+}
+
+static void compose_scalar(uint32_t *dest, const uint32_t *source, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		if (source[i] & ALPHA) {
+			dest[i] = source[i];
+		}
+	}
+}
+
+static void blend_scalar(uint32_t *dest, const uint32_t *source, size_t count, unsigned level, bool subtract) {
+	for (size_t i = 0; i < count; ++i) {
+		if (!(source[i] & ALPHA)) {
+			continue;
+		}
+
+		uint32_t mixed = ALPHA;
+		for (unsigned shift = 0; shift < 24; shift += 8) {
+			int s = (source[i] >> shift & 0xFF) * level;
+			int d = (dest[i] >> shift & 0xFF) * (subtract ? 64 : 64 - level);
+			int channel = subtract ? std::max(d - s, 0) : d + s;
+			mixed |= uint32_t(channel >> 6) << shift;
+		}
+
+		dest[i] = mixed;
+	}
+}
+
+#if defined(__x86_64__)
+
+// SSE2 is part of x86-64, so these need no check, a lookup has no gather to use though
+
+static void compose_sse2(uint32_t *dest, const uint32_t *source, size_t count) {
+	const __m128i alpha = _mm_set1_epi32(ALPHA);
+	const __m128i zero = _mm_setzero_si128();
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + i));
+		__m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, s)));
+	}
+
+	compose_scalar(dest + i, source + i, count - i);
+}
+
+static void blend_sse2(uint32_t *dest, const uint32_t *source, size_t count, unsigned level, bool subtract) {
+	const __m128i alpha = _mm_set1_epi32(ALPHA);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i sourceLevel = _mm_set1_epi16(level);
+	const __m128i destLevel = _mm_set1_epi16(subtract ? 64 : 64 - level);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+		__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + i));
+		__m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(s, alpha), zero);
+
+		// Channels widened to 16 bits, at most 255 * 64 so nothing overflows
+		__m128i sLow = _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), sourceLevel);
+		__m128i sHigh = _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), sourceLevel);
+		__m128i dLow = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), destLevel);
+		__m128i dHigh = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), destLevel);
+
+		__m128i low = subtract ? _mm_subs_epu16(dLow, sLow) : _mm_add_epi16(dLow, sLow);
+		__m128i high = subtract ? _mm_subs_epu16(dHigh, sHigh) : _mm_add_epi16(dHigh, sHigh);
+		__m128i mixed = _mm_or_si128(_mm_packus_epi16(_mm_srli_epi16(low, 6), _mm_srli_epi16(high, 6)), alpha);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_or_si128(_mm_and_si128(transparent, d), _mm_andnot_si128(transparent, mixed)));
+	}
+
+	blend_scalar(dest + i, source + i, count - i, level, subtract);
+}
+
+// AVX2 versions are only called once the processor is known to have it
+
+__attribute__((target("avx2")))
+static void lookup_avx2(const uint32_t *table, const uint32_t *indices, uint32_t *out, size_t count) {
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+		__m256i colors = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), index, 4);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), colors);
+	}
+
+	lookup_scalar(table, indices + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void compose_avx2(uint32_t *dest, const uint32_t *source, size_t count) {
+	const __m256i alpha = _mm256_set1_epi32(ALPHA);
+	const __m256i zero = _mm256_setzero_si256();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+		__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+		__m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), zero);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_blendv_epi8(s, d, transparent));
+	}
+
+	compose_scalar(dest + i, source + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void blend_avx2(uint32_t *dest, const uint32_t *source, size_t count, unsigned level, bool subtract) {
+	const __m256i alpha = _mm256_set1_epi32(ALPHA);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i sourceLevel = _mm256_set1_epi16(level);
+	const __m256i destLevel = _mm256_set1_epi16(subtract ? 64 : 64 - level);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+		__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+		__m256i transparent = _mm256_cmpeq_epi32(_mm256_and_si256(s, alpha), zero);
+
+		// Unpacking and packing both work within 128-bit lanes, so pixels come back in order
+		__m256i sLow = _mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), sourceLevel);
+		__m256i sHigh = _mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), sourceLevel);
+		__m256i dLow = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), destLevel);
+		__m256i dHigh = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), destLevel);
+
+		__m256i low = subtract ? _mm256_subs_epu16(dLow, sLow) : _mm256_add_epi16(dLow, sLow);
+		__m256i high = subtract ? _mm256_subs_epu16(dHigh, sHigh) : _mm256_add_epi16(dHigh, sHigh);
+		__m256i mixed = _mm256_or_si256(_mm256_packus_epi16(_mm256_srli_epi16(low, 6), _mm256_srli_epi16(high, 6)), alpha);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_blendv_epi8(mixed, d, transparent));
+	}
+
+	blend_scalar(dest + i, source + i, count - i, level, subtract);
+}
+
+#endif
+
+/**
+ * Picks the kernels for the processor running this
+ */
+static PPUKernels select_kernels() {
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		return { "AVX2", lookup_avx2, compose_avx2, blend_avx2 };
+	}
+
+	return { "SSE2", lookup_scalar, compose_sse2, blend_sse2 };
+#else
+	return { "scalar", lookup_scalar, compose_scalar, blend_scalar };
+#endif
+}
+
+const PPUKernels& ppu_kernels() {
+	static const PPUKernels kernels = select_kernels();
+	return kernels;
+}
+
+}
@@ -0,0 +1,44 @@
+#include <cstddef>
+#include <cstdint>
+
+#ifndef __HYPERSCAN_IO_PPUKERNELS_H__
+#define __HYPERSCAN_IO_PPUKERNELS_H__
+
+namespace hyperscan::io {
+
+/**
+ * Inner loops of the PPU renderer, working on spans of 32-bit RGBA pixels
+ * A pixel is transparent when its alpha byte is zero, everything the renderer produces is either that or opaque
+ *
+ * Picked once for the host: AVX2 when the processor has it, SSE2 on other x86-64 hosts, plain C++ elsewhere
+ */
+struct PPUKernels {
+	// Name of the instruction set used, for reports
+	const char *name;
+
+	/**
+	 * out[i] = table[indices[i]] for count pixels
+	 */
+	void (*lookup)(const uint32_t *table, const uint32_t *indices, uint32_t *out, size_t count);
+
+	/**
+	 * Copies every opaque pixel of source over dest
+	 */
+	void (*compose)(uint32_t *dest, const uint32_t *source, size_t count);
+
+	/**
+	 * Mixes every opaque pixel of source into dest, level 64ths of source with the rest of dest
+	 * Subtracting takes level 64ths of source away from dest instead, saturating at zero
+	 * Results are always opaque
+	 */
+	void (*blend)(uint32_t *dest, const uint32_t *source, size_t count, unsigned level, bool subtract);
+};
+
+/**
+ * The kernels best suited to the host
+ */
+const PPUKernels& ppu_kernels();
+
+}
+
+#endif
@@ -0,0 +1,382 @@
+#include <algorithm>
+
+#include "hyperscan/io/ppukernels.h"
+#include "hyperscan/io/ppurenderer.h"
+#include "hyperscan/memory/endian.h"
+
+namespace hyperscan::io {
+
+// Addresses within DRAM, the PPU only draws from there
+static constexpr uint32_t ADDRESS_MASK = 0x00FFFFFF;
+
+// Entries past the palette and the 16-bit color tables, transparent, for empty characters
+static constexpr uint32_t PALETTE_TRANSPARENT = PPUState::PALETTE_COUNT;
+static constexpr uint32_t DIRECT_TRANSPARENT = 0x10000;
+
+// Alpha bit of ARGB1555 colors, set for transparent ones
+static constexpr uint16_t RGB555_TRANSPARENT = 0x8000;
+
+// Colors of each ATTRIBUTE_COLOR value, and the bits each pixel is stored in
+static constexpr unsigned COLORS[4] = { 4, 16, 64, 256 };
+static constexpr unsigned STORED_BITS[4] = { 4, 4, 8, 8 };
+
+// Widest a layer row gets: a whole text window
+static constexpr unsigned MAX_ROW = 1024;
+
+/**
+ * Sign extends the low 10 bits of value, as X, Y and horizontal offsets are stored
+ */
+static int sign_extend10(uint32_t value) {
+	return int32_t(value << 22) >> 22;
+}
+
+static uint32_t expand5(uint32_t value) {
+	return (value << 3) | (value >> 2);
+}
+
+static uint32_t rgba(uint32_t r, uint32_t g, uint32_t b) {
+	return r | g << 8 | b << 16 | 0xFF000000;
+}
+
+/**
+ * RGBA of a 16-bit color, transparent when it has its alpha bit or matches key
+ */
+static uint32_t decode_rgb555(uint16_t color, uint32_t key) {
+	if ((color & RGB555_TRANSPARENT) || ((key & PPUState::TRANS_RGB_EN) && color == (key & 0xFFFF))) {
+		return 0;
+	}
+
+	return rgba(expand5(color >> 10 & 31), expand5(color >> 5 & 31), expand5(color & 31));
+}
+
+static uint32_t decode_rgb565(uint16_t color, uint32_t key) {
+	if ((key & PPUState::TRANS_RGB_EN) && color == (key & 0xFFFF)) {
+		return 0;
+	}
+
+	uint32_t green = color >> 5 & 63;
+	return rgba(expand5(color >> 11), (green << 2) | (green >> 4), expand5(color & 31));
+}
+
+/**
+ * Unpacks count pixels stored bits each from data, starting at pixel first, into table indices
+ * Palette colors are offset by base and wrap around the palette, 16-bit colors index their own table
+ */
+template <unsigned bits >
+static void unpack(const uint8_t *data, unsigned first, unsigned count, unsigned base, unsigned mask, uint32_t *out) {
+	auto color = [base, mask](unsigned value) {
+		return (base + (value & mask)) & (PPUState::PALETTE_COUNT - 1);
+	};
+
+	unsigned i = first;
+	unsigned end = first + count;
+	if constexpr (bits == 4) {
+		// A byte holds two pixels, the first in its low nibble
+		if ((i & 1) && i < end) {
+			*out++ = color(data[i++ >> 1] >> 4);
+		}
+
+		for (; i + 2 <= end; i += 2) {
+			uint8_t pair = data[i >> 1];
+			*out++ = color(pair);
+			*out++ = color(pair >> 4);
+		}
+
+		if (i < end) {
+			*out++ = color(data[i >> 1]);
+		}
+	} else if constexpr (bits == 8) {
+		for (; i < end; ++i) {
+			*out++ = color(data[i]);
+		}
+	} else {
+		for (; i < end; ++i) {
+			*out++ = memory::load16(data + i * 2);
+		}
+	}
+}
+
+static void unpack(const uint8_t *data, unsigned bits, unsigned first, unsigned count, unsigned base, unsigned colors, uint32_t *out) {
+	switch(bits) {
+		case 4:
+			return unpack<4>(data, first, count, base, colors - 1, out);
+		case 8:
+			return unpack<8>(data, first, count, base, colors - 1, out);
+		default:
+			return unpack<16>(data, first, count, base, colors - 1, out);
+	}
+}
+
+PPURenderer::PPURenderer():
+	window(), width(0), subtract(false), palette(), rgb555Key(~0u), rgb565Key(~0u),
+	indices(MAX_ROW), layer(MAX_ROW) {
+
+}
+
+const uint8_t* PPURenderer::fetch(const DRAM &dram, uint32_t address, size_t size, std::vector<uint8_t> &scratch) {
+	address &= ADDRESS_MASK;
+
+	const uint8_t *host = dram.readPage(address);
+	if (host && (address & memory::PAGE_MASK) + size <= memory::PAGE_SIZE) [[likely]] {
+		return host + (address & memory::PAGE_MASK);
+	}
+
+	scratch.resize(size);
+	dram.readBlock(address, scratch.data(), size);
+	return scratch.data();
+}
+
+void PPURenderer::decodeColors(const PPUState &state) {
+	uint32_t key = state.registers[PPUState::TRANS_RGB] & (PPUState::TRANS_RGB_EN | 0xFFFF);
+
+	for (unsigned i = 0; i < PPUState::PALETTE_COUNT; ++i) {
+		palette[i] = decode_rgb555(state.palette[i], key);
+	}
+	palette[PALETTE_TRANSPARENT] = 0;
+
+	// 64K colors each, only rebuilt when the color key changes
+	for (unsigned i = 0; i < PPUState::TEXT_COUNT; ++i) {
+		uint32_t control = state.registers[PPUState::TEXT + i * PPUState::TEXT_STRIDE + PPUState::TEXT_CONTROL];
+		if (!(control & PPUState::TEXT_EN)) {
+			continue;
+		}
+
+		if ((control & PPUState::TEXT_RGB565) && rgb565Key != key) {
+			rgb565.resize(DIRECT_TRANSPARENT + 1);
+			for (uint32_t color = 0; color < DIRECT_TRANSPARENT; ++color) {
+				rgb565[color] = decode_rgb565(color, key);
+			}
+			rgb565Key = key;
+		} else if ((control & PPUState::TEXT_RGB555) && !(control & PPUState::TEXT_RGB565) && rgb555Key != key) {
+			rgb555.resize(DIRECT_TRANSPARENT + 1);
+			for (uint32_t color = 0; color < DIRECT_TRANSPARENT; ++color) {
+				rgb555[color] = decode_rgb555(color, key);
+			}
+			rgb555Key = key;
+		}
+	}
+}
+
+void PPURenderer::merge(uint32_t *line, size_t count, bool blend, unsigned level) {
+	const PPUKernels &kernels = ppu_kernels();
+	if (blend) {
+		kernels.blend(line, layer.data(), count, level, subtract);
+	} else {
+		kernels.compose(line, layer.data(), count);
+	}
+}
+
+void PPURenderer::drawText(const PPUState &state, const Text &text, const DRAM &dram, uint32_t *line, unsigned y) {
+	unsigned mode = text.attribute & PPUState::ATTRIBUTE_COLOR;
+	unsigned bits = STORED_BITS[mode];
+	unsigned colors = COLORS[mode];
+	const uint32_t *table = palette;
+	uint32_t blank = PALETTE_TRANSPARENT;
+	if (text.control & PPUState::TEXT_RGB565) {
+		bits = 16;
+		table = rgb565.data();
+		blank = DIRECT_TRANSPARENT;
+	} else if (text.control & PPUState::TEXT_RGB555) {
+		bits = 16;
+		table = rgb555.data();
+		blank = DIRECT_TRANSPARENT;
+	}
+
+	unsigned base = ((text.attribute & PPUState::ATTRIBUTE_PALETTE) >> 8) * colors;
+	unsigned wy = (text.y + y) & (window.height - 1);
+	uint32_t wx = text.x;
+	if (text.control & PPUState::TEXT_HMOVE) {
+		wx += sign_extend10(state.hoffset[y % PPUState::LINE_COUNT]);
+	}
+	wx &= window.width - 1;
+
+	// Bitmaps have a word per line, the offset of the line from the character data
+	if (text.control & PPUState::TEXT_BITMAP) {
+		uint32_t offset = dram.readU32((text.numbers + wy * 4) & ADDRESS_MASK);
+		const uint8_t *data = fetch(dram, text.characters + offset, window.width * bits / 8, characterScratch);
+
+		unsigned first = std::min(width, window.width - wx);
+		unpack(data, bits, wx, first, base, colors, indices.data());
+		unpack(data, bits, 0, width - first, base, colors, indices.data() + first);
+	} else {
+		// Cells are powers of two wide, columns are found by shifting rather than dividing
+		unsigned cellShift = 3 + ((text.attribute & PPUState::ATTRIBUTE_WIDTH) >> 4);
+		unsigned cellWidth = 1u << cellShift;
+		unsigned cellHeight = 8u << ((text.attribute & PPUState::ATTRIBUTE_HEIGHT) >> 6);
+		unsigned columns = window.width / cellWidth;
+		unsigned rowBytes = cellWidth * bits / 8;
+		uint32_t characterBytes = rowBytes * cellHeight;
+		bool hflip = text.attribute & PPUState::ATTRIBUTE_HFLIP;
+
+		unsigned py = wy % cellHeight;
+		if (text.attribute & PPUState::ATTRIBUTE_VFLIP) {
+			py = cellHeight - 1 - py;
+		}
+
+		// Wallpapers repeat the first character all over
+		bool wallpaper = text.control & PPUState::TEXT_WALLPAPER;
+		uint32_t row = wallpaper ? 0 : wy / cellHeight * columns;
+		const uint8_t *numbers = fetch(dram, text.numbers + row * 2, wallpaper ? 2 : columns * 2, numberScratch);
+
+		uint32_t *out = indices.data();
+		for (unsigned x = 0; x < width; ) {
+			unsigned column = wx >> cellShift;
+			unsigned px = wx & (cellWidth - 1);
+			unsigned count = std::min(cellWidth - px, width - x);
+
+			uint16_t number = memory::load16(numbers + (wallpaper ? 0 : column * 2));
+			if (number == 0) {
+				std::fill_n(out + x, count, blank);
+			} else {
+				const uint8_t *data = fetch(dram, text.characters + number * characterBytes + py * rowBytes, rowBytes, characterScratch);
+				if (hflip) {
+					uint32_t cell[64];
+					unpack(data, bits, 0, cellWidth, base, colors, cell);
+					std::reverse_copy(cell + cellWidth - px - count, cell + cellWidth - px, out + x);
+				} else {
+					unpack(data, bits, px, count, base, colors, out + x);
+				}
+			}
+
+			x += count;
+			wx = (wx + count) & (window.width - 1);
+		}
+	}
+
+	ppu_kernels().lookup(table, indices.data(), layer.data(), width);
+	merge(line, width, text.control & PPUState::TEXT_BLEND_EN, text.level);
+}
+
+void PPURenderer::drawSprite(const Sprite &sprite, const DRAM &dram, uint32_t *line, unsigned y) {
+	unsigned mode = sprite.attribute & PPUState::ATTRIBUTE_COLOR;
+	unsigned bits = STORED_BITS[mode];
+	unsigned colors = COLORS[mode];
+	unsigned base = ((sprite.attribute & PPUState::ATTRIBUTE_PALETTE) >> 8) * colors;
+	unsigned rowBytes = sprite.width * bits / 8;
+
+	unsigned row = y - sprite.y;
+	if (sprite.attribute & PPUState::ATTRIBUTE_VFLIP) {
+		row = sprite.height - 1 - row;
+	}
+
+	unpack(fetch(dram, sprite.characters + row * rowBytes, rowBytes, characterScratch), bits, 0, sprite.width, base, colors, indices.data());
+	if (sprite.attribute & PPUState::ATTRIBUTE_HFLIP) {
+		std::reverse(indices.data(), indices.data() + sprite.width);
+	}
+
+	// Clipped to the screen
+	int start = std::max(sprite.x, 0);
+	int end = std::min<int>(sprite.x + sprite.width, width);
+	ppu_kernels().lookup(palette, indices.data() + (start - sprite.x), layer.data(), end - start);
+	merge(line + start, end - start, sprite.attribute & PPUState::ATTRIBUTE_BLEND, sprite.level);
+}
+
+void PPURenderer::render(const PPUState &state, const DRAM &dram, Frame &frame) {
+	const uint32_t *registers = state.registers;
+
+	switch(registers[PPUState::PPU_CONTROL] & PPUState::CONTROL_RESOLUTION) {
+		case PPUState::RESOLUTION_VGA:
+			frame.width = 640;
+			frame.height = 480;
+			window = { 1024, 512 };
+			break;
+		case PPUState::RESOLUTION_HVGA:
+			frame.width = 640;
+			frame.height = 240;
+			window = { 1024, 512 };
+			break;
+		default:
+			frame.width = 320;
+			frame.height = 240;
+			window = { 512, 256 };
+			break;
+	}
+
+	width = frame.width;
+	subtract = registers[PPUState::BLEND_MODE] & 1;
+	frame.pixels.resize(size_t(frame.width) * frame.height);
+
+	decodeColors(state);
+
+	Text texts[PPUState::TEXT_COUNT];
+	for (unsigned i = 0; i < PPUState::TEXT_COUNT; ++i) {
+		const uint32_t *text = registers + PPUState::TEXT + i * PPUState::TEXT_STRIDE;
+		texts[i] = {
+			text[PPUState::TEXT_X],
+			text[PPUState::TEXT_Y],
+			text[PPUState::TEXT_ATTRIBUTE],
+			text[PPUState::TEXT_CONTROL],
+			text[PPUState::TEXT_NUMBER],
+			registers[PPUState::TEXT_BUFFER + i * 3],
+			text[PPUState::TEXT_BLEND] & 63
+		};
+	}
+
+	for (auto &bucket : sprites) {
+		bucket.clear();
+	}
+
+	// Sprites up to P_Sprite_MaxNum, character 0 shows nothing
+	if (registers[PPUState::SPRITE_CONTROL] & PPUState::SPRITE_EN) {
+		bool topLeft = registers[PPUState::SPRITE_CONTROL] & PPUState::SPRITE_TOP_LEFT;
+		unsigned count = std::min<unsigned>((registers[PPUState::SPRITE_MAX] & 0x1FF) + 1, PPUState::SPRITE_COUNT);
+
+		for (unsigned i = 0; i < count; ++i) {
+			uint32_t first = state.sprites[i * 2];
+			uint32_t second = state.sprites[i * 2 + 1];
+			uint32_t number = first & 0xFFFF;
+			if (number == 0) {
+				continue;
+			}
+
+			uint32_t attribute = second & 0xFFFF;
+			Sprite sprite;
+			sprite.width = 8u << ((attribute & PPUState::ATTRIBUTE_WIDTH) >> 4);
+			sprite.height = 8u << ((attribute & PPUState::ATTRIBUTE_HEIGHT) >> 6);
+			sprite.attribute = attribute;
+			sprite.level = second >> 26;
+
+			// Centered coordinates have Y going up
+			int x = sign_extend10(first >> 16);
+			int y = sign_extend10(second >> 16);
+			if (topLeft) {
+				sprite.x = x;
+				sprite.y = y;
+			} else {
+				sprite.x = int(frame.width / 2) + x - int(sprite.width / 2);
+				sprite.y = int(frame.height / 2) - y - int(sprite.height / 2);
+			}
+
+			unsigned characterBytes = sprite.width * sprite.height * STORED_BITS[attribute & PPUState::ATTRIBUTE_COLOR] / 8;
+			sprite.characters = registers[PPUState::SPRITE_BUFFER] + number * characterBytes;
+
+			if (sprite.x < int(frame.width) && sprite.x + int(sprite.width) > 0 &&
+				sprite.y < int(frame.height) && sprite.y + int(sprite.height) > 0) {
+				sprites[(attribute & PPUState::ATTRIBUTE_DEPTH) >> 13].push_back(sprite);
+			}
+		}
+	}
+
+	for (unsigned y = 0; y < frame.height; ++y) {
+		uint32_t *line = frame.pixels.data() + size_t(y) * frame.width;
+
+		// Opaque black behind everything
+		std::fill_n(line, frame.width, 0xFF000000);
+
+		for (unsigned depth = 0; depth < 4; ++depth) {
+			for (const Text &text : texts) {
+				if ((text.control & PPUState::TEXT_EN) && (text.attribute & PPUState::ATTRIBUTE_DEPTH) >> 13 == depth) {
+					drawText(state, text, dram, line, y);
+				}
+			}
+
+			for (const Sprite &sprite : sprites[depth]) {
+				if (int(y) >= sprite.y && int(y) < sprite.y + int(sprite.height)) {
+					drawSprite(sprite, dram, line, y);
+				}
+			}
+		}
+	}
+}
+
+}
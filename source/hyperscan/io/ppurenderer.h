@@ -0,0 +1,217 @@
+#include <cstdint>
+#include <vector>
+
+#include "hyperscan/memory/memoryregion.h"
+
+#ifndef __HYPERSCAN_IO_PPURENDERER_H__
+#define __HYPERSCAN_IO_PPURENDERER_H__
+
+namespace hyperscan::io {
+
+/**
+ * The registers and internal memories of the PPU a frame is drawn from, copied out at the start of vertical blanking
+ * Characters, number arrays and bitmaps stay in DRAM and are read from there while drawing
+ */
+struct PPUState {
+	// Blocks within the PPU segment
+	static constexpr uint32_t REGISTERS = 0x0000;
+	static constexpr uint32_t PALETTE   = 0x1000;
+	static constexpr uint32_t HOFFSET   = 0x2000;
+	static constexpr uint32_t SPRITES   = 0x4000;
+
+	static constexpr unsigned REGISTER_COUNT = 0x0100 / 4;
+	static constexpr unsigned PALETTE_COUNT  = 512;
+	static constexpr unsigned LINE_COUNT     = 512;
+	static constexpr unsigned SPRITE_COUNT   = 512;
+	static constexpr unsigned TEXT_COUNT     = 3;
+
+	// Register indices
+	static constexpr unsigned PPU_CONTROL    = 0x0000 / 4;
+	static constexpr unsigned SPRITE_CONTROL = 0x0004 / 4;
+	static constexpr unsigned SPRITE_MAX     = 0x0008 / 4;
+	static constexpr unsigned BLEND_MODE     = 0x000C / 4;
+	static constexpr unsigned TRANS_RGB      = 0x0010 / 4;
+	static constexpr unsigned IRQ_CONTROL    = 0x0080 / 4;
+	static constexpr unsigned IRQ_STATUS     = 0x0084 / 4;
+	static constexpr unsigned SPRITE_BUFFER  = 0x00D0 / 4;
+
+	// Text layer N has its registers TEXT_STRIDE apart from TEXT, and its character data at TEXT_BUFFER + N * 3
+	static constexpr unsigned TEXT          = 0x0020 / 4;
+	static constexpr unsigned TEXT_STRIDE   = 0x001C / 4;
+	static constexpr unsigned TEXT_X        = 0x0000 / 4;
+	static constexpr unsigned TEXT_Y        = 0x0004 / 4;
+	static constexpr unsigned TEXT_ATTRIBUTE = 0x0008 / 4;
+	static constexpr unsigned TEXT_CONTROL  = 0x000C / 4;
+	static constexpr unsigned TEXT_NUMBER   = 0x0010 / 4;
+	static constexpr unsigned TEXT_BLEND    = 0x0018 / 4;
+	static constexpr unsigned TEXT_BUFFER   = 0x00A0 / 4;
+
+	// P_PPU_Control bits
+	static constexpr uint32_t CONTROL_RESOLUTION = 3u << 0;
+	static constexpr uint32_t CONTROL_PPU_EN     = 1u << 12;
+
+	// Resolution values
+	static constexpr uint32_t RESOLUTION_QVGA     = 0;
+	static constexpr uint32_t RESOLUTION_VGA      = 1;
+	static constexpr uint32_t RESOLUTION_HVGA     = 2;
+	static constexpr uint32_t RESOLUTION_VGA2CIF  = 3;
+
+	// P_Sprite_Control bits
+	static constexpr uint32_t SPRITE_EN        = 1u << 0;
+	static constexpr uint32_t SPRITE_TOP_LEFT  = 1u << 1;
+
+	// P_TransRGB bits
+	static constexpr uint32_t TRANS_RGB_EN = 1u << 16;
+
+	// Text and sprite attribute bits
+	static constexpr uint32_t ATTRIBUTE_COLOR   = 3u << 0;
+	static constexpr uint32_t ATTRIBUTE_HFLIP   = 1u << 2;
+	static constexpr uint32_t ATTRIBUTE_VFLIP   = 1u << 3;
+	static constexpr uint32_t ATTRIBUTE_WIDTH   = 3u << 4;
+	static constexpr uint32_t ATTRIBUTE_HEIGHT  = 3u << 6;
+	static constexpr uint32_t ATTRIBUTE_PALETTE = 31u << 8;
+	static constexpr uint32_t ATTRIBUTE_DEPTH   = 3u << 13;
+	static constexpr uint32_t ATTRIBUTE_BLEND   = 1u << 15;
+
+	// Text control bits
+	static constexpr uint32_t TEXT_BITMAP    = 1u << 0;
+	static constexpr uint32_t TEXT_WALLPAPER = 1u << 2;
+	static constexpr uint32_t TEXT_EN        = 1u << 3;
+	static constexpr uint32_t TEXT_HMOVE     = 1u << 4;
+	static constexpr uint32_t TEXT_RGB555    = 1u << 7;
+	static constexpr uint32_t TEXT_BLEND_EN  = 1u << 8;
+	static constexpr uint32_t TEXT_RGB565    = 1u << 12;
+
+	// P_IRQ_Control and P_IRQ_Status bits
+	static constexpr uint32_t IRQ_VBLANK_START = 1u << 0;
+	static constexpr uint32_t IRQ_VBLANK_END   = 1u << 1;
+
+	uint32_t registers[REGISTER_COUNT];
+
+	// ARGB1555 colors, the alpha bit making them transparent
+	uint16_t palette[PALETTE_COUNT];
+
+	// Horizontal movement of each line of the screen, 10 bits signed
+	uint16_t hoffset[LINE_COUNT];
+
+	// Two words per sprite: character number and X, then attributes, Y and blend level
+	uint32_t sprites[SPRITE_COUNT * 2];
+};
+
+/**
+ * A picture as output by the PPU
+ */
+struct Frame {
+	unsigned width = 0;
+	unsigned height = 0;
+
+	// Row by row, each word holding red in its low byte up to alpha in its high byte
+	std::vector<uint32_t> pixels;
+
+	// Frames started since the machine was built
+	uint64_t number = 0;
+};
+
+/**
+ * Draws frames from a PPUState, a line at a time back to front: for each depth, text layers 1 to 3 then the sprites at it
+ * Each layer is unpacked into palette indices, looked up and composed or blended onto the line by the PPUKernels
+ *
+ * Pixels of 2 and 6 bits are taken as stored in 4 and 8, the first pixel of a byte in its low bits,
+ * and bitmap lines as offsets from the character data of their layer
+ *
+ * Not emulated: attribute arrays (layers take their attributes from the registers), compressed text,
+ * vertical compression and the VGA to CIF scaler, which is drawn as QVGA
+ */
+class PPURenderer {
+	public:
+		// Where characters, number arrays and bitmaps are read from: the DRAM of the machine, or a snapshot of it
+		typedef memory::MemoryRegion<24> DRAM;
+
+		PPURenderer();
+
+		/**
+		 * Draws the frame state describes into frame, reading characters, number arrays and bitmaps from dram
+		 * Addresses are taken within DRAM, nothing else on the bus holds anything to draw
+		 */
+		void render(const PPUState &state, const DRAM &dram, Frame &frame);
+
+	private:
+		// Text layers are 1024x512 pixels, or 512x256 at QVGA, and wrap around
+		struct Window {
+			unsigned width;
+			unsigned height;
+		};
+
+		// Registers of a text layer, as drawn this frame
+		struct Text {
+			uint32_t x;
+			uint32_t y;
+			uint32_t attribute;
+			uint32_t control;
+			uint32_t numbers;
+			uint32_t characters;
+			unsigned level;
+		};
+
+		struct Sprite {
+			int x;
+			int y;
+			unsigned width;
+			unsigned height;
+			uint32_t attribute;
+			uint32_t characters;
+			unsigned level;
+		};
+
+		/**
+		 * Converts the palette and, when layers use them, the direct color tables to RGBA
+		 */
+		void decodeColors(const PPUState &state);
+
+		/**
+		 * Draws text onto line, the screen line y
+		 */
+		void drawText(const PPUState &state, const Text &text, const DRAM &dram, uint32_t *line, unsigned y);
+
+		/**
+		 * Draws the row of sprite crossing the screen line y onto line
+		 */
+		void drawSprite(const Sprite &sprite, const DRAM &dram, uint32_t *line, unsigned y);
+
+		/**
+		 * Composes or blends the first count pixels of layer onto line
+		 */
+		void merge(uint32_t *line, size_t count, bool blend, unsigned level);
+
+		/**
+		 * Returns size bytes of dram at address, in host memory when they are in one page, otherwise copied to scratch
+		 */
+		static const uint8_t* fetch(const DRAM &dram, uint32_t address, size_t size, std::vector<uint8_t> &scratch);
+
+		Window window;
+		unsigned width;
+		bool subtract;
+
+		// RGBA of every palette entry, then a transparent one for empty characters
+		uint32_t palette[PPUState::PALETTE_COUNT + 1];
+
+		// RGBA of every 16-bit color then a transparent one, built when first needed, for the TransRGB they were built with
+		std::vector<uint32_t> rgb555;
+		std::vector<uint32_t> rgb565;
+		uint32_t rgb555Key;
+		uint32_t rgb565Key;
+
+		// Sprites to draw at each depth
+		std::vector<Sprite> sprites[4];
+
+		// The layer being drawn, as table indices then as RGBA
+		std::vector<uint32_t> indices;
+		std::vector<uint32_t> layer;
+
+		std::vector<uint8_t> numberScratch;
+		std::vector<uint8_t> characterScratch;
+};
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "hyperscan/io/renderthread.h"
+
+namespace hyperscan::io {
+
+RenderThread::RenderThread(Sink sink):
+	sink(std::move(sink)), slots(new Slot[DEPTH]), submitted(0), drawn(0), delivered(0), stopping(false) {
+	thread = std::thread(&RenderThread::worker, this);
+}
+
+RenderThread::~RenderThread() {
+	// Counted as one more frame so the render thread wakes up, it never gets drawn
+	stopping.store(true, std::memory_order_relaxed);
+	submitted.fetch_add(1, std::memory_order_release);
+	submitted.notify_one();
+
+	thread.join();
+}
+
+void RenderThread::submit(const PPUState &state, memory::MemoryRegion<24> &dram, uint64_t number) {
+	deliver();
+
+	uint64_t position = submitted.load(std::memory_order_relaxed);
+	if (position - delivered == DEPTH) [[unlikely]] {
+		drawn.wait(delivered, std::memory_order_acquire);
+		deliver();
+	}
+
+	Slot &slot = slots[position % DEPTH];
+	slot.state = state;
+	slot.dram.share(dram);
+	slot.frame.number = number;
+
+	submitted.store(position + 1, std::memory_order_release);
+	submitted.notify_one();
+}
+
+void RenderThread::flush() {
+	uint64_t target = submitted.load(std::memory_order_relaxed);
+	for (uint64_t position = drawn.load(std::memory_order_acquire); position != target; position = drawn.load(std::memory_order_acquire)) {
+		drawn.wait(position, std::memory_order_acquire);
+	}
+
+	deliver();
+}
+
+void RenderThread::deliver() {
+	uint64_t end = drawn.load(std::memory_order_acquire);
+
+	for (; delivered != end; ++delivered) {
+		Slot &slot = slots[delivered % DEPTH];
+
+		// Pages are only ever released here, so DRAM sees the last reference to one drop on its own thread
+		slot.dram.share(empty);
+		sink(slot.frame);
+	}
+}
+
+void RenderThread::worker() {
+	uint64_t position = drawn.load(std::memory_order_relaxed);
+
+	while (true) {
+		submitted.wait(position, std::memory_order_acquire);
+		if (stopping.load(std::memory_order_relaxed)) {
+			return;
+		}
+
+		Slot &slot = slots[position % DEPTH];
+		renderer.render(slot.state, slot.dram, slot.frame);
+
+		drawn.store(++position, std::memory_order_release);
+		drawn.notify_one();
+	}
+}
+
+}
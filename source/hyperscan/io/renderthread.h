@@ -0,0 +1,93 @@
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "hyperscan/io/ppurenderer.h"
+#include "hyperscan/memory/sparsememoryregion.h"
+
+#ifndef __HYPERSCAN_IO_RENDERTHREAD_H__
+#define __HYPERSCAN_IO_RENDERTHREAD_H__
+
+namespace hyperscan::io {
+
+/**
+ * Draws frames on a thread of its own, so the CPU goes on with the next frame while the last one is drawn
+ *
+ * Each frame is drawn from a copy of the PPU state and a snapshot of DRAM sharing its pages, copy-on-write,
+ * so only pages DRAM writes to while the frame is drawn get copied, by the CPU thread writing them
+ * Frames go through a ring of DEPTH slots, submitted by the CPU thread and drawn by the render thread in order,
+ * neither side takes a lock, they only wait on each other when the ring is full or empty
+ *
+ * The sink is called on the submitting thread, as later frames get submitted or on flush(), so frames come out late
+ * Only a single thread may submit at a time
+ */
+class RenderThread {
+	public:
+		// Receives every frame drawn
+		typedef std::function<void(const Frame&)> Sink;
+
+		// Frames in flight, submit() waits for the oldest once all of them are taken
+		static constexpr size_t DEPTH = 3;
+
+		explicit RenderThread(Sink sink);
+
+		RenderThread(const RenderThread&) = delete;
+
+		RenderThread& operator=(const RenderThread&) = delete;
+
+		/**
+		 * Stops the render thread, frames not delivered yet are dropped
+		 */
+		~RenderThread();
+
+		/**
+		 * Queues frame number to be drawn from state and dram, a SparseMemoryRegion, delivering the frames drawn since the last call
+		 * Pages of dram are shared with the snapshot, whoever maps them for direct writes has to look them up again
+		 */
+		void submit(const PPUState &state, memory::MemoryRegion<24> &dram, uint64_t number);
+
+		/**
+		 * Returns once every frame submitted so far is drawn and delivered
+		 */
+		void flush();
+
+	private:
+		struct Slot {
+			PPUState state;
+			memory::SparseMemoryRegion<24> dram;
+			Frame frame;
+		};
+
+		/**
+		 * Passes the frames drawn so far to the sink, handing their slots back
+		 */
+		void deliver();
+
+		/**
+		 * Body of the render thread
+		 */
+		void worker();
+
+		Sink sink;
+
+		std::unique_ptr<Slot[]> slots;
+
+		// Frames ever submitted and drawn, and delivered by the submitting thread
+		std::atomic<uint64_t> submitted;
+		std::atomic<uint64_t> drawn;
+		uint64_t delivered;
+
+		// Never written, sharing it drops the pages a snapshot held
+		memory::SparseMemoryRegion<24> empty;
+
+		PPURenderer renderer;
+
+		std::thread thread;
+		std::atomic<bool> stopping;
+};
+
+}
+
+#endif
@@ -0,0 +1,240 @@
+#include "hyperscan/cpu.h"
+#include "hyperscan/io/interruptcontroller.h"
+#include "hyperscan/io/timers.h"
+
+namespace hyperscan::io {
+
+static constexpr uint64_t CYCLES_PER_TICK = CPU::CLOCK_RATE / Timers::CLOCK_RATE;
+
+// Counters are 16 bits, they wrap going past this
+static constexpr uint64_t COUNTER_END = 0x10000;
+
+Timers::Timers(CPU &cpu, InterruptController &interrupts):
+	cpu(cpu), interrupts(interrupts), timers() {
+
+}
+
+uint32_t Timers::counter(const Timer &timer) const {
+	if (!(timer.control & CONTROL_EN)) {
+		return timer.count;
+	}
+
+	uint64_t count = timer.count + (cpu.cycles - timer.since) / CYCLES_PER_TICK;
+	if (count < COUNTER_END) {
+		return count;
+	}
+
+	// Past a wrap whose event did not fire yet
+	return timer.preload + (count - COUNTER_END) % (COUNTER_END - timer.preload);
+}
+
+void Timers::sync(Timer &timer) {
+	uint64_t ticks = (cpu.cycles - timer.since) / CYCLES_PER_TICK;
+
+	timer.count = counter(timer);
+	timer.since += ticks * CYCLES_PER_TICK;
+}
+
+void Timers::reschedule(Timer &timer) {
+	if (timer.scheduled) {
+		cpu.events.cancel(timer.wrap);
+		timer.scheduled = false;
+	}
+
+	if (!(timer.control & CONTROL_EN)) {
+		return;
+	}
+
+	uint64_t deadline = timer.since + (COUNTER_END - timer.count) * CYCLES_PER_TICK;
+	timer.scheduled = true;
+	timer.wrap = cpu.events.schedule(deadline, [this, &timer](uint64_t deadline) {
+		timer.scheduled = false;
+		wrapped(timer, deadline);
+	});
+}
+
+void Timers::wrapped(Timer &timer, uint64_t deadline) {
+	timer.count = timer.preload;
+	timer.since = deadline;
+	timer.control |= CONTROL_IRQ_FLAG;
+
+	reschedule(timer);
+	updateInterrupt();
+}
+
+void Timers::updateInterrupt() {
+	bool asserted = false;
+	for (const Timer &timer : timers) {
+		asserted |= (timer.control & CONTROL_IRQ_EN) && (timer.control & CONTROL_IRQ_FLAG);
+	}
+
+	interrupts.set(InterruptController::SOURCE_TIMER, asserted);
+}
+
+uint8_t Timers::readU8(uint32_t address) const {
+	if (isRegister(address)) {
+		return MemoryRegion::readU8(address);
+	}
+
+	return SparseMemoryRegion::readU8(address);
+}
+
+uint16_t Timers::readU16(uint32_t address) const {
+	if (isRegister(address)) {
+		return MemoryRegion::readU16(address);
+	}
+
+	return SparseMemoryRegion::readU16(address);
+}
+
+uint32_t Timers::readU32(uint32_t address) const {
+	if (!isRegister(address)) {
+		return SparseMemoryRegion::readU32(address);
+	}
+
+	const Timer &timer = timers[address / TIMER_STRIDE];
+	switch(address % TIMER_STRIDE) {
+		// P_TimerXCtrl
+		case 0x0000:
+			return timer.control;
+		// P_CPP_CTRL
+		case 0x0004:
+			return timer.ccpControl;
+		// P_Preload_REGS
+		case 0x0008:
+			return timer.preload;
+		// P_CPP_REGS
+		case 0x000C:
+			return timer.ccp;
+		// P_CPP_UPCOUNT
+		case 0x0010:
+			return counter(timer);
+	}
+
+	return 0x00000000;
+}
+
+// Registers are written whole, like on the UART
+void Timers::writeU8(uint32_t address, uint8_t value) {
+	if (isRegister(address)) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU8(address, value);
+}
+
+void Timers::writeU16(uint32_t address, uint16_t value) {
+	if (isRegister(address)) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU16(address, value);
+}
+
+void Timers::writeU32(uint32_t address, uint32_t value) {
+	if (!isRegister(address)) {
+		return SparseMemoryRegion::writeU32(address, value);
+	}
+
+	Timer &timer = timers[address / TIMER_STRIDE];
+	switch(address % TIMER_STRIDE) {
+		// P_TimerXCtrl, writing 1 to the flag clears it
+		case 0x0000: {
+			bool wasEnabled = timer.control & CONTROL_EN;
+			if (wasEnabled) {
+				sync(timer);
+			}
+
+			uint32_t flag = timer.control & CONTROL_IRQ_FLAG & ~value;
+			timer.control = (value & (CONTROL_EN | CONTROL_IRQ_EN)) | flag;
+
+			// Starts over from the preload when enabled
+			if (!wasEnabled && (timer.control & CONTROL_EN)) {
+				timer.count = timer.preload;
+				timer.since = cpu.cycles;
+			}
+
+			if (wasEnabled != bool(timer.control & CONTROL_EN)) {
+				reschedule(timer);
+			}
+
+			updateInterrupt();
+			return;
+		}
+		// P_CPP_CTRL
+		case 0x0004:
+			timer.ccpControl = value;
+			return;
+		// P_Preload_REGS, taken on the next wrap
+		case 0x0008:
+			timer.preload = value & 0xFFFF;
+			return;
+		// P_CPP_REGS
+		case 0x000C:
+			timer.ccp = value & 0xFFFF;
+			return;
+		// P_CPP_UPCOUNT
+		case 0x0010:
+			if (timer.control & CONTROL_EN) {
+				sync(timer);
+			}
+
+			timer.count = value & 0xFFFF;
+			reschedule(timer);
+			return;
+	}
+}
+
+void Timers::save(memory::StateWriter &writer) const {
+	SparseMemoryRegion::save(writer);
+
+	for (const Timer &timer : timers) {
+		writer.write32(timer.control);
+		writer.write32(timer.ccpControl);
+		writer.write32(timer.preload);
+		writer.write32(timer.ccp);
+		writer.write32(timer.count);
+		writer.write64(timer.since);
+	}
+}
+
+void Timers::load(memory::StateReader &reader) {
+	SparseMemoryRegion::load(reader);
+
+	for (Timer &timer : timers) {
+		timer.control = reader.read32();
+		timer.ccpControl = reader.read32();
+		timer.preload = reader.read32() & 0xFFFF;
+		timer.ccp = reader.read32();
+		timer.count = reader.read32() & 0xFFFF;
+		timer.since = reader.read64();
+
+		reschedule(timer);
+	}
+
+	updateInterrupt();
+}
+
+void Timers::share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) {
+	SparseMemoryRegion::share(source);
+
+	Timers &other = sameKind<Timers>(source);
+	for (unsigned i = 0; i < COUNT; ++i) {
+		Timer &timer = timers[i];
+		const Timer &from = other.timers[i];
+
+		timer.control = from.control;
+		timer.ccpControl = from.ccpControl;
+		timer.preload = from.preload;
+		timer.ccp = from.ccp;
+		timer.count = from.count;
+		timer.since = from.since;
+
+		// Events are not forked, wraps have to be scheduled on this CPU
+		reschedule(timer);
+	}
+
+	updateInterrupt();
+}
+
+}
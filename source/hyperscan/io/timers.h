@@ -0,0 +1,142 @@
+#include <cstdint>
+
+#include "hyperscan/io/io.h"
+#include "hyperscan/memory/sparsememoryregion.h"
+#include "hyperscan/scheduler.h"
+
+#ifndef __HYPERSCAN_IO_TIMERS_H__
+#define __HYPERSCAN_IO_TIMERS_H__
+
+namespace hyperscan {
+
+class CPU;
+
+}
+
+namespace hyperscan::io {
+
+class InterruptController;
+
+/**
+ * The six 16-bit timers, 0x1000 apart
+ *
+ * An enabled timer counts up from its preload at CLOCK_RATE and wraps back to the preload past 0xFFFF,
+ * setting its interrupt flag, so it goes off every 65536 - preload ticks
+ * Counters are computed from the cycle count when read, wrapping is the only thing scheduled
+ *
+ * Only the timer mode is emulated, capture, comparison and PWM drive pins nothing is attached to
+ */
+class Timers : public memory::SparseMemoryRegion<IOMemoryRegion::DATA_BITS> {
+	public:
+		static constexpr unsigned COUNT = 6;
+
+		// PCLK/2, the clock source selection lives in the clock generator, which is not emulated
+		static constexpr uint64_t CLOCK_RATE = 13'500'000;
+
+		// P_TimerXCtrl bits
+		static constexpr uint32_t CONTROL_EN       = 1u << 31;
+		static constexpr uint32_t CONTROL_IRQ_EN   = 1u << 27;
+		static constexpr uint32_t CONTROL_IRQ_FLAG = 1u << 26;
+
+		Timers(CPU &cpu, InterruptController &interrupts);
+
+		[[nodiscard]]
+		uint8_t readU8(uint32_t address) const override;
+
+		[[nodiscard]]
+		uint16_t readU16(uint32_t address) const override;
+
+		[[nodiscard]]
+		uint32_t readU32(uint32_t address) const override;
+
+		// Counters move with every tick
+		[[nodiscard]]
+		bool steady(uint32_t address) const override {
+			return !isRegister(address) || (address % TIMER_STRIDE & ~3) != 0x0010;
+		}
+
+		void writeU8(uint32_t address, uint8_t value) override;
+
+		void writeU16(uint32_t address, uint16_t value) override;
+
+		void writeU32(uint32_t address, uint32_t value) override;
+
+		// Registers have side effects, every access has to go through the methods above
+		[[nodiscard]]
+		const uint8_t* readPage(uint32_t) const override {
+			return nullptr;
+		}
+
+		[[nodiscard]]
+		uint8_t* writePage(uint32_t) override {
+			return nullptr;
+		}
+
+		void save(memory::StateWriter &writer) const override;
+
+		void load(memory::StateReader &reader) override;
+
+		void share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) override;
+
+	private:
+		// Registers of each timer, past them and past the last timer is plain memory
+		static constexpr uint32_t TIMER_STRIDE = 0x1000;
+		static constexpr uint32_t REGISTERS_END = 0x0014;
+
+		struct Timer {
+			uint32_t control;
+			uint32_t ccpControl;
+			uint32_t preload;
+			uint32_t ccp;
+
+			// Counter value as of the cycle since
+			uint32_t count;
+			uint64_t since;
+
+			bool scheduled;
+			Scheduler::Event wrap;
+		};
+
+		/**
+		 * Whether address is a register of a timer rather than plain memory
+		 */
+		[[nodiscard]]
+		static bool isRegister(uint32_t address) {
+			return address / TIMER_STRIDE < COUNT && address % TIMER_STRIDE < REGISTERS_END;
+		}
+
+		/**
+		 * Counter of timer as of now
+		 */
+		[[nodiscard]]
+		uint32_t counter(const Timer &timer) const;
+
+		/**
+		 * Brings count and since up to now, keeping the fraction of a tick already elapsed
+		 */
+		void sync(Timer &timer);
+
+		/**
+		 * Schedules the next wrap of timer if it runs, dropping the one scheduled before
+		 */
+		void reschedule(Timer &timer);
+
+		/**
+		 * Reloads timer from the preload as due at deadline, flags it and schedules the next wrap
+		 */
+		void wrapped(Timer &timer, uint64_t deadline);
+
+		/**
+		 * Asserts the timer interrupt while any timer has both its flag and interrupt enabled
+		 */
+		void updateInterrupt();
+
+		CPU &cpu;
+		InterruptController &interrupts;
+
+		Timer timers[COUNT];
+};
+
+}
+
+#endif
@@ -1,45 +1,127 @@
+#include <memory>
+
+#include "hyperscan/io/bufferedsink.h"
 #include "hyperscan/io/uart.h"
 
 namespace hyperscan::io {
 
+UART::UART():
+	control(0), baudRate(0) {
+	setSink(nullptr);
+}
+
+void UART::setSink(Sink function) {
+	if (!function) {
+		// Written from its own thread, so prompts without a newline still show up
+		auto output = std::make_shared<BufferedSink>(stdout, true);
+		function = [output](uint8_t value) {
+			output->put(value);
+		};
+	}
+
+	sink = std::move(function);
+}
+
+void UART::receive(const uint8_t *data, size_t size) {
+	std::lock_guard<std::mutex> guard(receiving);
+	received.insert(received.end(), data, data + size);
+}
+
+uint8_t UART::readU8(uint32_t address) const {
+	if (address < REGISTERS_END) {
+		return MemoryRegion::readU8(address);
+	}
+
+	return SparseMemoryRegion::readU8(address);
+}
+
+uint16_t UART::readU16(uint32_t address) const {
+	if (address < REGISTERS_END) {
+		return MemoryRegion::readU16(address);
+	}
+
+	return SparseMemoryRegion::readU16(address);
+}
+
 uint32_t UART::readU32(uint32_t address) const {
 	switch(address) {
 		// RX
-		case 0x0000:
-			return 0x00000000;
+		case 0x0000: {
+			std::lock_guard<std::mutex> guard(receiving);
+			if (received.empty()) {
+				return 0x00000000;
+			}
+
+			uint8_t value = received.front();
+			received.pop_front();
+			return value;
+		}
 		// Error register
 		case 0x0004:
 			return 0x00000000;
 		// UART Control
 		case 0x0008:
-			return 0x00000000;
+			return control;
 		// Baud rate
 		case 0x000C:
-			return 0x00000000;
+			return baudRate;
 		// Status
-		case 0x0010:
-			return 0x00000090;
+		case 0x0010: {
+			// Bytes go out as soon as they are written, the transmitter is always empty
+			uint32_t status = STATUS_TE;
+
+			std::lock_guard<std::mutex> guard(receiving);
+			if (received.empty()) {
+				status |= STATUS_RE;
+			} else {
+				status |= STATUS_RI;
+			}
+
+			if (received.size() >= RX_FIFO_SIZE) {
+				status |= STATUS_RF;
+			}
+
+			return status;
+		}
 	}
 
 	// XXX: Is that what really happens?
-	return ArrayMemoryRegion::readU32(address);
+	return SparseMemoryRegion::readU32(address);
+}
+
+// Registers are written whole, merging with what reads back would pop the receiver
+void UART::writeU8(uint32_t address, uint8_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU8(address, value);
+}
+
+void UART::writeU16(uint32_t address, uint16_t value) {
+	if (address < REGISTERS_END) {
+		return writeU32(address & 0xFFFFFFFC, value << (address & 3) * 8);
+	}
+
+	SparseMemoryRegion::writeU16(address, value);
 }
 
 void UART::writeU32(uint32_t address, uint32_t value) {
 	switch(address) {
 		// TX
 		case 0x0000:
-			printf("%c", value & 0xFF);
-			fflush(stdout);
+			sink(value & 0xFF);
 			return;
 		// Error register
 		case 0x0004:
 			return;
 		// UART Control
 		case 0x0008:
+			control = value;
 			return;
 		// Baud rate
 		case 0x000C:
+			baudRate = value;
 			return;
 		// Status
 		case 0x0010:
@@ -47,7 +129,44 @@ void UART::writeU32(uint32_t address, uint32_t value) {
 	}
 
 	// XXX: May not be needed
-	ArrayMemoryRegion::writeU32(address, value);
+	SparseMemoryRegion::writeU32(address, value);
+}
+
+void UART::save(memory::StateWriter &writer) const {
+	SparseMemoryRegion::save(writer);
+
+	writer.write32(control);
+	writer.write32(baudRate);
+
+	std::lock_guard<std::mutex> guard(receiving);
+	writer.write32(received.size());
+	for (uint8_t value : received) {
+		writer.write8(value);
+	}
+}
+
+void UART::load(memory::StateReader &reader) {
+	SparseMemoryRegion::load(reader);
+
+	control = reader.read32();
+	baudRate = reader.read32();
+
+	std::lock_guard<std::mutex> guard(receiving);
+	received.clear();
+	for (uint32_t size = reader.read32(); size && reader.ok(); --size) {
+		received.push_back(reader.read8());
+	}
+}
+
+void UART::share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) {
+	SparseMemoryRegion::share(source);
+
+	UART &uart = sameKind<UART>(source);
+	control = uart.control;
+	baudRate = uart.baudRate;
+
+	std::scoped_lock guard(receiving, uart.receiving);
+	received = uart.received;
 }
 
 }
@@ -1,17 +1,92 @@
+#include <deque>
+#include <functional>
+#include <mutex>
+
 #include "hyperscan/io/io.h"
-#include "hyperscan/memory/arraymemoryregion.h"
+#include "hyperscan/memory/sparsememoryregion.h"
 
 #ifndef __HYPERSCAN_IO_UART_H__
 #define __HYPERSCAN_IO_UART_H__
 
 namespace hyperscan::io {
 
-class UART : public memory::ArrayMemoryRegion<IOMemoryRegion::DATA_BITS> {
+class UART : public memory::SparseMemoryRegion<IOMemoryRegion::DATA_BITS> {
 	public:
+		// Receives every transmitted byte
+		typedef std::function<void(uint8_t)> Sink;
+
+		// Bytes the hardware receive FIFO holds, the status register reports full past that
+		static constexpr size_t RX_FIFO_SIZE = 8;
+
+		// Status register bits
+		static constexpr uint32_t STATUS_RI = 1 << 15;
+		static constexpr uint32_t STATUS_TE = 1 << 7;
+		static constexpr uint32_t STATUS_RF = 1 << 6;
+		static constexpr uint32_t STATUS_RE = 1 << 4;
+
+		UART();
+
+		/**
+		 * Sets where transmitted bytes go, stdout through a BufferedSink by default
+		 */
+		void setSink(Sink function);
+
+		/**
+		 * Queues size bytes for the CPU to read from the data register
+		 * Safe to call from any thread
+		 */
+		void receive(const uint8_t *data, size_t size);
+
+		[[nodiscard]]
+		uint8_t readU8(uint32_t address) const override;
+
+		[[nodiscard]]
+		uint16_t readU16(uint32_t address) const override;
+
 		[[nodiscard]]
 		uint32_t readU32(uint32_t address) const override;
 
+		// Reading the data register pops the receiver, status changes as receive() queues bytes from any thread
+		[[nodiscard]]
+		bool steady(uint32_t address) const override {
+			return (address & 0xFFFFFFFC) != 0x0000 && (address & 0xFFFFFFFC) != 0x0010;
+		}
+
+		void writeU8(uint32_t address, uint8_t value) override;
+
+		void writeU16(uint32_t address, uint16_t value) override;
+
 		void writeU32(uint32_t address, uint32_t value) override;
+
+		// Registers have side effects, every access has to go through the methods above
+		[[nodiscard]]
+		const uint8_t* readPage(uint32_t) const override {
+			return nullptr;
+		}
+
+		[[nodiscard]]
+		uint8_t* writePage(uint32_t) override {
+			return nullptr;
+		}
+
+		void save(memory::StateWriter &writer) const override;
+
+		void load(memory::StateReader &reader) override;
+
+		void share(memory::MemoryRegion<IOMemoryRegion::DATA_BITS> &source) override;
+
+	private:
+		// Addresses past the registers are plain memory
+		static constexpr uint32_t REGISTERS_END = 0x0014;
+
+		Sink sink;
+
+		uint32_t control;
+		uint32_t baudRate;
+
+		// Received bytes the CPU did not read yet, reading the data register pops them
+		mutable std::mutex receiving;
+		mutable std::deque<uint8_t> received;
 };
 
 }
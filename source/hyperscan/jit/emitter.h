@@ -0,0 +1,283 @@
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifndef __HYPERSCAN_JIT_EMITTER_H__
+#define __HYPERSCAN_JIT_EMITTER_H__
+
+namespace hyperscan::jit {
+
+enum Reg : uint8_t {
+	EAX, ECX, EDX, EBX, ESP, EBP, ESI, EDI,
+	R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Condition codes as encoded in jcc/setcc
+enum Condition : uint8_t {
+	O, NO, C, NC, Z, NZ, BE, A,
+	S, NS, P, NP, L, GE, LE, G,
+};
+
+// ALU group 1 operations, the value is both the /digit and the opcode row
+enum Alu : uint8_t {
+	ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7,
+};
+
+// Shift group 2 operations (/digit)
+enum Shift : uint8_t {
+	SHL = 4, SHR = 5, SAR = 7,
+};
+
+/**
+ * Minimal x86-64 machine code emitter
+ * Memory operands are always [rbx + disp32], rbx holding the CPU being run
+ */
+class Emitter {
+	public:
+		// mov dst, [rbx + disp]
+		void load(Reg dst, int32_t disp) {
+			rex(false, dst, EBX);
+			byte(0x8B);
+			memory(dst, disp);
+		}
+
+		// mov [rbx + disp], src
+		void store(int32_t disp, Reg src) {
+			rex(false, src, EBX);
+			byte(0x89);
+			memory(src, disp);
+		}
+
+		// mov dword [rbx + disp], imm
+		void store(int32_t disp, uint32_t imm) {
+			byte(0xC7);
+			memory(0, disp);
+			dword(imm);
+		}
+
+		// mov dst, qword [rbx + disp]
+		void loadQword(Reg dst, int32_t disp) {
+			rex(true, dst, EBX);
+			byte(0x8B);
+			memory(dst, disp);
+		}
+
+		// op dst, qword [rbx + disp]
+		void aluQword(Alu op, Reg dst, int32_t disp) {
+			rex(true, dst, EBX);
+			byte((op << 3) | 0x03);
+			memory(dst, disp);
+		}
+
+		// op qword [rbx + disp], imm
+		void aluQword(Alu op, int32_t disp, uint32_t imm) {
+			rex(true, 0, EBX);
+			byte(0x81);
+			memory(op, disp);
+			dword(imm);
+		}
+
+		// movzx dst, byte [rbx + disp]
+		void loadByte(Reg dst, int32_t disp) {
+			rex(false, dst, EBX);
+			byte(0x0F);
+			byte(0xB6);
+			memory(dst, disp);
+		}
+
+		// and byte [rbx + disp], imm
+		void andByte(int32_t disp, uint8_t imm) {
+			byte(0x80);
+			memory(4, disp);
+			byte(imm);
+		}
+
+		// or byte [rbx + disp], src
+		void orByte(int32_t disp, Reg src) {
+			rex(false, src, EBX, true);
+			byte(0x08);
+			memory(src, disp);
+		}
+
+		// op dst, [rbx + disp]
+		void alu(Alu op, Reg dst, int32_t disp) {
+			rex(false, dst, EBX);
+			byte((op << 3) | 0x03);
+			memory(dst, disp);
+		}
+
+		// op [rbx + disp], src
+		void alu(Alu op, int32_t disp, Reg src) {
+			rex(false, src, EBX);
+			byte((op << 3) | 0x01);
+			memory(src, disp);
+		}
+
+		// op dst, src
+		void alu(Alu op, Reg dst, Reg src) {
+			rex(false, src, dst);
+			byte((op << 3) | 0x01);
+			direct(src, dst);
+		}
+
+		// op dst, imm
+		void alu(Alu op, Reg dst, uint32_t imm) {
+			rex(false, 0, dst);
+			byte(0x81);
+			direct(op, dst);
+			dword(imm);
+		}
+
+		// neg dst
+		void neg(Reg dst) {
+			rex(false, 0, dst);
+			byte(0xF7);
+			direct(3, dst);
+		}
+
+		// shl/shr/sar dst, amount
+		void shift(Shift op, Reg dst, uint8_t amount) {
+			rex(false, 0, dst);
+			byte(0xC1);
+			direct(op, dst);
+			byte(amount);
+		}
+
+		// test a, b
+		void test(Reg a, Reg b) {
+			rex(false, b, a);
+			byte(0x85);
+			direct(b, a);
+		}
+
+		// setcc dst8
+		void set(Condition condition, Reg dst) {
+			rex(false, 0, dst, true);
+			byte(0x0F);
+			byte(0x90 | condition);
+			direct(0, dst);
+		}
+
+		// movzx dst, src8
+		void zeroExtend(Reg dst, Reg src) {
+			rex(false, dst, src, true);
+			byte(0x0F);
+			byte(0xB6);
+			direct(dst, src);
+		}
+
+		// bt base, bit
+		void bitTest(Reg base, Reg bit) {
+			rex(false, bit, base);
+			byte(0x0F);
+			byte(0xA3);
+			direct(bit, base);
+		}
+
+		// mov dst, imm
+		void mov(Reg dst, uint32_t imm) {
+			rex(false, 0, dst);
+			byte(0xB8 | (dst & 7));
+			dword(imm);
+		}
+
+		// mov dst, imm64
+		void mov(Reg dst, const void *pointer) {
+			rex(true, 0, dst);
+			byte(0xB8 | (dst & 7));
+			uint64_t imm = reinterpret_cast<uintptr_t>(pointer);
+			dword(imm);
+			dword(imm >> 32);
+		}
+
+		// mov dst, src (64bit)
+		void mov(Reg dst, Reg src) {
+			rex(true, src, dst);
+			byte(0x89);
+			direct(src, dst);
+		}
+
+		// call target
+		void call(Reg target) {
+			rex(false, 0, target);
+			byte(0xFF);
+			direct(2, target);
+		}
+
+		void push(Reg reg) {
+			rex(false, 0, reg);
+			byte(0x50 | (reg & 7));
+		}
+
+		void pop(Reg reg) {
+			rex(false, 0, reg);
+			byte(0x58 | (reg & 7));
+		}
+
+		// sub/add rsp, amount
+		void reserve(int8_t amount) {
+			byte(0x48);
+			byte(0x83);
+			direct(amount > 0 ? SUB : ADD, ESP);
+			byte(amount > 0 ? amount : -amount);
+		}
+
+		void ret() {
+			byte(0xC3);
+		}
+
+		/**
+		 * jcc rel32 to a label bound later
+		 * Returns the label to bind
+		 */
+		size_t jump(Condition condition) {
+			byte(0x0F);
+			byte(0x80 | condition);
+			dword(0);
+			return code.size();
+		}
+
+		/**
+		 * Points a jump at the current position
+		 */
+		void bind(size_t label) {
+			int32_t rel = code.size() - label;
+			std::memcpy(&code[label - 4], &rel, sizeof(rel));
+		}
+
+		std::vector<uint8_t> code;
+
+	private:
+		void byte(uint8_t value) {
+			code.push_back(value);
+		}
+
+		void dword(uint32_t value) {
+			for (int i = 0; i < 4; ++i) {
+				byte(value >> (i * 8));
+			}
+		}
+
+		// REX prefix when needed. Byte registers past bl need one to not mean ah..bh
+		void rex(bool wide, uint8_t reg, uint8_t rm, bool bytes = false) {
+			uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+			if (prefix != 0x40 || (bytes && (reg >= ESP || rm >= ESP))) {
+				byte(prefix);
+			}
+		}
+
+		// ModRM for [rbx + disp32]
+		void memory(uint8_t reg, int32_t disp) {
+			byte(0x80 | ((reg & 7) << 3) | EBX);
+			dword(disp);
+		}
+
+		// ModRM for a register operand
+		void direct(uint8_t reg, uint8_t rm) {
+			byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+		}
+};
+
+}
+
+#endif
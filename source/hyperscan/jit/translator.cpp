@@ -0,0 +1,621 @@
+#include "hyperscan/jit/translator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <array>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__)
+#include <sys/mman.h>
+#endif
+
+#include "hyperscan/cpu.h"
+#include "hyperscan/disasm.h"
+#include "hyperscan/handlers.h"
+#include "hyperscan/jit/emitter.h"
+
+namespace hyperscan::jit {
+
+#if defined(__x86_64__)
+
+typedef BlockCache::Handlers H;
+
+// Size of the executable memory holding translations
+static constexpr size_t ARENA_SIZE = 16 << 20;
+
+// Flag bits in cr1
+static constexpr uint8_t FLAG_V = 1 << 0;
+static constexpr uint8_t FLAG_C = 1 << 1;
+static constexpr uint8_t FLAG_Z = 1 << 2;
+static constexpr uint8_t FLAG_N = 1 << 3;
+static constexpr uint8_t FLAG_T = 1 << 4;
+
+// Bit n of CONDITIONS[cond] is set when cond holds for the flags nibble n of cr1, as in CPU::conditional
+static constexpr std::array<uint16_t, 16> CONDITIONS = [] {
+	std::array<uint16_t, 16> table = {};
+	for (unsigned flags = 0; flags < 16; ++flags) {
+		bool V = flags & FLAG_V;
+		bool C = flags & FLAG_C;
+		bool Z = flags & FLAG_Z;
+		bool N = flags & FLAG_N;
+
+		bool holds[16] = {
+			C, !C,
+			C && !Z, !C || Z,
+			Z, !Z,
+			(N == V) && !Z, (N != V) || Z,
+			N == V, N != V,
+			N, !N,
+			V, !V,
+			false, true,
+		};
+
+		for (unsigned cond = 0; cond < 16; ++cond) {
+			table[cond] |= holds[cond] << flags;
+		}
+	}
+
+	return table;
+}();
+
+// Architectural state compared in lock-step mode
+struct State {
+	uint32_t r[32];
+	uint32_t cr[32];
+	uint32_t sr[32];
+	uint64_t CE;
+	uint32_t pc;
+	uint64_t cycles;
+
+	bool operator==(const State&) const = default;
+};
+
+static State save(const CPU &cpu) {
+	State state;
+	std::memcpy(state.r, cpu.r, sizeof(state.r));
+	std::memcpy(state.cr, cpu.cr, sizeof(state.cr));
+	std::memcpy(state.sr, cpu.sr, sizeof(state.sr));
+	state.CE = cpu.CE;
+	state.pc = cpu.pc;
+	state.cycles = cpu.cycles;
+
+	return state;
+}
+
+static void restore(CPU &cpu, const State &state) {
+	std::memcpy(cpu.r, state.r, sizeof(state.r));
+	std::memcpy(cpu.cr, state.cr, sizeof(state.cr));
+	std::memcpy(cpu.sr, state.sr, sizeof(state.sr));
+	cpu.CE = state.CE;
+	cpu.pc = state.pc;
+	cpu.cycles = state.cycles;
+}
+
+static void materialize(CPU *cpu) {
+	cpu->materializeFlags();
+}
+
+static void compare(const char *name, const uint32_t *jit, const uint32_t *interpreter, unsigned count) {
+	for (unsigned i = 0; i < count; ++i) {
+		if (jit[i] != interpreter[i]) {
+			fprintf(stderr, "  %s%-2u jit[%08X] interpreter[%08X]\n", name, i, jit[i], interpreter[i]);
+		}
+	}
+}
+
+Translator::~Translator() {
+	if (arena) {
+		munmap(arena, ARENA_SIZE);
+	}
+}
+
+uint32_t Translator::run(CPU &cpu, uint32_t budget) {
+	BlockCache::Block *block = cpu.blocks.block(cpu, cpu.pc);
+	if (block->count > budget) {
+		return 0;
+	}
+
+	// Stepped instead when the next event comes due before its last instruction, it has to go off right after it
+	if (cpu.cycles + block->count + block->stalls > cpu.events.next()) {
+		return 0;
+	}
+
+	// Breakpoints past the first instruction have to be stopped at
+	if (cpu.breakpoints.page(block->start) && cpu.breakpoints.any(block->start + 2, block->end)) {
+		return 0;
+	}
+
+	if (!block->native) {
+		block->native = reinterpret_cast<const void*>(compile(cpu, *block));
+	}
+
+	if (lockstep) {
+		return verify(cpu, *block);
+	}
+
+	return reinterpret_cast<Native>(block->native)(&cpu);
+}
+
+Translator::Native Translator::compile(CPU &cpu, BlockCache::Block &block) {
+	Emitter e;
+
+	auto offset = [&](const void *field) -> int32_t {
+		return reinterpret_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(&cpu);
+	};
+
+	auto reg = [&](uint8_t index) {
+		return offset(&cpu.r[index]);
+	};
+
+	const int32_t PC = offset(&cpu.pc);
+	const int32_t CR1 = offset(&cpu.cr1);
+	const int32_t CEL = offset(&cpu.CEL);
+	const int32_t CEH = offset(&cpu.CEH);
+	const int32_t INVALIDATIONS = offset(&cpu.blocks.invalidations);
+	const int32_t LAZY_NZ = offset(&cpu.lazy.nz);
+	const int32_t LAZY_CV = offset(&cpu.lazy.cv);
+	const int32_t CYCLES = offset(&cpu.cycles);
+	const int32_t DUE = offset(&cpu.events.due);
+
+	// Instructions already counted in cycles, which is brought up to date before handlers look at it
+	uint32_t retired = 0;
+
+	// Returns to run() with the number of instructions executed, retiring them
+	auto leave = [&](uint32_t executed) {
+		if (executed > retired) {
+			e.aluQword(ADD, CYCLES, executed - retired);
+		}
+
+		e.mov(EAX, executed);
+		e.reserve(-8);
+		e.pop(R12);
+		e.pop(EBX);
+		e.ret();
+	};
+
+	// Replaces the flags in mask from the host flags of the last operation
+	// carry is the host condition for C, tcs selects what T copies as in CPU::cmp
+	auto arithmetic_flags = [&](Condition carry, int tcs = 3) {
+		uint8_t mask = FLAG_V | FLAG_C | FLAG_Z | FLAG_N;
+
+		e.set(O, EDI);
+		e.set(carry, ECX);
+		e.set(Z, EDX);
+		e.set(S, ESI);
+		e.zeroExtend(EDI, EDI);
+		e.zeroExtend(ECX, ECX);
+		e.zeroExtend(EDX, EDX);
+		e.zeroExtend(ESI, ESI);
+		e.shift(SHL, ECX, 1);
+		e.shift(SHL, EDX, 2);
+		e.shift(SHL, ESI, 3);
+		e.alu(OR, ECX, EDI);
+		e.alu(OR, ECX, EDX);
+		e.alu(OR, ECX, ESI);
+
+		if (tcs == 0 || tcs == 1) {
+			// T = Z or T = N
+			e.mov(EDI, tcs == 0 ? EDX : ESI);
+			e.shift(SHL, EDI, tcs == 0 ? 2 : 1);
+			e.alu(OR, ECX, EDI);
+			mask |= FLAG_T;
+		}
+
+		e.andByte(CR1, ~mask);
+		e.orByte(CR1, ECX);
+	};
+
+	// N and Z only, as in CPU::basic_flags
+	auto basic_flags = [&]() {
+		e.set(Z, EDX);
+		e.set(S, ESI);
+		e.zeroExtend(EDX, EDX);
+		e.zeroExtend(ESI, ESI);
+		e.shift(SHL, EDX, 2);
+		e.shift(SHL, ESI, 3);
+		e.alu(OR, EDX, ESI);
+		e.andByte(CR1, ~(FLAG_Z | FLAG_N));
+		e.orByte(CR1, EDX);
+	};
+
+	// Whether flags may still be lazy, as left by the interpreter or a handler
+	bool lazy = true;
+
+	// Computes lazy flags into cr1, which native code reads and writes directly
+	auto flags = [&]() {
+		if (!lazy) {
+			return;
+		}
+
+		e.loadByte(EAX, LAZY_NZ);
+		e.loadByte(ECX, LAZY_CV);
+		e.alu(OR, EAX, ECX);
+		size_t computed = e.jump(Z);
+		e.mov(EDI, EBX);
+		e.mov(EAX, reinterpret_cast<const void*>(&materialize));
+		e.call(EAX);
+		e.bind(computed);
+		lazy = false;
+	};
+
+	// Sets PC to target and leaves, linking r3 to the next instruction if needed
+	auto jump = [&](const DecodedInstruction &insn, uint32_t width, uint32_t executed) {
+		if (insn.CU) {
+			e.store(reg(3), insn.pc + width);
+		}
+
+		e.store(PC, insn.imm);
+		leave(executed);
+	};
+
+	bool terminated = false;
+
+	// Emits a native translation of insn, returns false when there is none
+	// Terminators leave the block themselves
+	auto translate = [&](auto size, const DecodedInstruction &insn, uint32_t executed) -> bool {
+		constexpr int I = decltype(size)::value;
+		constexpr uint32_t WIDTH = I / 8;
+		auto handler = insn.handler;
+
+		if (handler == H::nop<I>) {
+			return true;
+		}
+
+		if (handler == H::mv<I>) {
+			e.load(EAX, reg(insn.rA));
+			e.store(reg(insn.rD), EAX);
+			return true;
+		}
+
+		if (handler == H::ldi<I>) {
+			e.store(reg(insn.rD), insn.imm);
+			return true;
+		}
+
+		if (handler == H::mfcel<I> || handler == H::mfceh<I>) {
+			e.load(EAX, handler == H::mfcel<I> ? CEL : CEH);
+			e.store(reg(insn.rD), EAX);
+			return true;
+		}
+
+		if (handler == H::mtcel<I> || handler == H::mtceh<I>) {
+			e.load(EAX, reg(insn.rD));
+			e.store(handler == H::mtcel<I> ? CEL : CEH, EAX);
+			return true;
+		}
+
+		if (handler == H::add<I> || handler == H::sub<I> || handler == H::addi<I>) {
+			if (insn.CU) {
+				flags();
+			}
+
+			e.load(EAX, reg(insn.rA));
+			if (handler == H::addi<I>) {
+				e.alu(ADD, EAX, insn.imm);
+			} else {
+				e.alu(handler == H::add<I> ? ADD : SUB, EAX, reg(insn.rB));
+			}
+
+			if (insn.CU) {
+				// C is a borrow on x86 but carry-out on S+core
+				arithmetic_flags(handler == H::sub<I> ? NC : C);
+			}
+
+			e.store(reg(insn.rD), EAX);
+			return true;
+		}
+
+		if (handler == H::neg<I>) {
+			if (insn.CU) {
+				flags();
+			}
+
+			e.alu(XOR, EAX, EAX);
+			e.alu(SUB, EAX, reg(insn.rB));
+			if (insn.CU) {
+				arithmetic_flags(NC);
+			}
+
+			e.store(reg(insn.rD), EAX);
+			return true;
+		}
+
+		if (handler == H::cmp<I> || handler == H::cmpi<I>) {
+			if (!insn.CU) {
+				return true;
+			}
+
+			flags();
+			e.load(EAX, reg(insn.rA));
+			if (handler == H::cmpi<I>) {
+				e.alu(CMP, EAX, insn.imm);
+			} else {
+				e.alu(CMP, EAX, reg(insn.rB));
+			}
+
+			arithmetic_flags(NC, insn.rD);
+			return true;
+		}
+
+		static const std::pair<DecodedInstruction::Handler, Alu> BIT_OPS[] = {
+			{ H::bit_op<I, std::bit_and<>>, AND },
+			{ H::bit_op<I, std::bit_or<>>,  OR  },
+			{ H::bit_op<I, std::bit_xor<>>, XOR },
+		};
+
+		static const std::pair<DecodedInstruction::Handler, Alu> BIT_OPIS[] = {
+			{ H::bit_opi<I, std::bit_and<>>, AND },
+			{ H::bit_opi<I, std::bit_or<>>,  OR  },
+			{ H::bit_opi<I, std::bit_xor<>>, XOR },
+		};
+
+		for (const auto &[op, alu] : BIT_OPS) {
+			if (handler == op) {
+				if (insn.CU) {
+					flags();
+				}
+
+				e.load(EAX, reg(insn.rA));
+				e.alu(alu, EAX, reg(insn.rB));
+				if (insn.CU) {
+					basic_flags();
+				}
+
+				e.store(reg(insn.rD), EAX);
+				return true;
+			}
+		}
+
+		for (const auto &[op, alu] : BIT_OPIS) {
+			if (handler == op) {
+				if (insn.CU) {
+					flags();
+				}
+
+				e.load(EAX, reg(insn.rA));
+				e.alu(alu, EAX, insn.imm);
+				if (insn.CU) {
+					basic_flags();
+				}
+
+				e.store(reg(insn.rD), EAX);
+				return true;
+			}
+		}
+
+		if (handler == H::tsti<I>) {
+			if (insn.CU) {
+				flags();
+				e.load(EAX, reg(insn.rA));
+				e.alu(AND, EAX, insn.imm);
+				basic_flags();
+			}
+
+			return true;
+		}
+
+		// Shift carry has edge cases at 0, leave those with flags to the handler
+		static const std::pair<DecodedInstruction::Handler, Shift> SHIFTS[] = {
+			{ H::shifti<I, &CPU::sll>, SHL },
+			{ H::shifti<I, &CPU::srl>, SHR },
+			{ H::shifti<I, &CPU::sra>, SAR },
+		};
+
+		for (const auto &[op, shift] : SHIFTS) {
+			if (handler == op && !insn.CU) {
+				e.load(EAX, reg(insn.rA));
+				e.shift(shift, EAX, insn.imm & 0x1F);
+				e.store(reg(insn.rD), EAX);
+				return true;
+			}
+		}
+
+		if (handler == H::jump<I>) {
+			jump(insn, WIDTH, executed);
+			terminated = true;
+			return true;
+		}
+
+		// The CNT decrementing condition stays with the handler
+		if (handler == H::branch<I> && insn.rB != 0xE) {
+			terminated = true;
+			if (insn.rB == 0xF) {
+				jump(insn, WIDTH, executed);
+				return true;
+			}
+
+			flags();
+			e.loadByte(EAX, CR1);
+			e.alu(AND, EAX, uint32_t(0x0F));
+			// Conditions past 0xF never hold
+			e.mov(ECX, uint32_t(insn.rB < CONDITIONS.size() ? CONDITIONS[insn.rB] : 0));
+			e.bitTest(ECX, EAX);
+			size_t untaken = e.jump(NC);
+			jump(insn, WIDTH, executed);
+
+			e.bind(untaken);
+			e.store(PC, insn.pc + WIDTH);
+			leave(executed);
+			return true;
+		}
+
+		return false;
+	};
+
+	// Prologue, rbx holds the CPU, r12 the invalidation count blocks are checked against
+	e.push(EBX);
+	e.push(R12);
+	e.reserve(8);
+	e.mov(EBX, EDI);
+	e.load(R12, INVALIDATIONS);
+
+	const auto &instructions = block.instructions;
+	uint32_t executed = 0;
+	for (size_t i = 0; instructions[i].length; i += instructions[i].length) {
+		const DecodedInstruction &insn = instructions[i];
+		uint32_t next = instructions[i + insn.length].length ? instructions[i + insn.length].pc : block.end;
+		++executed;
+
+		if (insn.length == 1 && (translate(std::integral_constant<int, 32>(), insn, executed) ||
+		                         translate(std::integral_constant<int, 16>(), insn, executed))) {
+			continue;
+		}
+
+		// Handlers may look at PC, and at cycles, e.g. reading a timer
+		if (executed - 1 > retired) {
+			e.aluQword(ADD, CYCLES, executed - 1 - retired);
+			retired = executed - 1;
+		}
+
+		e.store(PC, insn.pc);
+		e.mov(EDI, EBX);
+		e.mov(ESI, &insn);
+		e.mov(EAX, reinterpret_cast<const void*>(insn.handler));
+		e.call(EAX);
+		lazy = true;
+
+		if (!instructions[i + insn.length].length) {
+			// Last instruction, which may be a terminator having set PC itself
+			e.alu(ADD, PC, EAX);
+			leave(executed);
+			terminated = true;
+			break;
+		}
+
+		e.aluQword(ADD, CYCLES, 1);
+		retired = executed;
+
+		// A store may have replaced the rest of this block, or raised an interrupt due right away
+		e.alu(CMP, R12, INVALIDATIONS);
+		size_t invalid = e.jump(NZ);
+		e.loadQword(EAX, CYCLES);
+		e.aluQword(CMP, EAX, DUE);
+		size_t valid = e.jump(C);
+		e.bind(invalid);
+		e.store(PC, next);
+		leave(executed);
+		e.bind(valid);
+	}
+
+	if (!terminated) {
+		e.store(PC, block.end);
+		leave(executed);
+	}
+
+	if (!arena) {
+		void *memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (memory == MAP_FAILED) {
+			perror("jit: mmap");
+			exit(1);
+		}
+
+		arena = static_cast<uint8_t*>(memory);
+	}
+
+	// Out of space, every translation goes along with the blocks owning them
+	if (used + e.code.size() > ARENA_SIZE) {
+		cpu.blocks.clear();
+		used = 0;
+	}
+
+	// Keep the arena either writable or executable, never both
+	uint8_t *code = arena + used;
+	mprotect(arena, ARENA_SIZE, PROT_READ | PROT_WRITE);
+	std::memcpy(code, e.code.data(), e.code.size());
+	mprotect(arena, ARENA_SIZE, PROT_READ | PROT_EXEC);
+	used += (e.code.size() + 15) & ~15;
+
+	return reinterpret_cast<Native>(code);
+}
+
+uint32_t Translator::verify(CPU &cpu, const BlockCache::Block &block) {
+	typedef memory::SegmentedMemoryRegion<8, 24>::Write Write;
+
+	// Flags are compared as held in cr1
+	cpu.materializeFlags();
+	State before = save(cpu);
+
+	// Native run, writes are held back so the interpreter sees memory as it was
+	std::vector<Write> jitWrites;
+	cpu.miu->setJournal(&jitWrites, true);
+	uint32_t executed = reinterpret_cast<Native>(block.native)(&cpu);
+	bool device = cpu.miu->deviceAccessed();
+	cpu.miu->setJournal(nullptr);
+
+	cpu.materializeFlags();
+	State jit = save(cpu);
+	restore(cpu, before);
+
+	// Devices are only accessed once, by stepping through the block as a normal run without native code would
+	if (device) {
+		return 0;
+	}
+
+	std::vector<Write> interpreterWrites;
+	cpu.miu->setJournal(&interpreterWrites);
+	for (uint32_t i = 0; i < executed; ++i) {
+		cpu.pc += cpu.interpret();
+		++cpu.cycles;
+	}
+	cpu.miu->setJournal(nullptr);
+
+	cpu.materializeFlags();
+	State interpreter = save(cpu);
+	if (jit == interpreter && jitWrites == interpreterWrites) {
+		return executed;
+	}
+
+	fprintf(stderr, "lockstep: divergence in block %08X-%08X after %u instructions\n", block.start, block.end, executed);
+	for (uint32_t address = block.start; address < block.end;) {
+		CPU::InstructionDecoder instruction = cpu.fetch(address - (address & 2));
+
+		printf("%08X: ", address);
+		if (instruction.p0) {
+			disasm32((instruction.high << 15) | instruction.low, address);
+			address += 4;
+		} else {
+			disasm16((address & 2) ? instruction.high : instruction.low, address);
+			address += 2;
+		}
+		printf("\n");
+	}
+	fflush(stdout);
+
+	compare("r", jit.r, interpreter.r, 32);
+	compare("cr", jit.cr, interpreter.cr, 32);
+	compare("sr", jit.sr, interpreter.sr, 32);
+	compare("pc", &jit.pc, &interpreter.pc, 1);
+	if (jit.CE != interpreter.CE) {
+		fprintf(stderr, "  CE jit[%016llX] interpreter[%016llX]\n", (unsigned long long) jit.CE, (unsigned long long) interpreter.CE);
+	}
+
+	if (jit.cycles != interpreter.cycles) {
+		fprintf(stderr, "  cycles jit[%llu] interpreter[%llu]\n", (unsigned long long) jit.cycles, (unsigned long long) interpreter.cycles);
+	}
+
+	for (size_t i = 0; i < std::max(jitWrites.size(), interpreterWrites.size()); ++i) {
+		if (i >= jitWrites.size() || i >= interpreterWrites.size() || jitWrites[i] != interpreterWrites[i]) {
+			fprintf(stderr, "  write #%zu differs (jit %zu writes, interpreter %zu writes)\n", i, jitWrites.size(), interpreterWrites.size());
+			break;
+		}
+	}
+
+	exit(1);
+}
+
+#else
+
+Translator::~Translator() {
+
+}
+
+uint32_t Translator::run(CPU &, uint32_t) {
+	// No native backend for this host
+	return 0;
+}
+
+#endif
+
+}
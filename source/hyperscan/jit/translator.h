@@ -0,0 +1,65 @@
+#include <cstddef>
+#include <cstdint>
+
+#include "hyperscan/blockcache.h"
+
+#ifndef __HYPERSCAN_JIT_TRANSLATOR_H__
+#define __HYPERSCAN_JIT_TRANSLATOR_H__
+
+namespace hyperscan {
+
+class CPU;
+
+namespace jit {
+
+/**
+ * Translates cached blocks into x86-64 code
+ * Guest registers stay in the CPU, addressed off a host register pinned to it
+ * Instructions without a native translation call their block cache handler
+ */
+class Translator {
+	public:
+		Translator() = default;
+
+		~Translator();
+
+		Translator(const Translator&) = delete;
+
+		Translator& operator=(const Translator&) = delete;
+
+		/**
+		 * Runs the block at PC natively, as long as it fits within budget instructions and no event comes due inside it
+		 * Native code advances cycles like the other engines, and leaves once an instruction makes an event due
+		 *
+		 * Returns the number of instructions executed, 0 when nothing ran
+		 */
+		uint32_t run(CPU &cpu, uint32_t budget);
+
+		// Re-run every native block through the interpreter and compare the results
+		bool lockstep = false;
+
+	private:
+		typedef uint32_t (*Native)(CPU *cpu);
+
+		/**
+		 * Generates native code for block
+		 */
+		Native compile(CPU &cpu, BlockCache::Block &block);
+
+		/**
+		 * Runs a native block, then the interpreter over the same instructions
+		 * Exits with a report of the first difference found
+		 * Blocks accessing devices are undone and left to be stepped, returning 0, as running them twice would show
+		 */
+		uint32_t verify(CPU &cpu, const BlockCache::Block &block);
+
+		// Executable memory holding all translations
+		uint8_t *arena = nullptr;
+		size_t used = 0;
+};
+
+}
+
+}
+
+#endif
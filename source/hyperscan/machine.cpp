@@ -0,0 +1,41 @@
+#include "hyperscan/machine.h"
+
+namespace hyperscan {
+
+Machine::Machine(const char *firmwarePath):
+	firmware(std::make_shared<memory::MappedFileMemoryRegion<24>>(firmwarePath)),
+	dram(std::make_shared<memory::SparseMemoryRegion<24>>()),
+	io(std::make_shared<io::IOMemoryRegion>(cpu)),
+	firmwarePath(firmwarePath) {
+	cpu.miu = std::make_shared<memory::SegmentedMemoryRegion<8, 24>>();
+
+	cpu.miu->setRegion(0x9E, firmware);
+	cpu.miu->setRegion(0x9F, firmware);
+
+	cpu.miu->setRegion(0x80, dram);
+	cpu.miu->setRegion(0xA0, dram);
+
+	cpu.miu->setRegion(0x08, io);
+	cpu.miu->setRegion(0x88, io);
+
+	// XXX: Debug control register
+	cpu.cr29 = 0x20000000;
+
+	// Firmware entry point
+	cpu.pc = 0x9F000000;
+
+//	// ISO "entry point"
+//	cpu.pc = 0xA0091000;
+}
+
+std::unique_ptr<Machine> Machine::fork() {
+	auto child = std::make_unique<Machine>(firmwarePath.c_str());
+	child->cpu.engine = cpu.engine;
+	child->cpu.jit.lockstep = cpu.jit.lockstep;
+	child->cpu.skipIdle = cpu.skipIdle;
+	child->cpu.forkFrom(cpu);
+
+	return child;
+}
+
+}
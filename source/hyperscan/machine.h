@@ -0,0 +1,56 @@
+#include <memory>
+#include <string>
+
+#include "hyperscan/cpu.h"
+#include "hyperscan/debugger.h"
+#include "hyperscan/io/io.h"
+#include "hyperscan/memory/mappedfilememoryregion.h"
+#include "hyperscan/memory/sparsememoryregion.h"
+
+#ifndef __HYPERSCAN_MACHINE_H__
+#define __HYPERSCAN_MACHINE_H__
+
+namespace hyperscan {
+
+/**
+ * A whole HyperScan: CPU, memory, I/O and the debugger looking at them
+ * Machines share no mutable state, any number of them can run side by side, each on one thread at a time
+ */
+class Machine {
+	public:
+		/**
+		 * Builds a machine booting the firmware in firmwarePath, mapped as on the hardware
+		 */
+		explicit Machine(const char *firmwarePath = "roms/hsfirmware.bin");
+
+		Machine(const Machine&) = delete;
+
+		Machine& operator=(const Machine&) = delete;
+
+		/**
+		 * Returns a copy of the machine as it is now, sharing memory copy-on-write
+		 * The copy runs the same engine, breakpoints and debugger state start out empty
+		 */
+		std::unique_ptr<Machine> fork();
+
+		CPU cpu;
+
+		// Mirrored at 0x9E00_0000 and 0x9F00_0000
+		std::shared_ptr<memory::MappedFileMemoryRegion<24>> firmware;
+
+		// Mirrored at 0x8000_0000 and 0xA000_0000
+		std::shared_ptr<memory::SparseMemoryRegion<24>> dram;
+
+		// Mirrored at 0x0800_0000 and 0x8800_0000
+		std::shared_ptr<io::IOMemoryRegion> io;
+
+		Debugger debugger;
+
+	private:
+		// Forks map the same firmware
+		std::string firmwarePath;
+};
+
+}
+
+#endif
@@ -1,5 +1,8 @@
+#include <algorithm>
 #include <array>
+#include <cstring>
 
+#include "hyperscan/memory/endian.h"
 #include "hyperscan/memory/memoryregion.h"
 
 #ifndef __HYPERSCAN_MEMORY_ARRAYMEMORYREGION_H__
@@ -22,16 +25,12 @@ class ArrayMemoryRegion: public MemoryRegion<addressable_bits > {
 
 		[[nodiscard]]
 		virtual uint16_t readU16(uint32_t address) const {
-			return memory[address + 0] << 0 |
-				   memory[address + 1] << 8;
+			return load16(&memory[address]);
 		}
 
 		[[nodiscard]]
 		virtual uint32_t readU32(uint32_t address) const {
-			return memory[address + 0] <<  0 |
-				   memory[address + 1] <<  8 |
-				   memory[address + 2] << 16 |
-				   memory[address + 3] << 24;
+			return load32(&memory[address]);
 		}
 
 		virtual void writeU8(uint32_t address, uint8_t value) {
@@ -39,18 +38,66 @@ class ArrayMemoryRegion: public MemoryRegion<addressable_bits > {
 		}
 
 		virtual void writeU16(uint32_t address, uint16_t value) {
-			memory[address + 0] = (value >> 0) & 0xFF;
-			memory[address + 1] = (value >> 8) & 0xFF;
+			store16(&memory[address], value);
 		}
 
 		virtual void writeU32(uint32_t address, uint32_t value) {
-			memory[address + 0] = (value >>  0) & 0xFF;
-			memory[address + 1] = (value >>  8) & 0xFF;
-			memory[address + 2] = (value >> 16) & 0xFF;
-			memory[address + 3] = (value >> 24) & 0xFF;
+			store32(&memory[address], value);
+		}
+
+		virtual void readBlock(uint32_t address, uint8_t *buffer, size_t size) const {
+			std::memcpy(buffer, &memory[address], size);
+		}
+
+		virtual void writeBlock(uint32_t address, const uint8_t *buffer, size_t size) {
+			std::memcpy(&memory[address], buffer, size);
+		}
+
+		[[nodiscard]]
+		virtual const uint8_t* readPage(uint32_t address) const {
+			return memory.data() + address;
+		}
+
+		[[nodiscard]]
+		virtual uint8_t* writePage(uint32_t address) {
+			return memory.data() + address;
+		}
+
+		// Only pages holding anything but zeros are saved
+		virtual void save(StateWriter &writer) const {
+			for (uint32_t offset = 0; offset < TOTAL_SIZE; offset += CHUNK_SIZE) {
+				const uint8_t *page = memory.data() + offset;
+				if (std::any_of(page, page + CHUNK_SIZE, [](uint8_t byte) { return byte; })) {
+					writer.write32(offset);
+					writer.writeBytes(page, CHUNK_SIZE);
+				}
+			}
+
+			writer.write32(END_OF_PAGES);
+		}
+
+		virtual void load(StateReader &reader) {
+			memory.fill(0);
+
+			for (uint32_t offset = reader.read32(); offset != END_OF_PAGES && reader.ok(); offset = reader.read32()) {
+				if (offset >= TOTAL_SIZE || (offset & PAGE_MASK)) {
+					return reader.fail();
+				}
+
+				reader.readBytes(memory.data() + offset, CHUNK_SIZE);
+			}
+		}
+
+		// Nothing is shared, the whole array is copied
+		virtual void share(MemoryRegion<addressable_bits > &source) {
+			memory = MemoryRegion<addressable_bits >::template sameKind<ArrayMemoryRegion>(source).memory;
 		}
 
 		std::array<uint8_t, TOTAL_SIZE > memory;
+
+	private:
+		// Saved a page at a time, regions smaller than a page at once
+		static constexpr unsigned CHUNK_SIZE  = std::min(PAGE_SIZE, TOTAL_SIZE);
 };
 
 }
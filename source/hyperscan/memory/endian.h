@@ -0,0 +1,60 @@
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#ifndef __HYPERSCAN_MEMORY_ENDIAN_H__
+#define __HYPERSCAN_MEMORY_ENDIAN_H__
+
+namespace hyperscan::memory {
+
+/**
+ * Reads a little endian half-word from host memory, which may be unaligned
+ */
+static inline uint16_t load16(const uint8_t *host) {
+	uint16_t value;
+	std::memcpy(&value, host, sizeof(value));
+	if constexpr (std::endian::native == std::endian::big) {
+		value = __builtin_bswap16(value);
+	}
+
+	return value;
+}
+
+/**
+ * Writes a little endian half-word to host memory, which may be unaligned
+ */
+static inline void store16(uint8_t *host, uint16_t value) {
+	if constexpr (std::endian::native == std::endian::big) {
+		value = __builtin_bswap16(value);
+	}
+
+	std::memcpy(host, &value, sizeof(value));
+}
+
+/**
+ * Reads a little endian word from host memory, which may be unaligned
+ */
+static inline uint32_t load32(const uint8_t *host) {
+	uint32_t value;
+	std::memcpy(&value, host, sizeof(value));
+	if constexpr (std::endian::native == std::endian::big) {
+		value = __builtin_bswap32(value);
+	}
+
+	return value;
+}
+
+/**
+ * Writes a little endian word to host memory, which may be unaligned
+ */
+static inline void store32(uint8_t *host, uint32_t value) {
+	if constexpr (std::endian::native == std::endian::big) {
+		value = __builtin_bswap32(value);
+	}
+
+	std::memcpy(host, &value, sizeof(value));
+}
+
+}
+
+#endif
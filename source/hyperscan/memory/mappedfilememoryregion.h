@@ -0,0 +1,250 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hyperscan/memory/endian.h"
+#include "hyperscan/memory/memoryregion.h"
+
+#ifndef __HYPERSCAN_MEMORY_MAPPEDFILEMEMORYREGION_H__
+#define __HYPERSCAN_MEMORY_MAPPEDFILEMEMORYREGION_H__
+
+namespace hyperscan::memory {
+
+/**
+ * Memory region backed by a file mapped into memory
+ * The file is mapped copy-on-write: pages are shared with every other process mapping it
+ * until written, and writes never reach the file. Space past the end of the file reads as zero
+ */
+template <unsigned addressable_bits >
+class MappedFileMemoryRegion: public MemoryRegion<addressable_bits > {
+	public:
+		static constexpr unsigned TOTAL_SIZE  = (1 << addressable_bits);
+
+		/**
+		 * Maps fileName at offset inside the region, offset has to be host page aligned
+		 */
+		explicit MappedFileMemoryRegion(const char *fileName, uint32_t offset = 0):
+			fileName(fileName), offset(offset) {
+			// Reserve the whole region, only pages actually written to are ever committed
+			void *region = mmap(nullptr, TOTAL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (region == MAP_FAILED) {
+				perror("mmap");
+				exit(1);
+			}
+
+			memory = static_cast<uint8_t*>(region);
+
+			if (offset % sysconf(_SC_PAGESIZE)) {
+				fprintf(stderr, "%s: offset %08X is not page aligned\n", fileName, offset);
+				exit(1);
+			}
+
+			mapFile();
+		}
+
+		virtual ~MappedFileMemoryRegion() {
+			munmap(memory, TOTAL_SIZE);
+		}
+
+		MappedFileMemoryRegion(const MappedFileMemoryRegion&) = delete;
+
+		MappedFileMemoryRegion& operator=(const MappedFileMemoryRegion&) = delete;
+
+		[[nodiscard]]
+		virtual uint8_t readU8(uint32_t address) const {
+			return memory[address];
+		}
+
+		[[nodiscard]]
+		virtual uint16_t readU16(uint32_t address) const {
+			return load16(memory + address);
+		}
+
+		[[nodiscard]]
+		virtual uint32_t readU32(uint32_t address) const {
+			return load32(memory + address);
+		}
+
+		virtual void writeU8(uint32_t address, uint8_t value) {
+			memory[address] = value;
+		}
+
+		virtual void writeU16(uint32_t address, uint16_t value) {
+			store16(memory + address, value);
+		}
+
+		virtual void writeU32(uint32_t address, uint32_t value) {
+			store32(memory + address, value);
+		}
+
+		virtual void readBlock(uint32_t address, uint8_t *buffer, size_t size) const {
+			std::memcpy(buffer, memory + address, size);
+		}
+
+		virtual void writeBlock(uint32_t address, const uint8_t *buffer, size_t size) {
+			std::memcpy(memory + address, buffer, size);
+		}
+
+		[[nodiscard]]
+		virtual const uint8_t* readPage(uint32_t address) const {
+			return memory + address;
+		}
+
+		[[nodiscard]]
+		virtual uint8_t* writePage(uint32_t address) {
+			return memory + address;
+		}
+
+		// Only pages that differ from the file, or from zero past its end, are saved
+		virtual void save(StateWriter &writer) const {
+			forEachDirtyPage([&](uint32_t address) {
+				writer.write32(address);
+				writer.writeBytes(memory + address, PAGE_SIZE);
+			});
+
+			writer.write32(END_OF_PAGES);
+		}
+
+		virtual void load(StateReader &reader) {
+			mapFile();
+
+			for (uint32_t address = reader.read32(); address != END_OF_PAGES && reader.ok(); address = reader.read32()) {
+				if (address >= TOTAL_SIZE || (address & PAGE_MASK)) {
+					return reader.fail();
+				}
+
+				reader.readBytes(memory + address, PAGE_SIZE);
+			}
+		}
+
+		// The file is mapped again, only pages written to are copied
+		virtual void share(MemoryRegion<addressable_bits > &source) {
+			auto &other = MemoryRegion<addressable_bits >::template sameKind<MappedFileMemoryRegion>(source);
+
+			fileName = other.fileName;
+			offset = other.offset;
+			mapFile();
+
+			other.forEachDirtyPage([&](uint32_t address) {
+				std::memcpy(memory + address, other.memory + address, PAGE_SIZE);
+			});
+		}
+
+	protected:
+		/**
+		 * Maps the file over the region afresh, dropping every write made so far
+		 * The region stays at the same host address
+		 */
+		void mapFile() {
+			if (mmap(memory, TOTAL_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED) {
+				perror("mmap");
+				exit(1);
+			}
+
+			int fd = open(fileName.c_str(), O_RDONLY);
+			struct stat info;
+			if (fd < 0 || fstat(fd, &info) < 0) {
+				fprintf(stderr, "bad file: %s\n", fileName.c_str());
+				exit(1);
+			}
+
+			// Pages past the end of the file fault, anything beyond stays anonymous
+			size_t size = std::min<size_t>(info.st_size, TOTAL_SIZE - offset);
+			if (size && mmap(memory + offset, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+				perror(fileName.c_str());
+				exit(1);
+			}
+
+			close(fd);
+		}
+
+		/**
+		 * Calls function with the address of every page that differs from the file, or from zero past its end
+		 */
+		template <typename Function >
+		void forEachDirtyPage(Function function) const {
+			int fd = open(fileName.c_str(), O_RDONLY);
+			if (fd < 0) {
+				perror(fileName.c_str());
+				exit(1);
+			}
+
+			std::vector<bool> written = writtenPages();
+
+			uint8_t original[PAGE_SIZE];
+			for (uint32_t address = 0; address < TOTAL_SIZE; address += PAGE_SIZE) {
+				if (!written[address / PAGE_SIZE]) {
+					continue;
+				}
+
+				// Whatever is not read from the file is zero
+				std::memset(original, 0, PAGE_SIZE);
+				if (address >= offset && pread(fd, original, PAGE_SIZE, address - offset) < 0) {
+					perror(fileName.c_str());
+					exit(1);
+				}
+
+				if (std::memcmp(memory + address, original, PAGE_SIZE)) {
+					function(address);
+				}
+			}
+
+			close(fd);
+		}
+
+		/**
+		 * Returns which pages may have been written, by page index
+		 * Written pages are private anonymous copies, which the kernel tells apart from pages of the file
+		 * Without /proc/self/pagemap every page may have been
+		 */
+		std::vector<bool> writtenPages() const {
+			static constexpr uint64_t PRESENT = 1ull << 63;
+			static constexpr uint64_t SWAPPED = 1ull << 62;
+			static constexpr uint64_t FILE    = 1ull << 61;
+
+			std::vector<bool> written(TOTAL_SIZE / PAGE_SIZE, true);
+
+			int pagemap = open("/proc/self/pagemap", O_RDONLY);
+			if (pagemap < 0) {
+				return written;
+			}
+
+			size_t hostPageSize = sysconf(_SC_PAGESIZE);
+			std::vector<uint64_t> entries(TOTAL_SIZE / hostPageSize);
+			off_t position = reinterpret_cast<uintptr_t>(memory) / hostPageSize * sizeof(uint64_t);
+			size_t size = entries.size() * sizeof(uint64_t);
+
+			if (pread(pagemap, entries.data(), size, position) == ssize_t(size)) {
+				std::fill(written.begin(), written.end(), false);
+				for (size_t i = 0; i < entries.size(); ++i) {
+					// Pages never touched are neither, the zero page mapped by reads past the file shows as anonymous
+					if ((entries[i] & (PRESENT | SWAPPED)) && !(entries[i] & FILE)) {
+						for (size_t address = i * hostPageSize; address < (i + 1) * hostPageSize; address += PAGE_SIZE) {
+							written[address / PAGE_SIZE] = true;
+						}
+					}
+				}
+			}
+
+			close(pagemap);
+			return written;
+		}
+
+		uint8_t *memory;
+
+		// Mapped again when loading state or sharing
+		std::string fileName;
+		uint32_t offset;
+};
+
+}
+
+#endif
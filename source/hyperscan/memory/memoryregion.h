@@ -1,10 +1,20 @@
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include "hyperscan/memory/state.h"
 
 #ifndef __HYPERSCAN_MEMORY_MEMORYREGION_H__
 #define __HYPERSCAN_MEMORY_MEMORYREGION_H__
 
 namespace hyperscan::memory {
 
+// Granularity of page based bookkeeping (write watches, page tables)
+static constexpr unsigned PAGE_BITS = 12;
+static constexpr unsigned PAGE_SIZE = (1 << PAGE_BITS);
+static constexpr unsigned PAGE_MASK = PAGE_SIZE - 1;
+
 /**
  * Defines a memory region inside the MIU
  */
@@ -57,6 +67,89 @@ class MemoryRegion {
 		 * Write an unsigned word
 		 */
 		virtual void writeU32(uint32_t address, uint32_t value) = 0;
+
+		/**
+		 * Read size bytes starting at address into buffer
+		 */
+		virtual void readBlock(uint32_t address, uint8_t *buffer, size_t size) const {
+			for (size_t i = 0; i < size; ++i) {
+				buffer[i] = readU8(address + i);
+			}
+		}
+
+		/**
+		 * Write size bytes from buffer starting at address
+		 */
+		virtual void writeBlock(uint32_t address, const uint8_t *buffer, size_t size) {
+			for (size_t i = 0; i < size; ++i) {
+				writeU8(address + i, buffer[i]);
+			}
+		}
+
+		/**
+		 * Host memory backing the page at address for direct reads
+		 * Returns nullptr when reads must go through readU32 and friends
+		 * The pointer may be looked up again after any write made without it
+		 */
+		[[nodiscard]]
+		virtual const uint8_t* readPage(uint32_t) const {
+			return nullptr;
+		}
+
+		/**
+		 * Host memory backing the page at address for direct writes
+		 * Returns nullptr when writes must go through writeU32 and friends
+		 */
+		[[nodiscard]]
+		virtual uint8_t* writePage(uint32_t) {
+			return nullptr;
+		}
+
+		/**
+		 * Whether reading address has no side effect and keeps returning the same until the next scheduled event
+		 * Loops only polling such addresses are skipped through, see CPU::run()
+		 */
+		[[nodiscard]]
+		virtual bool steady(uint32_t) const {
+			return true;
+		}
+
+		/**
+		 * Serializes the contents of the region, nothing for regions without state
+		 */
+		virtual void save(StateWriter &) const {
+
+		}
+
+		/**
+		 * Restores what save() wrote, failing reader when it does not fit the region
+		 */
+		virtual void load(StateReader &) {
+
+		}
+
+		/**
+		 * Makes the region a copy of source, the same kind of region, sharing what it can copy-on-write
+		 * Pages of source may stop being writable directly, pointers from writePage() have to be looked up again
+		 */
+		virtual void share(MemoryRegion &) {
+
+		}
+
+	protected:
+		/**
+		 * Returns source as Region, the kind of region it is shared with
+		 */
+		template <typename Region >
+		static Region& sameKind(MemoryRegion &source) {
+			Region *region = dynamic_cast<Region*>(&source);
+			if (!region) {
+				fprintf(stderr, "cannot share a region with a different kind of region\n");
+				exit(1);
+			}
+
+			return *region;
+		}
 };
 
 }
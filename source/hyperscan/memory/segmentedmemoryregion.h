@@ -1,7 +1,15 @@
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include "hyperscan/memory/emptymemoryregion.h"
+#include "hyperscan/memory/endian.h"
 #include "hyperscan/memory/memoryregion.h"
 
 #ifndef __HYPERSCAN_MEMORY_SEGMENTEDMEMORYREGION_H__
@@ -11,6 +19,10 @@ namespace hyperscan::memory {
 
 template <unsigned segment_bit_size, unsigned segment_data_bit_size >
 class SegmentedMemoryRegion : public MemoryRegion<segment_bit_size + segment_data_bit_size > {
+	static_assert(segment_data_bit_size >= PAGE_BITS, "segments must span whole pages");
+
+	typedef MemoryRegion<segment_bit_size + segment_data_bit_size > Base;
+
 	public:
 		static constexpr unsigned DATA_BITS             = segment_data_bit_size;
 
@@ -18,29 +30,546 @@ class SegmentedMemoryRegion : public MemoryRegion<segment_bit_size + segment_dat
 		static constexpr unsigned SEGMENT_SIZE          = (1 << segment_data_bit_size);
 		static constexpr unsigned SEGMENT_ACCESS_MASK   = SEGMENT_SIZE - 1;
 
+		static constexpr unsigned PAGE_COUNT            = (1 << (segment_bit_size + segment_data_bit_size - PAGE_BITS));
+
 		// Segment type
 		typedef MemoryRegion<segment_data_bit_size> Segment;
 
-		SegmentedMemoryRegion() {
+		// Called with the written address when a watched page is modified
+		typedef std::function<void(uint32_t address)> Watcher;
+
+		// A word written through writeU32
+		struct Write {
+			uint32_t address;
+			uint32_t value;
+
+			bool operator==(const Write&) const = default;
+		};
+
+		SegmentedMemoryRegion():
+			pages(new Page[PAGE_COUNT]()),
+			watched(PAGE_COUNT),
+			generation(++GENERATIONS) {
 			auto empty = std::shared_ptr<Segment>(new EmptyMemoryRegion<segment_data_bit_size>());
 			std::fill(segments.begin(), segments.end(), empty);
 		}
 
+		// Sub-word accesses keep the semantics of the default implementation: the aligned word is read and shifted
+
+		[[nodiscard]]
+		uint8_t readU8(uint32_t address) const final {
+			if (const uint8_t *host = readable(address)) [[likely]] {
+				return host[address & PAGE_MASK];
+			}
+
+			return Base::readU8(address);
+		}
+
+		[[nodiscard]]
+		uint16_t readU16(uint32_t address) const final {
+			if (const uint8_t *host = readable(address)) [[likely]] {
+				return load32(host + (address & PAGE_MASK & ~3)) >> ((address & 3) * 8);
+			}
+
+			return Base::readU16(address);
+		}
+
+		[[nodiscard]]
+		uint32_t readU32(uint32_t address) const final {
+			const uint8_t *host = readable(address);
+			if (host && (address & PAGE_MASK) <= PAGE_SIZE - 4) [[likely]] {
+				return load32(host + (address & PAGE_MASK));
+			}
+
+			const auto &segment = segments[address >> segment_data_bit_size];
+			if (capturing) [[unlikely]] {
+				// The read would happen again when the captured run is repeated, e.g. popping a FIFO twice
+				if (!segment->steady(address & SEGMENT_ACCESS_MASK)) {
+					deviceAccess = true;
+					return 0xFFFFFFFF;
+				}
+
+				return overlay(address, segment->readU32(address & SEGMENT_ACCESS_MASK));
+			}
+
+			return segment->readU32(address & SEGMENT_ACCESS_MASK);
+		}
+
 		[[nodiscard]]
-		virtual uint32_t readU32(uint32_t address) const {
-			return segments[address >> segment_data_bit_size]->readU32(address & SEGMENT_ACCESS_MASK);
+		bool steady(uint32_t address) const final {
+			return segments[address >> segment_data_bit_size]->steady(address & SEGMENT_ACCESS_MASK);
+		}
+
+		void writeU8(uint32_t address, uint8_t value) final {
+			if (uint8_t *host = writable(address)) [[likely]] {
+				host[address & PAGE_MASK] = value;
+				return;
+			}
+
+			Base::writeU8(address, value);
+		}
+
+		void writeU16(uint32_t address, uint16_t value) final {
+			if (uint8_t *host = writable(address)) [[likely]] {
+				uint8_t *word = host + (address & PAGE_MASK & ~3);
+				uint32_t shift = (address & 3) * 8;
+				store32(word, (load32(word) & ~(0xFFFFu << shift)) | (uint32_t(value) << shift));
+				return;
+			}
+
+			Base::writeU16(address, value);
+		}
+
+		void writeU32(uint32_t address, uint32_t value) final {
+			uint8_t *host = writable(address);
+			if (host && (address & PAGE_MASK) <= PAGE_SIZE - 4) [[likely]] {
+				store32(host + (address & PAGE_MASK), value);
+				return;
+			}
+
+			if (journal) [[unlikely]] {
+				journal->push_back({ address, value });
+			}
+
+			// Registers have no host memory, their side effects only come once the captured run is repeated
+			if (capturing && !pages[page(address)].read) {
+				deviceAccess = true;
+			}
+
+			if (!capturing) {
+				segments[address >> segment_data_bit_size]->writeU32(address & SEGMENT_ACCESS_MASK, value);
+
+				// The segment may have moved its pages around, e.g. on the first write to one
+				refresh(address);
+				if (page(address + 3) != page(address)) {
+					refresh(address + 3);
+				}
+			}
+
+			if (watched[page(address)] || watched[page(address + 3)]) {
+				notify(address);
+			}
+		}
+
+		// Whole pages are copied at once, others are moved a byte at a time
+		void readBlock(uint32_t address, uint8_t *buffer, size_t size) const final {
+			while (size) {
+				size_t chunk = std::min<size_t>(size, PAGE_SIZE - (address & PAGE_MASK));
+				if (const uint8_t *host = readable(address)) {
+					std::memcpy(buffer, host + (address & PAGE_MASK), chunk);
+				} else {
+					Base::readBlock(address, buffer, chunk);
+				}
+
+				address += chunk;
+				buffer += chunk;
+				size -= chunk;
+			}
+		}
+
+		void writeBlock(uint32_t address, const uint8_t *buffer, size_t size) final {
+			while (size) {
+				size_t chunk = std::min<size_t>(size, PAGE_SIZE - (address & PAGE_MASK));
+				if (uint8_t *host = writable(address)) {
+					std::memcpy(host + (address & PAGE_MASK), buffer, chunk);
+				} else {
+					Base::writeBlock(address, buffer, chunk);
+				}
+
+				address += chunk;
+				buffer += chunk;
+				size -= chunk;
+			}
 		}
 
-		virtual void writeU32(uint32_t address, uint32_t value) {
-			segments[address >> segment_data_bit_size]->writeU32(address & SEGMENT_ACCESS_MASK, value);
+		/**
+		 * Copies count words from source to dest in ascending order, as a bus master moving a word at a time would
+		 * Runs of pages both sides have host memory for are copied at once, other words go through readU32 and writeU32
+		 */
+		void copyWords(uint32_t dest, uint32_t source, size_t count) {
+			dest &= ~3;
+			source &= ~3;
+
+			while (count) {
+				size_t chunk = std::min<size_t>({ count, (PAGE_SIZE - (source & PAGE_MASK)) / 4, (PAGE_SIZE - (dest & PAGE_MASK)) / 4 });
+
+				const uint8_t *from = readable(source);
+				uint8_t *to = writable(dest);
+				if (from && to) {
+					from += source & PAGE_MASK;
+					to += dest & PAGE_MASK;
+
+					// Copying ahead of itself repeats what it wrote, memmove would not
+					if (to <= from || to >= from + chunk * 4) {
+						std::memmove(to, from, chunk * 4);
+						dest += chunk * 4;
+						source += chunk * 4;
+						count -= chunk;
+						continue;
+					}
+				}
+
+				// A single word, the write may give the page host memory for the rest
+				writeU32(dest, readU32(source));
+				dest += 4;
+				source += 4;
+				count -= 1;
+			}
+		}
+
+		/**
+		 * Writes value to count words from dest, like copyWords() does
+		 */
+		void fillWords(uint32_t dest, uint32_t value, size_t count) {
+			dest &= ~3;
+
+			while (count) {
+				size_t chunk = std::min<size_t>(count, (PAGE_SIZE - (dest & PAGE_MASK)) / 4);
+
+				if (uint8_t *to = writable(dest)) {
+					to += dest & PAGE_MASK;
+					if (value == (value & 0xFF) * 0x01010101u) {
+						std::memset(to, value & 0xFF, chunk * 4);
+					} else {
+						for (size_t i = 0; i < chunk; ++i) {
+							store32(to + i * 4, value);
+						}
+					}
+
+					dest += chunk * 4;
+					count -= chunk;
+					continue;
+				}
+
+				writeU32(dest, value);
+				dest += 4;
+				count -= 1;
+			}
 		}
 
 		void setRegion(uint8_t address, std::shared_ptr<Segment> segment) {
 			segments[address] = segment;
+
+			for (uint32_t offset = 0; offset < SEGMENT_SIZE; offset += PAGE_SIZE) {
+				map((uint32_t(address) << segment_data_bit_size) | offset);
+			}
+			moved();
+		}
+
+		/**
+		 * Region mapped at segment address
+		 */
+		[[nodiscard]]
+		const std::shared_ptr<Segment>& region(uint8_t address) const {
+			return segments[address];
+		}
+
+		/**
+		 * Looks up host memory again for the pages of segment address written directly, and of its mirrors
+		 * Needed once pages of the region behind it were shared from outside, share() does the same for every segment
+		 */
+		void unmapWritable(uint8_t address) {
+			forEachMirror(uint32_t(address) << segment_data_bit_size, [this](uint32_t base) {
+				for (uint32_t offset = 0; offset < SEGMENT_SIZE; offset += PAGE_SIZE) {
+					if (pages[page(base | offset)].write) {
+						map(base | offset);
+					}
+				}
+			});
+
+			moved();
+		}
+
+		/**
+		 * Host memory of the page containing address for direct reads, nullptr when reads have to go through readU32
+		 * Stays valid as long as layout() returns the same
+		 */
+		[[nodiscard]]
+		const uint8_t* readablePage(uint32_t address) const {
+			return readable(address);
+		}
+
+		/**
+		 * Changes whenever host memory behind any page may have moved, never the same for two regions
+		 */
+		[[nodiscard]]
+		uint64_t layout() const {
+			return generation;
+		}
+
+		/**
+		 * Sets the function called when a watched page is written
+		 */
+		void setWatcher(Watcher function) {
+			watcher = std::move(function);
+		}
+
+		/**
+		 * Watch the page containing address for writes
+		 * Every mirror of the page (segments mapping the same region) is watched as well
+		 * Writes to watched pages always go through the segment
+		 */
+		void watch(uint32_t address) {
+			forEachMirror(address, [this](uint32_t mirror) {
+				watched[page(mirror)] = true;
+				pages[page(mirror)].write = nullptr;
+			});
+		}
+
+		/**
+		 * Stop watching the page containing address, and every mirror of it
+		 * Writes go to host memory directly again where the segment allows it
+		 */
+		void unwatch(uint32_t address) {
+			forEachMirror(address, [this](uint32_t mirror) {
+				watched[page(mirror)] = false;
+				map(mirror);
+			});
+		}
+
+		/**
+		 * Stop watching all pages
+		 */
+		void unwatchAll() {
+			std::fill(watched.begin(), watched.end(), false);
+			remap();
+		}
+
+		/**
+		 * Calls function with address translated into every segment mapping the same region
+		 */
+		template <typename Function >
+		void forEachMirror(uint32_t address, Function function) const {
+			const auto &segment = segments[address >> segment_data_bit_size];
+			for (unsigned i = 0; i < SEGMENT_COUNT; ++i) {
+				if (segments[i] == segment) {
+					function((i << segment_data_bit_size) | (address & SEGMENT_ACCESS_MASK));
+				}
+			}
+		}
+
+		/**
+		 * Saves every distinct segment once, mirrors are saved with the first segment mapping them
+		 * Loading expects segments laid out the same way, the state of a region always goes back to it
+		 */
+		void save(StateWriter &writer) const override {
+			for (unsigned i = 0; i < SEGMENT_COUNT; ++i) {
+				if (mirrored(i) != i) {
+					continue;
+				}
+
+				writer.write16(i);
+				size_t section = writer.begin();
+				segments[i]->save(writer);
+				writer.end(section);
+			}
+
+			writer.write16(SEGMENT_COUNT);
+		}
+
+		void load(StateReader &reader) override {
+			for (unsigned i = reader.read16(); i != SEGMENT_COUNT && reader.ok(); i = reader.read16()) {
+				if (i > SEGMENT_COUNT) {
+					return reader.fail();
+				}
+
+				size_t section = reader.begin();
+				segments[i]->load(reader);
+				reader.end(section);
+			}
+
+			// Segments may have replaced the host memory behind their pages
+			remap();
+		}
+
+		/**
+		 * Shares every distinct segment with the one at the same place in source, which has to be laid out the same way
+		 */
+		void share(Base &source) override {
+			auto &other = Base::template sameKind<SegmentedMemoryRegion>(source);
+
+			for (unsigned i = 0; i < SEGMENT_COUNT; ++i) {
+				if (mirrored(i) != other.mirrored(i)) {
+					fprintf(stderr, "cannot share regions laid out differently, segment %02X\n", i);
+					exit(1);
+				}
+
+				if (mirrored(i) == i) {
+					segments[i]->share(*other.segments[i]);
+				}
+			}
+
+			// Pages of both sides may have stopped being writable directly
+			remap();
+			other.unmapWritable();
+		}
+
+		/**
+		 * Appends every write to journal, or stops when journal is nullptr
+		 * When capturing, writes are only journaled and later reads see them through the journal
+		 */
+		void setJournal(std::vector<Write> *writes, bool capture = false) {
+			journal = writes;
+			capturing = writes && capture;
+			deviceAccess = false;
+			moved();
+		}
+
+		/**
+		 * Whether the capture started by the last setJournal() accessed a device rather than memory
+		 * Reads with side effects were not made and returned all ones, writes only take effect when repeated
+		 */
+		[[nodiscard]]
+		bool deviceAccessed() const {
+			return deviceAccess;
 		}
 
 	protected:
+		// Host memory of a page, nullptr when accesses go through the segment
+		struct Page {
+			const uint8_t *read;
+			uint8_t *write;
+		};
+
+		static constexpr uint32_t page(uint32_t address) {
+			return (address >> PAGE_BITS) & (PAGE_COUNT - 1);
+		}
+
+		const uint8_t* readable(uint32_t address) const {
+			return capturing ? nullptr : pages[page(address)].read;
+		}
+
+		uint8_t* writable(uint32_t address) const {
+			return journal ? nullptr : pages[page(address)].write;
+		}
+
+		/**
+		 * Looks up host memory for the page containing address from its segment
+		 */
+		void map(uint32_t address) {
+			const auto &segment = segments[(address >> segment_data_bit_size) & (SEGMENT_COUNT - 1)];
+			uint32_t offset = address & SEGMENT_ACCESS_MASK & ~PAGE_MASK;
+
+			Page &entry = pages[page(address)];
+			entry.read = segment->readPage(offset);
+			entry.write = watched[page(address)] ? nullptr : segment->writePage(offset);
+		}
+
+		/**
+		 * Maps the page containing address again after a write through its segment, only if that could have changed it
+		 * Writes either allocate or copy a page, giving it new host memory, or may make a page without a write pointer writable
+		 */
+		void refresh(uint32_t address) {
+			const Page &entry = pages[page(address)];
+			if (!entry.read) {
+				return;
+			}
+
+			const auto &segment = segments[(address >> segment_data_bit_size) & (SEGMENT_COUNT - 1)];
+			const uint8_t *previous = entry.read;
+			if (segment->readPage(address & SEGMENT_ACCESS_MASK & ~PAGE_MASK) == previous && (entry.write || watched[page(address)])) {
+				return;
+			}
+
+			forEachMirror(address, [this](uint32_t mirror) {
+				map(mirror);
+			});
+
+			if (entry.read != previous) {
+				moved();
+			}
+		}
+
+		/**
+		 * Looks up host memory for every page
+		 * Each region is only asked once, mirrors copy what the first segment mapping it got
+		 */
+		void remap() {
+			for (unsigned i = 0; i < SEGMENT_COUNT; ++i) {
+				unsigned first = mirrored(i);
+				for (uint32_t offset = 0; offset < SEGMENT_SIZE; offset += PAGE_SIZE) {
+					uint32_t address = (i << segment_data_bit_size) | offset;
+					if (first == i) {
+						map(address);
+						continue;
+					}
+
+					const Page &original = pages[page((first << segment_data_bit_size) | offset)];
+					pages[page(address)] = { original.read, watched[page(address)] ? nullptr : original.write };
+				}
+			}
+
+			moved();
+		}
+
+		/**
+		 * Looks up host memory again for pages written directly, e.g. once they may have become shared
+		 * Pages not writable directly stay that way until a write through their segment maps them
+		 */
+		void unmapWritable() {
+			for (uint32_t i = 0; i < PAGE_COUNT; ++i) {
+				if (pages[i].write) {
+					map(i << PAGE_BITS);
+				}
+			}
+
+			moved();
+		}
+
+		/**
+		 * Tells holders of pointers from readablePage() to look them up again, called once pages were mapped
+		 */
+		void moved() {
+			generation = ++GENERATIONS;
+		}
+
+		/**
+		 * Returns the first segment mapping the same region as segment index
+		 */
+		unsigned mirrored(unsigned index) const {
+			return std::find(segments.begin(), segments.begin() + index, segments[index]) - segments.begin();
+		}
+
+		// Applies captured writes overlapping the word at address
+		uint32_t overlay(uint32_t address, uint32_t value) const {
+			for (const Write &write : *journal) {
+				for (uint32_t i = 0; i < 4; ++i) {
+					uint32_t offset = write.address + i - address;
+					if (offset < 4) {
+						value &= ~(0xFF << (offset * 8));
+						value |= ((write.value >> (i * 8)) & 0xFF) << (offset * 8);
+					}
+				}
+			}
+
+			return value;
+		}
+
+		void notify(uint32_t address) const {
+			if (!watcher) {
+				return;
+			}
+
+			forEachMirror(address, watcher);
+		}
+
 		std::array<std::shared_ptr<Segment>, SEGMENT_COUNT> segments;
+
+		// Direct host access, indexed by page
+		std::unique_ptr<Page[]> pages;
+
+		std::vector<bool> watched;
+		Watcher watcher;
+
+		std::vector<Write> *journal = nullptr;
+		bool capturing = false;
+
+		// Set by reads too, see deviceAccessed()
+		mutable bool deviceAccess = false;
+
+		// Shared by every region, so a layout never repeats even across regions
+		static inline std::atomic<uint64_t> GENERATIONS = 0;
+		uint64_t generation;
 };
 
 }
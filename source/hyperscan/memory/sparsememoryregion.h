@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "hyperscan/memory/endian.h"
+#include "hyperscan/memory/memoryregion.h"
+
+#ifndef __HYPERSCAN_MEMORY_SPARSEMEMORYREGION_H__
+#define __HYPERSCAN_MEMORY_SPARSEMEMORYREGION_H__
+
+namespace hyperscan::memory {
+
+/**
+ * Zero initialized memory region, allocated a page at a time on first write
+ * Pages never written read from a single shared zero page
+ * Pages shared with another region by share() are copied on the first write to either
+ * Regions sharing pages may run on different threads, each on one thread at a time
+ */
+template <unsigned addressable_bits >
+class SparseMemoryRegion: public MemoryRegion<addressable_bits > {
+	static_assert(addressable_bits >= PAGE_BITS, "region must span whole pages");
+
+	// Contents of a page, along with the number of regions holding it
+	struct Page {
+		std::array<uint8_t, PAGE_SIZE> bytes;
+		std::atomic<uint32_t> holders;
+	};
+
+	/**
+	 * Counted reference to a page, as a shared_ptr whose count is read with acquire ordering
+	 * Seeing itself as the only holder, a region knows whatever others did with the page before dropping it is done
+	 */
+	class Reference {
+		public:
+			Reference() = default;
+
+			explicit Reference(Page *page):
+				page(page) {
+
+			}
+
+			Reference(const Reference &other):
+				page(other.page) {
+				if (page) {
+					page->holders.fetch_add(1, std::memory_order_relaxed);
+				}
+			}
+
+			Reference(Reference &&other):
+				page(std::exchange(other.page, nullptr)) {
+
+			}
+
+			Reference& operator=(Reference other) {
+				std::swap(page, other.page);
+				return *this;
+			}
+
+			~Reference() {
+				// The last holder deletes it, after everything other holders did
+				if (page && page->holders.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+					delete page;
+				}
+			}
+
+			explicit operator bool() const {
+				return page;
+			}
+
+			Page* operator->() const {
+				return page;
+			}
+
+			/**
+			 * Whether no other region holds the page, which can then be written in place
+			 */
+			[[nodiscard]]
+			bool unique() const {
+				return page->holders.load(std::memory_order_acquire) == 1;
+			}
+
+		private:
+			Page *page = nullptr;
+	};
+
+	public:
+		static constexpr unsigned TOTAL_SIZE  = (1 << addressable_bits);
+		static constexpr unsigned PAGE_COUNT  = TOTAL_SIZE / PAGE_SIZE;
+
+		SparseMemoryRegion():
+			pages(PAGE_COUNT) {
+
+		}
+
+		[[nodiscard]]
+		virtual uint8_t readU8(uint32_t address) const {
+			return host(address)[address & PAGE_MASK];
+		}
+
+		[[nodiscard]]
+		virtual uint16_t readU16(uint32_t address) const {
+			if ((address & PAGE_MASK) > PAGE_SIZE - 2) [[unlikely]] {
+				return readU8(address) | readU8(address + 1) << 8;
+			}
+
+			return load16(host(address) + (address & PAGE_MASK));
+		}
+
+		[[nodiscard]]
+		virtual uint32_t readU32(uint32_t address) const {
+			if ((address & PAGE_MASK) > PAGE_SIZE - 4) [[unlikely]] {
+				return readU16(address) | readU16(address + 2) << 16;
+			}
+
+			return load32(host(address) + (address & PAGE_MASK));
+		}
+
+		virtual void writeU8(uint32_t address, uint8_t value) {
+			allocate(address)[address & PAGE_MASK] = value;
+		}
+
+		virtual void writeU16(uint32_t address, uint16_t value) {
+			if ((address & PAGE_MASK) > PAGE_SIZE - 2) [[unlikely]] {
+				writeU8(address + 0, value >> 0);
+				writeU8(address + 1, value >> 8);
+				return;
+			}
+
+			store16(allocate(address) + (address & PAGE_MASK), value);
+		}
+
+		virtual void writeU32(uint32_t address, uint32_t value) {
+			if ((address & PAGE_MASK) > PAGE_SIZE - 4) [[unlikely]] {
+				writeU16(address + 0, value >>  0);
+				writeU16(address + 2, value >> 16);
+				return;
+			}
+
+			store32(allocate(address) + (address & PAGE_MASK), value);
+		}
+
+		virtual void readBlock(uint32_t address, uint8_t *buffer, size_t size) const {
+			while (size) {
+				size_t chunk = std::min<size_t>(size, PAGE_SIZE - (address & PAGE_MASK));
+				std::memcpy(buffer, host(address) + (address & PAGE_MASK), chunk);
+
+				address += chunk;
+				buffer += chunk;
+				size -= chunk;
+			}
+		}
+
+		virtual void writeBlock(uint32_t address, const uint8_t *buffer, size_t size) {
+			while (size) {
+				size_t chunk = std::min<size_t>(size, PAGE_SIZE - (address & PAGE_MASK));
+				std::memcpy(allocate(address) + (address & PAGE_MASK), buffer, chunk);
+
+				address += chunk;
+				buffer += chunk;
+				size -= chunk;
+			}
+		}
+
+		[[nodiscard]]
+		virtual const uint8_t* readPage(uint32_t address) const {
+			return host(address);
+		}
+
+		// Pages not allocated yet, or shared, are written through writeU32, which allocates them
+		[[nodiscard]]
+		virtual uint8_t* writePage(uint32_t address) {
+			const auto &page = pages[(address >> PAGE_BITS) & (PAGE_COUNT - 1)];
+			return (page && page.unique()) ? page->bytes.data() : nullptr;
+		}
+
+		/**
+		 * Number of pages allocated so far
+		 */
+		[[nodiscard]]
+		size_t committed() const {
+			return std::count_if(pages.begin(), pages.end(), [](const auto &page) {
+				return bool(page);
+			});
+		}
+
+		// Only pages holding anything but zeros are saved
+		virtual void save(StateWriter &writer) const {
+			for (unsigned i = 0; i < PAGE_COUNT; ++i) {
+				const auto &page = pages[i];
+				if (page && std::any_of(page->bytes.begin(), page->bytes.end(), [](uint8_t byte) { return byte; })) {
+					writer.write32(i << PAGE_BITS);
+					writer.writeBytes(page->bytes.data(), PAGE_SIZE);
+				}
+			}
+
+			writer.write32(END_OF_PAGES);
+		}
+
+		virtual void load(StateReader &reader) {
+			for (auto &page : pages) {
+				page = Reference();
+			}
+
+			for (uint32_t offset = reader.read32(); offset != END_OF_PAGES && reader.ok(); offset = reader.read32()) {
+				if (offset >= TOTAL_SIZE || (offset & PAGE_MASK)) {
+					return reader.fail();
+				}
+
+				reader.readBytes(allocate(offset), PAGE_SIZE);
+			}
+		}
+
+		virtual void share(MemoryRegion<addressable_bits > &source) {
+			pages = MemoryRegion<addressable_bits >::template sameKind<SparseMemoryRegion>(source).pages;
+		}
+
+	protected:
+		/**
+		 * Returns the page containing address, the zero page if not allocated yet
+		 * Unlike readPage(), this still works for subclasses hiding their pages from direct access
+		 */
+		const uint8_t* host(uint32_t address) const {
+			const auto &page = pages[(address >> PAGE_BITS) & (PAGE_COUNT - 1)];
+			return page ? page->bytes.data() : ZERO.data();
+		}
+
+		/**
+		 * Returns the page containing address, allocating it if needed
+		 * A page still shared with another region is copied first
+		 */
+		uint8_t* allocate(uint32_t address) {
+			auto &page = pages[(address >> PAGE_BITS) & (PAGE_COUNT - 1)];
+			if (!page) [[unlikely]] {
+				page = Reference(new Page{ .bytes = {}, .holders = 1 });
+			} else if (!page.unique()) [[unlikely]] {
+				page = Reference(new Page{ .bytes = page->bytes, .holders = 1 });
+			}
+
+			return page->bytes.data();
+		}
+
+		static inline const std::array<uint8_t, PAGE_SIZE> ZERO = {};
+
+		// Only ever shared between regions, a page is written by whoever holds the last reference
+		std::vector<Reference> pages;
+};
+
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "hyperscan/memory/endian.h"
+
+#ifndef __HYPERSCAN_MEMORY_STATE_H__
+#define __HYPERSCAN_MEMORY_STATE_H__
+
+namespace hyperscan::memory {
+
+// Ends a list of pages, each written as its offset followed by its contents
+static constexpr uint32_t END_OF_PAGES = 0xFFFFFFFF;
+
+/**
+ * Serializes machine state into a byte buffer, values are stored little endian
+ */
+class StateWriter {
+	public:
+		void write8(uint8_t value) {
+			buffer.push_back(value);
+		}
+
+		void write16(uint16_t value) {
+			store16(grow(sizeof(value)), value);
+		}
+
+		void write32(uint32_t value) {
+			store32(grow(sizeof(value)), value);
+		}
+
+		void write64(uint64_t value) {
+			write32(value);
+			write32(value >> 32);
+		}
+
+		void writeBytes(const uint8_t *data, size_t size) {
+			std::memcpy(grow(size), data, size);
+		}
+
+		/**
+		 * Starts a section prefixed with its size, so readers can tell when it does not match what they expect
+		 * Returns what has to be given to end()
+		 */
+		size_t begin() {
+			write32(0);
+			return buffer.size();
+		}
+
+		void end(size_t start) {
+			store32(buffer.data() + start - sizeof(uint32_t), buffer.size() - start);
+		}
+
+		[[nodiscard]]
+		const std::vector<uint8_t>& data() const {
+			return buffer;
+		}
+
+	private:
+		uint8_t* grow(size_t size) {
+			buffer.resize(buffer.size() + size);
+			return buffer.data() + buffer.size() - size;
+		}
+
+		std::vector<uint8_t> buffer;
+};
+
+/**
+ * Reads back what StateWriter wrote
+ * Reading past the end, or past the end of a section, marks the reader failed and every read from then on yields zeros
+ */
+class StateReader {
+	public:
+		StateReader(const uint8_t *data, size_t size):
+			data(data), position(0), limit(size), failed(false) {
+
+		}
+
+		uint8_t read8() {
+			const uint8_t *host = take(sizeof(uint8_t));
+			return host ? *host : 0;
+		}
+
+		uint16_t read16() {
+			const uint8_t *host = take(sizeof(uint16_t));
+			return host ? load16(host) : 0;
+		}
+
+		uint32_t read32() {
+			const uint8_t *host = take(sizeof(uint32_t));
+			return host ? load32(host) : 0;
+		}
+
+		uint64_t read64() {
+			uint64_t low = read32();
+			return low | uint64_t(read32()) << 32;
+		}
+
+		void readBytes(uint8_t *buffer, size_t size) {
+			const uint8_t *host = take(size);
+			if (host) {
+				std::memcpy(buffer, host, size);
+			} else {
+				std::memset(buffer, 0, size);
+			}
+		}
+
+		/**
+		 * Enters a section written between StateWriter::begin() and end()
+		 * Returns what has to be given to end()
+		 */
+		size_t begin() {
+			size_t size = read32();
+			size_t outer = limit;
+			if (size > limit - position) {
+				fail();
+				return outer;
+			}
+
+			limit = position + size;
+			return outer;
+		}
+
+		/**
+		 * Leaves the current section, which fails the reader if it was not read exactly
+		 */
+		void end(size_t outer) {
+			if (position != limit) {
+				fail();
+			}
+
+			limit = outer;
+		}
+
+		/**
+		 * Marks the state as unusable, e.g. when it describes a different machine layout
+		 */
+		void fail() {
+			failed = true;
+			position = limit;
+		}
+
+		[[nodiscard]]
+		bool ok() const {
+			return !failed;
+		}
+
+	private:
+		const uint8_t* take(size_t size) {
+			if (failed || size > limit - position) {
+				fail();
+				return nullptr;
+			}
+
+			position += size;
+			return data + position - size;
+		}
+
+		const uint8_t *data;
+		size_t position;
+		size_t limit;
+		bool failed;
+};
+
+}
+
+#endif
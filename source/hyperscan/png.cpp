@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <vector>
+
+#include <zlib.h>
+
+#include "hyperscan/png.h"
+
+static constexpr uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+// IHDR fields past the size: 8 bits per channel, truecolor with alpha, no interlacing
+static constexpr uint8_t BIT_DEPTH = 8;
+static constexpr uint8_t COLOR_TYPE_RGBA = 6;
+
+// Every row starts with its filter type, none is applied
+static constexpr uint8_t FILTER_NONE = 0;
+
+/**
+ * Appends value to data, most significant byte first as PNG wants
+ */
+static void append_be32(std::vector<uint8_t> &data, uint32_t value) {
+	data.push_back(value >> 24);
+	data.push_back(value >> 16);
+	data.push_back(value >>  8);
+	data.push_back(value >>  0);
+}
+
+/**
+ * Appends a chunk of the given type to png, with its length and CRC
+ */
+static void append_chunk(std::vector<uint8_t> &png, const char type[4], const std::vector<uint8_t> &payload) {
+	append_be32(png, payload.size());
+
+	size_t start = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), payload.begin(), payload.end());
+
+	append_be32(png, crc32(0, png.data() + start, png.size() - start));
+}
+
+bool png_save(const char *path, const uint32_t *pixels, unsigned width, unsigned height) {
+	std::vector<uint8_t> header;
+	append_be32(header, width);
+	append_be32(header, height);
+	header.insert(header.end(), { BIT_DEPTH, COLOR_TYPE_RGBA, 0, 0, 0 });
+
+	std::vector<uint8_t> raw;
+	raw.reserve(size_t(width * 4 + 1) * height);
+	for (unsigned y = 0; y < height; ++y) {
+		raw.push_back(FILTER_NONE);
+		for (unsigned x = 0; x < width; ++x) {
+			uint32_t pixel = pixels[size_t(y) * width + x];
+			raw.insert(raw.end(), { uint8_t(pixel), uint8_t(pixel >> 8), uint8_t(pixel >> 16), uint8_t(pixel >> 24) });
+		}
+	}
+
+	// Screenshots are taken while running, speed matters more than size
+	uLongf compressedSize = compressBound(raw.size());
+	std::vector<uint8_t> compressed(compressedSize);
+	if (compress2(compressed.data(), &compressedSize, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK) {
+		fprintf(stderr, "%s: compression failed\n", path);
+		return false;
+	}
+	compressed.resize(compressedSize);
+
+	std::vector<uint8_t> png(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+	append_chunk(png, "IHDR", header);
+	append_chunk(png, "IDAT", compressed);
+	append_chunk(png, "IEND", {});
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+
+	bool written = fwrite(png.data(), png.size(), 1, file) == 1;
+	if (fclose(file) || !written) {
+		perror(path);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,14 @@
+#include <cstdint>
+
+#ifndef __HYPERSCAN_PNG_H__
+#define __HYPERSCAN_PNG_H__
+
+/**
+ * Writes width by height pixels to path as an 8-bit RGBA PNG
+ * Pixels go row by row, each word holding red in its low byte up to alpha in its high byte
+ *
+ * Returns false, with the reason printed, when the image could not be written
+ */
+bool png_save(const char *path, const uint32_t *pixels, unsigned width, unsigned height);
+
+#endif
@@ -0,0 +1,88 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "hyperscan/runner.h"
+
+namespace hyperscan {
+
+Runner::Runner(unsigned threads):
+	threads(std::max(1u, threads ? threads : std::thread::hardware_concurrency())),
+	queues(new Queue[this->threads]) {
+
+}
+
+void Runner::add(Machine &machine) {
+	machines.push_back(&machine);
+}
+
+void Runner::run(const Slice &slice) {
+	for (size_t i = 0; i < machines.size(); ++i) {
+		queues[i % threads].machines.push_back(machines[i]);
+	}
+
+	// Machines either queued or running a slice
+	std::atomic<size_t> remaining = machines.size();
+
+	auto work = [&](unsigned thread) {
+		while (remaining) {
+			Machine *machine = take(thread);
+			if (!machine) {
+				// Whatever is left is running elsewhere
+				std::this_thread::yield();
+				continue;
+			}
+
+			if (slice(*machine)) {
+				give(thread, machine);
+			} else {
+				--remaining;
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for (unsigned thread = 1; thread < std::min<size_t>(threads, machines.size()); ++thread) {
+		workers.emplace_back(work, thread);
+	}
+
+	work(0);
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+
+	machines.clear();
+}
+
+Machine* Runner::take(unsigned thread) {
+	{
+		Queue &own = queues[thread];
+		std::lock_guard<std::mutex> guard(own.lock);
+		if (!own.machines.empty()) {
+			Machine *machine = own.machines.front();
+			own.machines.pop_front();
+			return machine;
+		}
+	}
+
+	// Steal from the back, which is what its owner would get to last
+	for (unsigned i = 1; i < threads; ++i) {
+		Queue &victim = queues[(thread + i) % threads];
+		std::lock_guard<std::mutex> guard(victim.lock);
+		if (!victim.machines.empty()) {
+			Machine *machine = victim.machines.back();
+			victim.machines.pop_back();
+			return machine;
+		}
+	}
+
+	return nullptr;
+}
+
+void Runner::give(unsigned thread, Machine *machine) {
+	Queue &own = queues[thread];
+	std::lock_guard<std::mutex> guard(own.lock);
+	own.machines.push_back(machine);
+}
+
+}
@@ -0,0 +1,61 @@
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "hyperscan/machine.h"
+
+#ifndef __HYPERSCAN_RUNNER_H__
+#define __HYPERSCAN_RUNNER_H__
+
+namespace hyperscan {
+
+/**
+ * Runs many machines across host threads, a time slice at a time
+ * Every thread takes machines from its own queue in turn, and steals from the others once it runs dry
+ */
+class Runner {
+	public:
+		// Runs one time slice of machine, returns whether it has more to run
+		typedef std::function<bool(Machine &machine)> Slice;
+
+		/**
+		 * Uses up to threads host threads, one per host core when 0
+		 */
+		explicit Runner(unsigned threads = 0);
+
+		/**
+		 * Adds a machine to the next run(), it has to outlive it
+		 */
+		void add(Machine &machine);
+
+		/**
+		 * Calls slice on every machine added until it returns false for all of them
+		 * Slices of different machines run concurrently, those of the same machine one after the other
+		 */
+		void run(const Slice &slice);
+
+	private:
+		// Machines waiting for their next slice
+		struct Queue {
+			std::mutex lock;
+			std::deque<Machine*> machines;
+		};
+
+		/**
+		 * Returns the next machine for thread, nullptr when no queue holds any
+		 */
+		Machine* take(unsigned thread);
+
+		void give(unsigned thread, Machine *machine);
+
+		unsigned threads;
+		std::unique_ptr<Queue[]> queues;
+
+		std::vector<Machine*> machines;
+};
+
+}
+
+#endif
@@ -0,0 +1,149 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <zlib.h>
+
+#include "hyperscan/savestate.h"
+
+using namespace hyperscan;
+
+static constexpr char MAGIC[8] = { 'H', 'S', 'S', 'T', 'A', 'T', 'E', '\x1A' };
+
+// Bumped whenever the layout of anything saved changes, older states are refused
+static constexpr uint32_t VERSION = 5;
+
+// Magic, version, then the sizes of the payload before and after compression
+static constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 4 + 8 + 8;
+
+bool savestate_save(CPU &cpu, const char *path) {
+	memory::StateWriter writer;
+
+	cpu.materializeFlags();
+	for (uint32_t value : cpu.r) {
+		writer.write32(value);
+	}
+	for (uint32_t value : cpu.cr) {
+		writer.write32(value);
+	}
+	for (uint32_t value : cpu.sr) {
+		writer.write32(value);
+	}
+	writer.write64(cpu.CE);
+	writer.write32(cpu.pc);
+	writer.write64(cpu.cycles);
+
+	cpu.miu->save(writer);
+
+	// Speed matters more than size, most of a state is untouched zeros anyway
+	const std::vector<uint8_t> &payload = writer.data();
+	uLongf compressedSize = compressBound(payload.size());
+	std::vector<uint8_t> compressed(compressedSize);
+	if (compress2(compressed.data(), &compressedSize, payload.data(), payload.size(), Z_BEST_SPEED) != Z_OK) {
+		fprintf(stderr, "%s: compression failed\n", path);
+		return false;
+	}
+
+	memory::StateWriter header;
+	header.writeBytes(reinterpret_cast<const uint8_t*>(MAGIC), sizeof(MAGIC));
+	header.write32(VERSION);
+	header.write64(payload.size());
+	header.write64(compressedSize);
+
+	FILE *file = fopen(path, "wb");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+
+	bool written = fwrite(header.data().data(), header.data().size(), 1, file) == 1 &&
+				   fwrite(compressed.data(), compressedSize, 1, file) == 1;
+	if (fclose(file) || !written) {
+		perror(path);
+		return false;
+	}
+
+	return true;
+}
+
+bool savestate_load(CPU &cpu, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+
+	uint8_t bytes[HEADER_SIZE];
+	size_t read = fread(bytes, 1, sizeof(bytes), file);
+
+	memory::StateReader header(bytes, read);
+	char magic[sizeof(MAGIC)];
+	header.readBytes(reinterpret_cast<uint8_t*>(magic), sizeof(magic));
+	uint32_t version = header.read32();
+	uint64_t payloadSize = header.read64();
+	uint64_t compressedSize = header.read64();
+
+	if (!header.ok() || memcmp(magic, MAGIC, sizeof(MAGIC))) {
+		fprintf(stderr, "%s: not a save state\n", path);
+		fclose(file);
+		return false;
+	}
+
+	if (version != VERSION) {
+		fprintf(stderr, "%s: save state version %u, expected %u\n", path, version, VERSION);
+		fclose(file);
+		return false;
+	}
+
+	// Sizes are checked before allocating anything, deflate never shrinks data more than about 1000 times
+	long start = ftell(file);
+	fseek(file, 0, SEEK_END);
+	uint64_t available = ftell(file) - start;
+	fseek(file, start, SEEK_SET);
+
+	if (compressedSize > available || payloadSize > compressedSize * 1032) {
+		fprintf(stderr, "%s: save state is truncated\n", path);
+		fclose(file);
+		return false;
+	}
+
+	std::vector<uint8_t> compressed(compressedSize);
+	bool complete = fread(compressed.data(), 1, compressedSize, file) == compressedSize;
+	fclose(file);
+
+	std::vector<uint8_t> payload(payloadSize);
+	uLongf uncompressedSize = payloadSize;
+	if (!complete || uncompress(payload.data(), &uncompressedSize, compressed.data(), compressedSize) != Z_OK ||
+		uncompressedSize != payloadSize) {
+		fprintf(stderr, "%s: save state is corrupted\n", path);
+		return false;
+	}
+
+	memory::StateReader reader(payload.data(), payload.size());
+	for (uint32_t &value : cpu.r) {
+		value = reader.read32();
+	}
+	for (uint32_t &value : cpu.cr) {
+		value = reader.read32();
+	}
+	for (uint32_t &value : cpu.sr) {
+		value = reader.read32();
+	}
+	cpu.CE = reader.read64();
+	cpu.pc = reader.read32();
+	cpu.cycles = reader.read64();
+
+	// Flags were materialized when saving
+	cpu.lazy.nz = false;
+	cpu.lazy.cv = cpu.lazy.NONE;
+
+	cpu.miu->load(reader);
+	cpu.blocks.clear();
+
+	if (!reader.ok()) {
+		fprintf(stderr, "%s: save state does not match the memory layout\n", path);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,23 @@
+#include "hyperscan/cpu.h"
+
+#ifndef __HYPERSCAN_SAVESTATE_H__
+#define __HYPERSCAN_SAVESTATE_H__
+
+/**
+ * Writes the whole machine to path: CPU registers and every region mapped in the MIU
+ * Regions only save pages that differ from how they started, the result is compressed
+ *
+ * Returns false, with the reason printed, when the state could not be written
+ */
+bool savestate_save(hyperscan::CPU &cpu, const char *path);
+
+/**
+ * Restores a state written by savestate_save() into a machine with the same memory layout
+ * Breakpoints, events and the selected engine are left alone, decoded blocks are dropped
+ *
+ * Returns false, with the reason printed, when path holds no usable state
+ * The machine is only left half restored when the state was saved from a different memory layout
+ */
+bool savestate_load(hyperscan::CPU &cpu, const char *path);
+
+#endif
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+#ifndef __HYPERSCAN_SCHEDULER_H__
+#define __HYPERSCAN_SCHEDULER_H__
+
+namespace hyperscan {
+
+namespace jit {
+class Translator;
+}
+
+/**
+ * Events peripherals want to happen once the CPU reaches a given cycle, kept in a min-heap
+ * Events due on the same cycle fire in the order they were scheduled
+ */
+class Scheduler {
+	// Native code compares the cycle count against due directly
+	friend class jit::Translator;
+
+	public:
+		// Called with the cycle the event was due, which the CPU may have gone past slightly
+		typedef std::function<void(uint64_t deadline)> Callback;
+
+		// Identifies a scheduled event, never reused
+		typedef uint64_t Event;
+
+		// Deadline of nothing
+		static constexpr uint64_t NEVER = std::numeric_limits<uint64_t>::max();
+
+		/**
+		 * Calls callback once the CPU reaches deadline
+		 * Returns what to give to cancel()
+		 */
+		Event schedule(uint64_t deadline, Callback callback) {
+			heap.push_back({ deadline, ++last, std::move(callback) });
+			std::push_heap(heap.begin(), heap.end(), later);
+			due = heap.front().deadline;
+
+			return last;
+		}
+
+		/**
+		 * Drops event if it did not fire yet
+		 */
+		void cancel(Event event) {
+			auto it = std::find_if(heap.begin(), heap.end(), [event](const Entry &entry) {
+				return entry.event == event;
+			});
+
+			if (it != heap.end()) {
+				heap.erase(it);
+				std::make_heap(heap.begin(), heap.end(), later);
+				due = heap.empty() ? NEVER : heap.front().deadline;
+			}
+		}
+
+		/**
+		 * Drops every event
+		 */
+		void clear() {
+			heap.clear();
+			due = NEVER;
+		}
+
+		/**
+		 * Deadline of the earliest event, NEVER when there is none
+		 */
+		[[nodiscard]]
+		uint64_t next() const {
+			return due;
+		}
+
+		/**
+		 * Fires every event due by now, earliest first
+		 * Callbacks may schedule more, those already due fire as well
+		 */
+		void dispatch(uint64_t now) {
+			while (!heap.empty() && heap.front().deadline <= now) {
+				std::pop_heap(heap.begin(), heap.end(), later);
+				Entry entry = std::move(heap.back());
+				heap.pop_back();
+				due = heap.empty() ? NEVER : heap.front().deadline;
+
+				entry.callback(entry.deadline);
+			}
+		}
+
+	private:
+		struct Entry {
+			uint64_t deadline;
+			Event event;
+			Callback callback;
+		};
+
+		// Orders the heap so the earliest deadline, then the first scheduled, is at the front
+		static bool later(const Entry &a, const Entry &b) {
+			return a.deadline != b.deadline ? a.deadline > b.deadline : a.event > b.event;
+		}
+
+		std::vector<Entry> heap;
+		Event last = 0;
+
+		// Deadline of the front of the heap, read every instruction
+		uint64_t due = NEVER;
+};
+
+}
+
+#endif
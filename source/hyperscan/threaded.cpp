@@ -0,0 +1,607 @@
+#include "hyperscan/cpu.h"
+#include "hyperscan/handlers.h"
+
+#if defined(HYPERSCAN_THREADED)
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+
+namespace hyperscan {
+
+typedef BlockCache::Handlers H;
+
+// Where the sub-function of each 32bit OP sits in the encoding, handlers are indexed by OP then sub-function
+// spform func6 for 0x00, iform func3 for 0x01/0x05, rixform func3 for 0x03/0x07, crform CR_OP for 0x06
+static constexpr uint8_t SUB32_SHIFT[32] = { 1, 17, 0, 0, 0, 17, 0, 0 };
+static constexpr uint8_t SUB32_MASK[32]  = { 0x3F, 0x07, 0x00, 0x07, 0x00, 0x07, 0xFF, 0x07 };
+
+// Same for 16bit OPs, rform func4 for 0x00-0x02, iform1 func3 for 0x06/0x07, always at the bottom
+static constexpr uint8_t SUB16_MASK[8]   = { 0x0F, 0x0F, 0x0F, 0x00, 0x00, 0x00, 0x07, 0x07 };
+
+static constexpr unsigned key32(uint8_t OP, uint8_t sub = 0) {
+	return (OP << 8) | sub;
+}
+
+static constexpr unsigned key16(uint8_t OP, uint8_t sub = 0) {
+	return (OP << 4) | sub;
+}
+
+// Fetches the instruction at PC and jumps to its handler
+// Every handler ends with its own copy, so each indirect jump is predicted on its own
+#define DISPATCH() \
+	do { \
+		instruction = fetch(pc); \
+		if (!(pc & 2) && instruction.p0) { \
+			insn32 = (instruction.high << 15) | instruction.low; \
+			width = 4; \
+			goto *table32[key32(insn32.OP, (insn32.encoded >> SUB32_SHIFT[insn32.OP]) & SUB32_MASK[insn32.OP])]; \
+		} \
+		width = (!(pc & 2) && instruction.p1) ? 4 : 2; \
+		insn16 = (width == 4 && !T) ? instruction.high : instruction.low; \
+		goto *table16[key16(insn16.OP, insn16.encoded & SUB16_MASK[insn16.OP])]; \
+	} while (0)
+
+// Advances PC and retires the instruction, then stops or runs the next one
+#define NEXT(advance) \
+	do { \
+		pc += (advance); \
+		++cycles; \
+		if (++executed == count || cycles >= events.next() || (stops && breakpoints.contains(pc))) { \
+			return executed; \
+		} \
+		DISPATCH(); \
+	} while (0)
+
+// 16bit control flow links and falls through according to the width being run, parallel pairs take a word
+#define JUMP16(...) (width == 4 ? jump<32>(__VA_ARGS__) : jump<16>(__VA_ARGS__))
+#define BRANCH16(...) (width == 4 ? branch<32>(__VA_ARGS__) : branch<16>(__VA_ARGS__))
+
+// Memory accesses through the rixform pre/post-increment and mform offset encodings
+#define PRE(label, A) \
+	label: \
+		r[insn32.rixform.rA] += sign_extend(insn32.rixform.Imm12, 12); \
+		H::access<H::A>(*this, r[insn32.rixform.rA], r[insn32.rixform.rD]); \
+		NEXT(4);
+
+#define POST(label, A) \
+	label: \
+		H::access<H::A>(*this, r[insn32.rixform.rA], r[insn32.rixform.rD]); \
+		r[insn32.rixform.rA] += sign_extend(insn32.rixform.Imm12, 12); \
+		NEXT(4);
+
+#define OFFSET(label, A) \
+	label: \
+		H::access<H::A>(*this, r[insn32.mform.rA] + sign_extend(insn32.mform.Imm15, 15), r[insn32.mform.rD]); \
+		NEXT(4);
+
+uint32_t CPU::threaded(uint32_t count) {
+	static void *table32[32 << 8];
+	static void *table16[8 << 4];
+
+	// Labels only have addresses in here, the first machine to get here builds the tables for every thread
+	static std::atomic<bool> built = false;
+	static std::mutex building;
+
+	if (!built.load(std::memory_order_acquire)) [[unlikely]] {
+		std::lock_guard<std::mutex> guard(building);
+		if (!built.load(std::memory_order_relaxed)) {
+			std::fill(std::begin(table32), std::end(table32), &&illegal);
+			std::fill(std::begin(table16), std::end(table16), &&illegal);
+
+			table32[key32(0x00, 0x00)] = &&nop32;
+			table32[key32(0x00, 0x04)] = &&br32;
+			table32[key32(0x00, 0x08)] = &&add32;
+			table32[key32(0x00, 0x09)] = &&addc32;
+			table32[key32(0x00, 0x0A)] = &&sub32;
+			table32[key32(0x00, 0x0B)] = &&subc32;
+			table32[key32(0x00, 0x0C)] = &&cmp32;
+			table32[key32(0x00, 0x0D)] = &&cmpz32;
+			table32[key32(0x00, 0x0F)] = &&neg32;
+			table32[key32(0x00, 0x10)] = &&and32;
+			table32[key32(0x00, 0x11)] = &&or32;
+			table32[key32(0x00, 0x12)] = &&not32;
+			table32[key32(0x00, 0x13)] = &&xor32;
+			table32[key32(0x00, 0x14)] = &&bitclr32;
+			table32[key32(0x00, 0x15)] = &&bitset32;
+			table32[key32(0x00, 0x16)] = &&bittst32;
+			table32[key32(0x00, 0x17)] = &&bittgl32;
+			table32[key32(0x00, 0x18)] = &&sll32;
+			table32[key32(0x00, 0x1A)] = &&srl32;
+			table32[key32(0x00, 0x1B)] = &&sra32;
+			table32[key32(0x00, 0x20)] = &&mul32;
+			table32[key32(0x00, 0x21)] = &&mulu32;
+			table32[key32(0x00, 0x22)] = &&div32;
+			table32[key32(0x00, 0x23)] = &&divu32;
+			table32[key32(0x00, 0x24)] = &&mfce32;
+			table32[key32(0x00, 0x25)] = &&mtce32;
+			table32[key32(0x00, 0x28)] = &&mfsr32;
+			table32[key32(0x00, 0x29)] = &&mtsr32;
+			table32[key32(0x00, 0x2A)] = &&tcond32;
+			table32[key32(0x00, 0x2B)] = &&mvcond32;
+			table32[key32(0x00, 0x2C)] = &&extsb32;
+			table32[key32(0x00, 0x2D)] = &&extsh32;
+			table32[key32(0x00, 0x2E)] = &&extzb32;
+			table32[key32(0x00, 0x2F)] = &&extzh32;
+			table32[key32(0x00, 0x38)] = &&slli32;
+			table32[key32(0x00, 0x3A)] = &&srli32;
+			table32[key32(0x00, 0x3B)] = &&srai32;
+
+			table32[key32(0x01, 0x00)] = &&addi32;
+			table32[key32(0x01, 0x02)] = &&cmpi32;
+			table32[key32(0x01, 0x04)] = &&andi32;
+			table32[key32(0x01, 0x05)] = &&ori32;
+			table32[key32(0x01, 0x06)] = &&ldi32;
+
+			table32[key32(0x02)] = &&j32;
+
+			table32[key32(0x03, 0x00)] = &&pre_lw;
+			table32[key32(0x03, 0x01)] = &&pre_lh;
+			table32[key32(0x03, 0x02)] = &&pre_lhu;
+			table32[key32(0x03, 0x03)] = &&pre_lb;
+			table32[key32(0x03, 0x04)] = &&pre_sw;
+			table32[key32(0x03, 0x05)] = &&pre_sh;
+			table32[key32(0x03, 0x06)] = &&pre_lbu;
+			table32[key32(0x03, 0x07)] = &&pre_sb;
+
+			table32[key32(0x04)] = &&b32;
+
+			table32[key32(0x05, 0x00)] = &&addis32;
+			table32[key32(0x05, 0x02)] = &&cmpis32;
+			table32[key32(0x05, 0x04)] = &&andis32;
+			table32[key32(0x05, 0x05)] = &&oris32;
+			table32[key32(0x05, 0x06)] = &&ldis32;
+
+			table32[key32(0x06, 0x00)] = &&mtcr32;
+			table32[key32(0x06, 0x01)] = &&mfcr32;
+			table32[key32(0x06, 0x84)] = &&rte32;
+
+			table32[key32(0x07, 0x00)] = &&post_lw;
+			table32[key32(0x07, 0x01)] = &&post_lh;
+			table32[key32(0x07, 0x02)] = &&post_lhu;
+			table32[key32(0x07, 0x03)] = &&post_lb;
+			table32[key32(0x07, 0x04)] = &&post_sw;
+			table32[key32(0x07, 0x05)] = &&post_sh;
+			table32[key32(0x07, 0x06)] = &&post_lbu;
+			table32[key32(0x07, 0x07)] = &&post_sb;
+
+			table32[key32(0x08)] = &&addri32;
+			table32[key32(0x0C)] = &&andri32;
+			table32[key32(0x0D)] = &&orri32;
+
+			table32[key32(0x10)] = &&offset_lw;
+			table32[key32(0x11)] = &&offset_lh;
+			table32[key32(0x12)] = &&offset_lhu;
+			table32[key32(0x13)] = &&offset_lb;
+			table32[key32(0x14)] = &&offset_sw;
+			table32[key32(0x15)] = &&offset_sh;
+			table32[key32(0x16)] = &&offset_lbu;
+			table32[key32(0x17)] = &&offset_sb;
+
+			table32[key32(0x18)] = &&nop32;
+
+			table16[key16(0x00, 0x00)] = &&nop16;
+			table16[key16(0x00, 0x01)] = &&mlfh16;
+			table16[key16(0x00, 0x02)] = &&mhfl16;
+			table16[key16(0x00, 0x03)] = &&mv16;
+			table16[key16(0x00, 0x04)] = &&br16;
+			table16[key16(0x00, 0x05)] = &&tcond16;
+			table16[key16(0x00, 0x0C)] = &&brl16;
+
+			table16[key16(0x01, 0x00)] = &&mtce16;
+			table16[key16(0x01, 0x01)] = &&mfce16;
+
+			table16[key16(0x02, 0x00)] = &&add16;
+			table16[key16(0x02, 0x01)] = &&sub16;
+			table16[key16(0x02, 0x02)] = &&neg16;
+			table16[key16(0x02, 0x03)] = &&cmp16;
+			table16[key16(0x02, 0x04)] = &&and16;
+			table16[key16(0x02, 0x05)] = &&or16;
+			table16[key16(0x02, 0x06)] = &&not16;
+			table16[key16(0x02, 0x07)] = &&xor16;
+			table16[key16(0x02, 0x08)] = &&lw16;
+			table16[key16(0x02, 0x09)] = &&lh16;
+			table16[key16(0x02, 0x0A)] = &&pop16;
+			table16[key16(0x02, 0x0B)] = &&lbu16;
+			table16[key16(0x02, 0x0C)] = &&sw16;
+			table16[key16(0x02, 0x0D)] = &&sh16;
+			table16[key16(0x02, 0x0E)] = &&push16;
+			table16[key16(0x02, 0x0F)] = &&sb16;
+
+			table16[key16(0x03)] = &&j16;
+			table16[key16(0x04)] = &&b16;
+			table16[key16(0x05)] = &&ldiu16;
+
+			table16[key16(0x06, 0x03)] = &&srli16;
+			table16[key16(0x06, 0x04)] = &&bitclr16;
+			table16[key16(0x06, 0x05)] = &&bitset16;
+			table16[key16(0x06, 0x06)] = &&bittst16;
+
+			table16[key16(0x07, 0x00)] = &&lwp16;
+			table16[key16(0x07, 0x01)] = &&lhp16;
+			table16[key16(0x07, 0x03)] = &&lbup16;
+			table16[key16(0x07, 0x04)] = &&swp16;
+			table16[key16(0x07, 0x05)] = &&shp16;
+			table16[key16(0x07, 0x07)] = &&sbp16;
+
+			built.store(true, std::memory_order_release);
+		}
+	}
+
+	if (!count) {
+		return 0;
+	}
+
+	// Breakpoints can only change from outside run()
+	const bool stops = !breakpoints.empty();
+
+	uint32_t executed = 0;
+	uint32_t width = 0;
+	InstructionDecoder instruction = 0;
+	Instruction32 insn32 = 0;
+	Instruction16 insn16 = 0;
+
+	DISPATCH();
+
+illegal:
+	debugDump();
+	NEXT(width);
+
+	// 32bit, OP 0x00
+nop32:
+	NEXT(4);
+br32:
+	NEXT(branch<32>(insn32.spform.rB, r[insn32.spform.rA], insn32.spform.CU));
+add32:
+	r[insn32.spform.rD] = add(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+addc32:
+	r[insn32.spform.rD] = addc(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+sub32:
+	r[insn32.spform.rD] = sub(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+subc32:
+	r[insn32.spform.rD] = subc(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+cmp32:
+	cmp(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.rD & 0x03, insn32.spform.CU);
+	NEXT(4);
+cmpz32:
+	cmp(r[insn32.spform.rA], 0, insn32.spform.rD & 0x03, insn32.spform.CU);
+	NEXT(4);
+neg32:
+	r[insn32.spform.rD] = sub(0, r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+and32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU, std::bit_and());
+	NEXT(4);
+or32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU, std::bit_or());
+	NEXT(4);
+not32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], ~0, insn32.spform.CU, std::bit_xor());
+	NEXT(4);
+xor32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU, std::bit_xor());
+	NEXT(4);
+bitclr32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], ~(1 << insn32.spform.rB), insn32.spform.CU, std::bit_and());
+	NEXT(4);
+bitset32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], 1 << insn32.spform.rB, insn32.spform.CU, std::bit_or());
+	NEXT(4);
+bittst32:
+	bit_op(r[insn32.spform.rA], 1 << insn32.spform.rB, insn32.spform.CU, std::bit_and());
+	NEXT(4);
+bittgl32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], 1 << insn32.spform.rB, insn32.spform.CU, std::bit_xor());
+	NEXT(4);
+sll32:
+	r[insn32.spform.rD] = sll(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+srl32:
+	r[insn32.spform.rD] = srl(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+sra32:
+	r[insn32.spform.rD] = sra(r[insn32.spform.rA], r[insn32.spform.rB], insn32.spform.CU);
+	NEXT(4);
+mul32:
+	CE = std::multiplies<int64_t>()(r[insn32.spform.rA], r[insn32.spform.rB]);
+	cycles += MUL_STALL;
+	NEXT(4);
+mulu32:
+	CE = std::multiplies<uint64_t>()(r[insn32.spform.rA], r[insn32.spform.rB]);
+	cycles += MUL_STALL;
+	NEXT(4);
+div32:
+	CEL = std::divides<int64_t>()(r[insn32.spform.rA], r[insn32.spform.rB]);
+	CEH = std::modulus<int64_t>()(r[insn32.spform.rA], r[insn32.spform.rB]);
+	cycles += DIV_STALL;
+	NEXT(4);
+divu32:
+	CEL = std::divides<uint64_t>()(r[insn32.spform.rA], r[insn32.spform.rB]);
+	CEH = std::modulus<uint64_t>()(r[insn32.spform.rA], r[insn32.spform.rB]);
+	cycles += DIV_STALL;
+	NEXT(4);
+mfce32:
+	switch(insn32.spform.rB) {
+		case 0x01: r[insn32.spform.rD] = CEL; break;
+		case 0x02: r[insn32.spform.rD] = CEH; break;
+		case 0x03: r[insn32.spform.rD] = CEH; r[insn32.spform.rA] = CEL; break;
+	}
+	NEXT(4);
+mtce32:
+	switch(insn32.spform.rB) {
+		case 0x01: CEL = r[insn32.spform.rD]; break;
+		case 0x02: CEH = r[insn32.spform.rD]; break;
+		case 0x03: CEH = r[insn32.spform.rD]; CEL = r[insn32.spform.rA]; break;
+	}
+	NEXT(4);
+mfsr32:
+	r[insn32.spform.rD] = sr[insn32.spform.rB];
+	NEXT(4);
+mtsr32:
+	sr[insn32.spform.rB] = r[insn32.spform.rA];
+	NEXT(4);
+tcond32:
+	T = conditional(insn32.spform.rB);
+	NEXT(4);
+mvcond32:
+	if (conditional(insn32.spform.rB)) {
+		r[insn32.spform.rD] = r[insn32.spform.rA];
+	}
+	NEXT(4);
+extsb32:
+	r[insn32.spform.rD] = sign_extend(r[insn32.spform.rA], 8);
+	if (insn32.spform.CU) {
+		basic_flags(r[insn32.spform.rD]);
+	}
+	NEXT(4);
+extsh32:
+	r[insn32.spform.rD] = sign_extend(r[insn32.spform.rA], 16);
+	if (insn32.spform.CU) {
+		basic_flags(r[insn32.spform.rD]);
+	}
+	NEXT(4);
+extzb32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], 0x000000FF, insn32.spform.CU, std::bit_and());
+	NEXT(4);
+extzh32:
+	r[insn32.spform.rD] = bit_op(r[insn32.spform.rA], 0x0000FFFF, insn32.spform.CU, std::bit_and());
+	NEXT(4);
+slli32:
+	r[insn32.spform.rD] = sll(r[insn32.spform.rA], insn32.spform.rB, insn32.spform.CU);
+	NEXT(4);
+srli32:
+	r[insn32.spform.rD] = srl(r[insn32.spform.rA], insn32.spform.rB, insn32.spform.CU);
+	NEXT(4);
+srai32:
+	r[insn32.spform.rD] = sra(r[insn32.spform.rA], insn32.spform.rB, insn32.spform.CU);
+	NEXT(4);
+
+	// 32bit, OP 0x01 and 0x05
+addi32:
+	r[insn32.iform.rD] = add(r[insn32.iform.rD], sign_extend(insn32.iform.Imm16, 16), insn32.iform.CU);
+	NEXT(4);
+cmpi32:
+	cmp(r[insn32.iform.rD], sign_extend(insn32.iform.Imm16, 16), 3, insn32.iform.CU);
+	NEXT(4);
+andi32:
+	r[insn32.iform.rD] = bit_op(r[insn32.iform.rD], insn32.iform.Imm16, insn32.iform.CU, std::bit_and());
+	NEXT(4);
+ori32:
+	r[insn32.iform.rD] = bit_op(r[insn32.iform.rD], insn32.iform.Imm16, insn32.iform.CU, std::bit_or());
+	NEXT(4);
+ldi32:
+	r[insn32.iform.rD] = sign_extend(insn32.iform.Imm16, 16);
+	NEXT(4);
+addis32:
+	r[insn32.iform.rD] = add(r[insn32.iform.rD], insn32.iform.Imm16 << 16, insn32.iform.CU);
+	NEXT(4);
+cmpis32:
+	cmp(r[insn32.iform.rD], insn32.iform.Imm16 << 16, 3, insn32.iform.CU);
+	NEXT(4);
+andis32:
+	r[insn32.iform.rD] = bit_op(r[insn32.iform.rD], insn32.iform.Imm16 << 16, insn32.iform.CU, std::bit_and());
+	NEXT(4);
+oris32:
+	r[insn32.iform.rD] = bit_op(r[insn32.iform.rD], insn32.iform.Imm16 << 16, insn32.iform.CU, std::bit_or());
+	NEXT(4);
+ldis32:
+	r[insn32.iform.rD] = insn32.iform.Imm16 << 16;
+	NEXT(4);
+
+	// 32bit control flow
+j32:
+	NEXT(jump<32>((pc & 0xFE000000) | (insn32.jform.Disp24 << 1), insn32.jform.LK));
+b32:
+	NEXT(branch<32>(insn32.bcform.BC, pc + sign_extend(((insn32.bcform.Disp18_9 << 9) | insn32.bcform.Disp8_0) << 1, 20), insn32.bcform.LK));
+
+	// 32bit, OP 0x06
+mtcr32:
+	materializeFlags();
+	cr[insn32.crform.crA] = r[insn32.crform.rD];
+	NEXT(4);
+mfcr32:
+	materializeFlags();
+	r[insn32.crform.rD] = cr[insn32.crform.crA];
+	NEXT(4);
+rte32:
+	returnFromException();
+	NEXT(jump<32>(cr5, false));
+
+	// 32bit, OP 0x08, 0x0C and 0x0D
+addri32:
+	r[insn32.riform.rD] = add(r[insn32.riform.rA], sign_extend(insn32.riform.Imm14, 14), insn32.riform.CU);
+	NEXT(4);
+andri32:
+	r[insn32.riform.rD] = bit_op(r[insn32.riform.rA], insn32.riform.Imm14, insn32.riform.CU, std::bit_and());
+	NEXT(4);
+orri32:
+	r[insn32.riform.rD] = bit_op(r[insn32.riform.rA], insn32.riform.Imm14, insn32.riform.CU, std::bit_or());
+	NEXT(4);
+
+	// 32bit memory accesses
+	PRE(pre_lw, LW)
+	PRE(pre_lh, LH)
+	PRE(pre_lhu, LHU)
+	PRE(pre_lb, LB)
+	PRE(pre_sw, SW)
+	PRE(pre_sh, SH)
+	PRE(pre_lbu, LBU)
+	PRE(pre_sb, SB)
+
+	POST(post_lw, LW)
+	POST(post_lh, LH)
+	POST(post_lhu, LHU)
+	POST(post_lb, LB)
+	POST(post_sw, SW)
+	POST(post_sh, SH)
+	POST(post_lbu, LBU)
+	POST(post_sb, SB)
+
+	OFFSET(offset_lw, LW)
+	OFFSET(offset_lh, LH)
+	OFFSET(offset_lhu, LHU)
+	OFFSET(offset_lb, LB)
+	OFFSET(offset_sw, SW)
+	OFFSET(offset_sh, SH)
+	OFFSET(offset_lbu, LBU)
+	OFFSET(offset_sb, SB)
+
+	// 16bit, OP 0x00 and 0x01
+nop16:
+	NEXT(width);
+mlfh16:
+	g0[insn16.rform.rD] = g1[insn16.rform.rA];
+	NEXT(width);
+mhfl16:
+	g1[insn16.rform.rD] = g0[insn16.rform.rA];
+	NEXT(width);
+mv16:
+	g0[insn16.rform.rD] = g0[insn16.rform.rA];
+	NEXT(width);
+br16:
+	NEXT(BRANCH16(insn16.rform.rD, g0[insn16.rform.rA], false));
+tcond16:
+	T = conditional(insn16.rform.rD);
+	NEXT(width);
+brl16:
+	NEXT(BRANCH16(insn16.rform.rD, g0[insn16.rform.rA], true));
+mtce16:
+	switch(insn16.rform.rD) {
+		case 0x00: CEL = g0[insn16.rform.rA]; break;
+		case 0x01: CEH = g0[insn16.rform.rA]; break;
+	}
+	NEXT(width);
+mfce16:
+	switch(insn16.rform.rD) {
+		case 0x00: g0[insn16.rform.rA] = CEL; break;
+		case 0x01: g0[insn16.rform.rA] = CEH; break;
+	}
+	NEXT(width);
+
+	// 16bit, OP 0x02
+add16:
+	g0[insn16.rform.rD] = add(g0[insn16.rform.rD], g0[insn16.rform.rA], true);
+	NEXT(width);
+sub16:
+	g0[insn16.rform.rD] = sub(g0[insn16.rform.rD], g0[insn16.rform.rA], true);
+	NEXT(width);
+neg16:
+	g0[insn16.rform.rD] = sub(0, g0[insn16.rform.rA], true);
+	NEXT(width);
+cmp16:
+	sub(g0[insn16.rform.rD], g0[insn16.rform.rA], true);
+	NEXT(width);
+and16:
+	g0[insn16.rform.rD] = bit_op(g0[insn16.rform.rD], g0[insn16.rform.rA], true, std::bit_and());
+	NEXT(width);
+or16:
+	g0[insn16.rform.rD] = bit_op(g0[insn16.rform.rD], g0[insn16.rform.rA], true, std::bit_or());
+	NEXT(width);
+not16:
+	g0[insn16.rform.rD] = bit_op(g0[insn16.rform.rA], ~0, true, std::bit_xor());
+	NEXT(width);
+xor16:
+	g0[insn16.rform.rD] = bit_op(g0[insn16.rform.rD], g0[insn16.rform.rA], true, std::bit_xor());
+	NEXT(width);
+lw16:
+	H::access<H::LW>(*this, g0[insn16.rform.rA], g0[insn16.rform.rD]);
+	NEXT(width);
+lh16:
+	H::access<H::LH>(*this, g0[insn16.rform.rA], g0[insn16.rform.rD]);
+	NEXT(width);
+pop16:
+	g[insn16.rhform.H][insn16.rhform.rD] = miu->readU32(g0[insn16.rhform.rA]);
+	g0[insn16.rhform.rA] += 4;
+	NEXT(width);
+lbu16:
+	H::access<H::LBU>(*this, g0[insn16.rform.rA], g0[insn16.rform.rD]);
+	NEXT(width);
+sw16:
+	H::access<H::SW>(*this, g0[insn16.rform.rA], g0[insn16.rform.rD]);
+	NEXT(width);
+sh16:
+	H::access<H::SH>(*this, g0[insn16.rform.rA], g0[insn16.rform.rD]);
+	NEXT(width);
+push16:
+	// Stores rDgh as it was before rAg0 is decremented
+	{
+		uint32_t value = g[insn16.rhform.H][insn16.rhform.rD];
+		miu->writeU32(g0[insn16.rhform.rA] -= 4, value);
+	}
+	NEXT(width);
+sb16:
+	H::access<H::SB>(*this, g0[insn16.rform.rA], g0[insn16.rform.rD]);
+	NEXT(width);
+
+	// 16bit, OP 0x03 to 0x05
+j16:
+	NEXT(JUMP16((pc & 0xFFFFF000) | (insn16.jform.Disp11 << 1), insn16.jform.LK));
+b16:
+	NEXT(BRANCH16(insn16.bxform.EC, pc + (sign_extend(insn16.bxform.Imm8, 8) << 1), false));
+ldiu16:
+	g0[insn16.iform2.rD] = insn16.iform2.Imm8;
+	NEXT(width);
+
+	// 16bit, OP 0x06
+srli16:
+	g0[insn16.iform1.rD] = srl(g0[insn16.iform1.rD], insn16.iform1.Imm5, true);
+	NEXT(width);
+bitclr16:
+	g0[insn16.iform1.rD] = bit_op(g0[insn16.iform1.rD], ~(1 << insn16.iform1.Imm5), true, std::bit_and());
+	NEXT(width);
+bitset16:
+	g0[insn16.iform1.rD] = bit_op(g0[insn16.iform1.rD], 1 << insn16.iform1.Imm5, true, std::bit_or());
+	NEXT(width);
+bittst16:
+	bit_op(g0[insn16.iform1.rD], 1 << insn16.iform1.Imm5, true, std::bit_and());
+	NEXT(width);
+
+	// 16bit, OP 0x07
+lwp16:
+	g0[insn16.iform1.rD] = miu->readU32(r2 + (insn16.iform1.Imm5 << 2));
+	NEXT(width);
+lhp16:
+	g0[insn16.iform1.rD] = miu->readU16(r2 + (insn16.iform1.Imm5 << 1));
+	NEXT(width);
+lbup16:
+	g0[insn16.iform1.rD] = miu->readU8(r2 + insn16.iform1.Imm5);
+	NEXT(width);
+swp16:
+	miu->writeU32(r2 + (insn16.iform1.Imm5 << 2), g0[insn16.iform1.rD]);
+	NEXT(width);
+shp16:
+	miu->writeU16(r2 + (insn16.iform1.Imm5 << 1), g0[insn16.iform1.rD]);
+	NEXT(width);
+sbp16:
+	miu->writeU8(r2 + insn16.iform1.Imm5, g0[insn16.iform1.rD]);
+	NEXT(width);
+}
+
+}
+
+#endif
@@ -0,0 +1,422 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "hyperscan/memory/endian.h"
+#include "hyperscan/tracer.h"
+
+namespace hyperscan {
+
+// Chunk header: size of the rest, then record count
+static constexpr size_t CHUNK_HEADER_SIZE = 8;
+
+// Worst case of a record without its writes: flags, PC, word, then every r, cr, sr and CE changed
+static constexpr size_t MAX_RECORD = 1 + 5 + 4 + (5 + 32 * 5) * 2 + (1 + 3 * 5 + 10);
+
+// Worst case of a single write: address delta and value
+static constexpr size_t MAX_WRITE = 5 + 5;
+
+static uint8_t* put_varint(uint8_t *out, uint64_t value) {
+	while (value >= 0x80) {
+		*out++ = value | 0x80;
+		value >>= 7;
+	}
+
+	*out++ = value;
+	return out;
+}
+
+// Maps small negative deltas to small varints
+static uint32_t zigzag(uint32_t delta) {
+	return (delta << 1) ^ uint32_t(int32_t(delta) >> 31);
+}
+
+static uint64_t zigzag64(uint64_t delta) {
+	return (delta << 1) ^ uint64_t(int64_t(delta) >> 63);
+}
+
+static uint32_t unzigzag(uint64_t value) {
+	return uint32_t(value >> 1) ^ -uint32_t(value & 1);
+}
+
+static uint64_t unzigzag64(uint64_t value) {
+	return (value >> 1) ^ -(value & 1);
+}
+
+/**
+ * Returns a mask of the registers in now that differ from before, for a file of 32
+ * Groups are compared as a whole first, most instructions change one register or none
+ */
+static uint32_t differences(const uint32_t *now, const uint32_t *before) {
+	static constexpr unsigned GROUP = 8;
+
+	uint32_t changed = 0;
+	for (unsigned group = 0; group < 32; group += GROUP) {
+		if (!std::memcmp(now + group, before + group, GROUP * sizeof(uint32_t))) {
+			continue;
+		}
+
+		for (unsigned i = group; i < group + GROUP; ++i) {
+			changed |= uint32_t(now[i] != before[i]) << i;
+		}
+	}
+
+	return changed;
+}
+
+/**
+ * Takes what the trace follows from cpu, flags have to be materialized
+ */
+static TraceState capture(const CPU &cpu) {
+	TraceState state;
+	state.pc = cpu.pc;
+	std::copy(cpu.r, cpu.r + 32, state.r);
+	std::copy(cpu.cr, cpu.cr + 32, state.cr);
+	std::copy(cpu.sr, cpu.sr + 3, state.sr);
+	state.CE = cpu.CE;
+
+	return state;
+}
+
+Tracer::Tracer(const char *path, size_t ring):
+	path(path), ring(ring), kept(0), chunk(CHUNK_HEADER_SIZE + sizeof(TraceState)), used(0), records(0),
+	started(false), lastPC(0), lastWrite(0) {
+	file = fopen(path, "wb");
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+
+	uint8_t header[sizeof(MAGIC) + 4];
+	std::memcpy(header, MAGIC, sizeof(MAGIC));
+	memory::store32(header + sizeof(MAGIC), VERSION);
+	fwrite(header, 1, sizeof(header), file);
+}
+
+Tracer::~Tracer() {
+	finish();
+
+	for (const auto &kept : chunks) {
+		fwrite(kept.data(), 1, kept.size(), file);
+	}
+
+	if (fclose(file)) {
+		perror(path.c_str());
+	}
+}
+
+void Tracer::resume(const CPU &cpu) {
+	TraceState state = capture(cpu);
+	if (!started || state != last) {
+		restart(state);
+	}
+}
+
+void Tracer::record(const CPU &cpu, uint32_t pc, uint32_t word) {
+	if (records == CHUNK_RECORDS) [[unlikely]] {
+		restart(last);
+	}
+
+	uint8_t *out = reserve(MAX_RECORD + writes.size() * MAX_WRITE);
+	uint8_t *start = out;
+	uint8_t flags = 0;
+	++out;
+
+	out = put_varint(out, zigzag(pc - lastPC));
+	lastPC = pc;
+
+	WordCache &cached = words[(pc >> 1) % WORD_CACHE_SIZE];
+	if (cached.pc == pc && cached.word == word) {
+		flags |= RECORD_WORD_SEEN;
+	} else {
+		memory::store32(out, word);
+		out += 4;
+		cached = { pc, word };
+	}
+
+	uint32_t changed = differences(cpu.r, last.r);
+	if (changed) {
+		flags |= RECORD_R;
+		out = put_varint(out, changed);
+		for (uint32_t mask = changed; mask; mask &= mask - 1) {
+			unsigned i = __builtin_ctz(mask);
+			out = put_varint(out, zigzag(cpu.r[i] - last.r[i]));
+			last.r[i] = cpu.r[i];
+		}
+	}
+
+	changed = differences(cpu.cr, last.cr);
+	if (changed) {
+		flags |= RECORD_CR;
+		out = put_varint(out, changed);
+		for (uint32_t mask = changed; mask; mask &= mask - 1) {
+			unsigned i = __builtin_ctz(mask);
+			out = put_varint(out, zigzag(cpu.cr[i] - last.cr[i]));
+			last.cr[i] = cpu.cr[i];
+		}
+	}
+
+	changed = (cpu.sr[0] != last.sr[0]) | (cpu.sr[1] != last.sr[1]) << 1 | (cpu.sr[2] != last.sr[2]) << 2 | (cpu.CE != last.CE) << 3;
+	if (changed) {
+		flags |= RECORD_SR;
+		*out++ = changed;
+		for (unsigned i = 0; i < 3; ++i) {
+			if (changed & (1 << i)) {
+				out = put_varint(out, zigzag(cpu.sr[i] - last.sr[i]));
+				last.sr[i] = cpu.sr[i];
+			}
+		}
+
+		if (changed & (1 << 3)) {
+			out = put_varint(out, zigzag64(cpu.CE - last.CE));
+			last.CE = cpu.CE;
+		}
+	}
+
+	if (!writes.empty()) {
+		flags |= RECORD_WRITES;
+		out = put_varint(out, writes.size());
+		for (const Write &write : writes) {
+			out = put_varint(out, zigzag(write.address - lastWrite));
+			out = put_varint(out, write.value);
+			lastWrite = write.address;
+		}
+
+		writes.clear();
+	}
+
+	*start = flags;
+	used = out - chunk.data();
+	last.pc = cpu.pc;
+	++records;
+}
+
+void Tracer::restart(const TraceState &state) {
+	finish();
+
+	used = CHUNK_HEADER_SIZE;
+	uint8_t *out = reserve(sizeof(TraceState));
+	memory::store32(out, state.pc);
+	out += 4;
+	for (uint32_t value : state.r) {
+		memory::store32(out, value);
+		out += 4;
+	}
+	for (uint32_t value : state.cr) {
+		memory::store32(out, value);
+		out += 4;
+	}
+	for (uint32_t value : state.sr) {
+		memory::store32(out, value);
+		out += 4;
+	}
+	memory::store32(out, state.CE);
+	memory::store32(out + 4, state.CE >> 32);
+	used = out + 8 - chunk.data();
+
+	records = 0;
+	last = state;
+	started = true;
+	lastPC = state.pc;
+	lastWrite = 0;
+	words.fill(NO_WORD);
+}
+
+void Tracer::finish() {
+	if (!records) {
+		return;
+	}
+
+	memory::store32(chunk.data(), used - CHUNK_HEADER_SIZE);
+	memory::store32(chunk.data() + 4, records);
+	records = 0;
+
+	if (!ring) {
+		fwrite(chunk.data(), 1, used, file);
+		return;
+	}
+
+	// Oldest chunks go first, the one just closed always stays
+	chunks.emplace_back(chunk.begin(), chunk.begin() + used);
+	kept += used;
+	while (kept > ring && chunks.size() > 1) {
+		kept -= chunks.front().size();
+		chunks.pop_front();
+	}
+}
+
+uint8_t* Tracer::reserve(size_t size) {
+	if (used + size > chunk.size()) [[unlikely]] {
+		chunk.resize(std::max(chunk.size() * 2, used + size));
+	}
+
+	return chunk.data() + used;
+}
+
+TraceReader::TraceReader(const char *path):
+	path(path), position(0), remaining(0), truncated(false), keyframe(false), lastWrite(0) {
+	file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		exit(1);
+	}
+
+	uint8_t header[sizeof(Tracer::MAGIC) + 4];
+	if (fread(header, 1, sizeof(header), file) != sizeof(header) || std::memcmp(header, Tracer::MAGIC, sizeof(Tracer::MAGIC))) {
+		fprintf(stderr, "%s: not a trace\n", path);
+		exit(1);
+	}
+
+	uint32_t version = memory::load32(header + sizeof(Tracer::MAGIC));
+	if (version != Tracer::VERSION) {
+		fprintf(stderr, "%s: trace version %u, expected %u\n", path, version, Tracer::VERSION);
+		exit(1);
+	}
+}
+
+TraceReader::~TraceReader() {
+	fclose(file);
+}
+
+bool TraceReader::next(Record &record) {
+	while (!remaining) {
+		if (!nextChunk()) {
+			return false;
+		}
+	}
+
+	uint8_t flags = read8();
+	record.pc = state.pc + unzigzag(readVarint());
+	state.pc = record.pc;
+	record.before = state;
+
+	Tracer::WordCache &cached = words[(record.pc >> 1) % Tracer::WORD_CACHE_SIZE];
+	if (flags & Tracer::RECORD_WORD_SEEN) {
+		record.word = cached.word;
+	} else {
+		record.word = read32();
+		cached = { record.pc, record.word };
+	}
+
+	record.changedR = (flags & Tracer::RECORD_R) ? readVarint() : 0;
+	for (uint32_t mask = record.changedR; mask; mask &= mask - 1) {
+		state.r[__builtin_ctz(mask)] += unzigzag(readVarint());
+	}
+
+	record.changedCR = (flags & Tracer::RECORD_CR) ? readVarint() : 0;
+	for (uint32_t mask = record.changedCR; mask; mask &= mask - 1) {
+		state.cr[__builtin_ctz(mask)] += unzigzag(readVarint());
+	}
+
+	record.changedSR = (flags & Tracer::RECORD_SR) ? read8() : 0;
+	for (unsigned i = 0; i < 3; ++i) {
+		if (record.changedSR & (1 << i)) {
+			state.sr[i] += unzigzag(readVarint());
+		}
+	}
+	if (record.changedSR & (1 << 3)) {
+		state.CE += unzigzag64(readVarint());
+	}
+
+	record.writes.clear();
+	uint64_t count = (flags & Tracer::RECORD_WRITES) ? readVarint() : 0;
+	for (; count && !truncated; --count) {
+		lastWrite += unzigzag(readVarint());
+		record.writes.push_back({ lastWrite, uint32_t(readVarint()) });
+	}
+
+	if (truncated) {
+		fprintf(stderr, "%s: chunk cut short\n", path.c_str());
+		return false;
+	}
+
+	record.keyframe = keyframe;
+	record.state = state;
+	keyframe = false;
+	--remaining;
+
+	return true;
+}
+
+bool TraceReader::nextChunk() {
+	uint8_t header[CHUNK_HEADER_SIZE];
+	size_t size = fread(header, 1, sizeof(header), file);
+	if (size != sizeof(header)) {
+		if (size) {
+			fprintf(stderr, "%s: trace cut short\n", path.c_str());
+		}
+
+		return false;
+	}
+
+	chunk.resize(memory::load32(header));
+	if (fread(chunk.data(), 1, chunk.size(), file) != chunk.size()) {
+		fprintf(stderr, "%s: trace cut short\n", path.c_str());
+		return false;
+	}
+
+	position = 0;
+	remaining = memory::load32(header + 4);
+
+	state.pc = read32();
+	for (uint32_t &value : state.r) {
+		value = read32();
+	}
+	for (uint32_t &value : state.cr) {
+		value = read32();
+	}
+	for (uint32_t &value : state.sr) {
+		value = read32();
+	}
+	state.CE = read64();
+
+	if (truncated) {
+		fprintf(stderr, "%s: chunk cut short\n", path.c_str());
+		return false;
+	}
+
+	keyframe = true;
+	lastWrite = 0;
+	words.fill(Tracer::NO_WORD);
+
+	return true;
+}
+
+uint8_t TraceReader::read8() {
+	if (position >= chunk.size()) {
+		truncated = true;
+		return 0;
+	}
+
+	return chunk[position++];
+}
+
+uint32_t TraceReader::read32() {
+	if (chunk.size() - position < 4) {
+		truncated = true;
+		position = chunk.size();
+		return 0;
+	}
+
+	position += 4;
+	return memory::load32(chunk.data() + position - 4);
+}
+
+uint64_t TraceReader::read64() {
+	uint64_t low = read32();
+	return low | uint64_t(read32()) << 32;
+}
+
+uint64_t TraceReader::readVarint() {
+	uint64_t value = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		uint8_t byte = read8();
+		value |= uint64_t(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			break;
+		}
+	}
+
+	return value;
+}
+
+}
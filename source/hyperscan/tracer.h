@@ -0,0 +1,218 @@
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "hyperscan/cpu.h"
+
+#ifndef __HYPERSCAN_TRACER_H__
+#define __HYPERSCAN_TRACER_H__
+
+namespace hyperscan {
+
+/**
+ * Everything the trace follows about the CPU
+ */
+struct TraceState {
+	uint32_t pc;
+	uint32_t r[32];
+	uint32_t cr[32];
+	uint32_t sr[3];
+	uint64_t CE;
+
+	bool operator==(const TraceState&) const = default;
+};
+
+/**
+ * Records every instruction a CPU runs: its PC and word, the registers it changed and the memory it wrote
+ *
+ * A trace is the magic and version, followed by chunks, each decodable on its own:
+ * u32 size of what follows the header, u32 number of records, then a keyframe with the whole TraceState
+ * and the records, each encoded against the state the record before left behind
+ *
+ * A record starts with a byte of RECORD_* flags and the PC as a zigzag varint delta from the PC of the record before
+ * The word follows as a raw u32, unless the same word was last seen at the same PC within the chunk
+ * Changed registers come as a varint mask per file (r, cr, then sr with CE as bit 3), each followed by zigzag varint deltas
+ * Writes are whole words, as the MIU journals them
+ * They come as a varint count, then the word address as a zigzag varint delta from the previous write and the value as a varint
+ *
+ * A new chunk starts every CHUNK_RECORDS records, and whenever the CPU changed between slices without running an instruction,
+ * e.g. when an interrupt was taken or the debugger set a register
+ */
+class Tracer {
+	friend class TraceReader;
+
+	public:
+		typedef memory::SegmentedMemoryRegion<8, 24>::Write Write;
+
+		static constexpr char MAGIC[8] = { 'H', 'S', 'T', 'R', 'A', 'C', 'E', '\x1A' };
+
+		// Bumped whenever the encoding changes
+		static constexpr uint32_t VERSION = 1;
+
+		static constexpr size_t CHUNK_RECORDS = 1 << 16;
+
+		// Record flags
+		static constexpr uint8_t RECORD_WORD_SEEN  = 1 << 0;
+		static constexpr uint8_t RECORD_R          = 1 << 1;
+		static constexpr uint8_t RECORD_CR         = 1 << 2;
+		static constexpr uint8_t RECORD_SR         = 1 << 3;
+		static constexpr uint8_t RECORD_WRITES     = 1 << 4;
+
+		// Instruction words remembered per chunk, indexed by half-word address
+		static constexpr size_t WORD_CACHE_SIZE = 1024;
+
+		/**
+		 * Writes the trace to path, as each chunk fills when ring is 0
+		 * Otherwise only about the last ring bytes are kept in memory and written when the tracer goes away
+		 * Exits when path cannot be opened
+		 */
+		explicit Tracer(const char *path, size_t ring = 0);
+
+		Tracer(const Tracer&) = delete;
+
+		Tracer& operator=(const Tracer&) = delete;
+
+		/**
+		 * Writes out whatever is still held
+		 */
+		~Tracer();
+
+		/**
+		 * Called before a slice runs, starts a new chunk if the CPU is not where the last record left it
+		 */
+		void resume(const CPU &cpu);
+
+		/**
+		 * Records the instruction at pc, encoded as word, which left cpu as it is now, along with writes
+		 * Flags have to be materialized, writes is emptied for the next instruction
+		 */
+		void record(const CPU &cpu, uint32_t pc, uint32_t word);
+
+		// Journaled by the MIU for the instruction being traced
+		std::vector<Write> writes;
+
+	private:
+		struct WordCache {
+			uint32_t pc;
+			uint32_t word;
+		};
+
+		// Matches no PC, instructions are half-word aligned
+		static constexpr WordCache NO_WORD = { 1, 0 };
+
+		/**
+		 * Closes the current chunk, writing it out or keeping it in the ring, then starts one from state
+		 */
+		void restart(const TraceState &state);
+
+		/**
+		 * Closes the current chunk if it holds any record
+		 */
+		void finish();
+
+		/**
+		 * Makes room for size more bytes in the chunk, returns where they go
+		 */
+		uint8_t* reserve(size_t size);
+
+		FILE *file;
+		std::string path;
+		size_t ring;
+
+		// Chunks kept when recording to a ring, the current one is not among them
+		std::deque<std::vector<uint8_t>> chunks;
+		size_t kept;
+
+		// Grows and never shrinks, only the first used bytes belong to the current chunk
+		std::vector<uint8_t> chunk;
+		size_t used;
+		uint32_t records;
+
+		// Where the last record left the CPU, and the PC and write it had
+		TraceState last;
+		bool started;
+		uint32_t lastPC;
+		uint32_t lastWrite;
+		std::array<WordCache, WORD_CACHE_SIZE> words;
+};
+
+/**
+ * Reads back a trace written by Tracer, a record at a time
+ */
+class TraceReader {
+	public:
+		typedef Tracer::Write Write;
+
+		struct Record {
+			// PC and word of the instruction
+			uint32_t pc;
+			uint32_t word;
+
+			// First record of a chunk, the state before it does not follow from the record before
+			bool keyframe;
+
+			// Registers before the instruction ran, with its PC
+			TraceState before;
+
+			// Registers once the instruction ran, what it changed has a bit set in the masks
+			// PC is the one of the instruction, where it went is only known from the next record
+			TraceState state;
+			uint32_t changedR;
+			uint32_t changedCR;
+			uint8_t changedSR;
+
+			std::vector<Write> writes;
+		};
+
+		/**
+		 * Exits when path cannot be opened or is not a trace
+		 */
+		explicit TraceReader(const char *path);
+
+		TraceReader(const TraceReader&) = delete;
+
+		TraceReader& operator=(const TraceReader&) = delete;
+
+		~TraceReader();
+
+		/**
+		 * Reads the next record into record
+		 * Returns false at the end of the trace, or when it is cut short, with the reason printed
+		 */
+		bool next(Record &record);
+
+	private:
+		/**
+		 * Loads the next chunk, returns false at the end of the trace
+		 */
+		bool nextChunk();
+
+		// Reading past the end of the chunk marks it truncated and yields zeros
+		uint8_t read8();
+
+		uint32_t read32();
+
+		uint64_t read64();
+
+		uint64_t readVarint();
+
+		FILE *file;
+		std::string path;
+
+		std::vector<uint8_t> chunk;
+		size_t position;
+		uint32_t remaining;
+		bool truncated;
+
+		bool keyframe;
+		TraceState state;
+		uint32_t lastWrite;
+		std::array<Tracer::WordCache, Tracer::WORD_CACHE_SIZE> words;
+};
+
+}
+
+#endif
@@ -1,67 +1,418 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "hyperscan/cpu.h"
 #include "hyperscan/debugger.h"
-#include "hyperscan/io/io.h"
-#include "hyperscan/memory/arraymemoryregion.h"
+#include "hyperscan/differential.h"
+#include "hyperscan/io/bufferedsink.h"
+#include "hyperscan/io/ppu.h"
+#include "hyperscan/io/uart.h"
+#include "hyperscan/machine.h"
+#include "hyperscan/png.h"
+#include "hyperscan/runner.h"
+#include "hyperscan/savestate.h"
+#include "hyperscan/tracer.h"
 
 using namespace hyperscan;
 
+// Instructions run between debugger checks when not single stepping
+static constexpr uint32_t SLICE = 4096;
+
+// Instructions run between stop condition checks in headless mode
+static constexpr uint32_t HEADLESS_SLICE = 1 << 16;
+
+struct HeadlessOptions {
+	bool enabled = false;
+
+	// Copies of the machine run side by side, on up to threads host threads, 0 for one per core
+	size_t instances = 1;
+	unsigned threads = 0;
+
+	// Instruction budget per machine, 0 for none
+	uint64_t maxInstructions = 0;
+
+	// Stop when reaching any of these
+	std::vector<uint32_t> untilPC;
+
+	// Stop once the UART has sent this
+	std::string untilUART;
+
+	// Where to save the machine once stopped, nullptr for nowhere
+	// With several machines, each gets its index appended
+	const char *saveState = nullptr;
+
+	// Runs a fork of every machine with another engine and stops once they disagree
+	bool differential = false;
+	CPU::Engine differentialEngine;
+	uint32_t differentialInterval = 1;
+
+	// Where the UART goes instead of stdout, nullptr for stdout
+	// With several machines, each gets its index appended
+	const char *uartOutput = nullptr;
+
+	// Where to save the last frame drawn as a PNG, nullptr for nowhere, frames are only drawn when set
+	// With several machines, each gets its index appended
+	const char *screenshot = nullptr;
+};
+
+// Kept until the process exits, so traces are still written out when the debugger quits
+static std::vector<std::unique_ptr<Tracer>> tracers;
+
+/**
+ * Returns the value of a --name=value argument, nullptr if arg is another option
+ */
+static const char* option(const char *arg, const char *name) {
+	size_t length = strlen(name);
+	return strncmp(arg, name, length) ? nullptr : arg + length;
+}
+
+/**
+ * Sets engine from its name, returns false for an unknown one
+ */
+static bool parse_engine(const char *name, CPU::Engine &engine) {
+	if (!strcmp(name, "interpreter")) {
+		engine = CPU::Engine::INTERPRETER;
+	} else if (!strcmp(name, "cached")) {
+		engine = CPU::Engine::CACHED;
+	} else if (!strcmp(name, "jit")) {
+		engine = CPU::Engine::JIT;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Returns path, with index appended when there are several machines
+ */
+static std::string machine_path(const char *path, size_t index, size_t count) {
+	return count > 1 ? std::string(path) + "." + std::to_string(index) : std::string(path);
+}
+
+/**
+ * Queues the contents of path for the UART to receive
+ * Returns false, with the reason printed, when path cannot be read
+ */
+static bool uart_receive_file(io::UART &uart, const char *path) {
+	FILE *file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return false;
+	}
+
+	uint8_t buffer[4096];
+	size_t size;
+	while ((size = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+		uart.receive(buffer, size);
+	}
+
+	bool ok = !ferror(file);
+	if (!ok) {
+		perror(path);
+	}
+
+	fclose(file);
+	return ok;
+}
+
+/**
+ * Where a machine run headless is at
+ */
+struct HeadlessRun {
+	uint64_t executed = 0;
+
+	// Last bytes sent by the UART, as many as in the pattern
+	std::string sent;
+	bool matched = false;
+
+	const char *reason = "instruction budget spent";
+	int status;
+
+	// Checks the machine against a fork of itself, when asked to
+	std::unique_ptr<Differential> differential;
+
+	// Last frame drawn, when taking a screenshot
+	io::Frame frame;
+};
+
 /**
- * TODO: make better
+ * Runs machines without the debugger until each spends the budget or meets a stop condition
+ * PCs are checked between blocks, the UART pattern between slices
+ * Only a single machine has its UART echoed, several would interleave, unless each goes to its own file
+ *
+ * Returns the process exit code: 0 when every machine stopped by a condition or on a budget with no conditions
  */
-auto createFileMemoryRegion(const char* fileName, uint32_t offset = 0) {
-	auto result = std::make_shared<memory::ArrayMemoryRegion<24>>();
+static int run_headless(const std::vector<std::unique_ptr<Machine>> &machines, const HeadlessOptions &options) {
+	std::unordered_map<const Machine*, HeadlessRun> runs;
+	std::vector<std::shared_ptr<io::BufferedSink>> outputs;
+
+	Runner runner(options.threads);
+	for (size_t i = 0; i < machines.size(); ++i) {
+		const auto &machine = machines[i];
+		HeadlessRun &run = runs[machine.get()];
+		run.status = (options.untilPC.empty() && options.untilUART.empty()) ? 0 : 1;
+
+		std::shared_ptr<io::BufferedSink> output;
+		if (options.uartOutput) {
+			output = std::make_shared<io::BufferedSink>(machine_path(options.uartOutput, i, machines.size()).c_str());
+		} else if (machines.size() == 1) {
+			output = std::make_shared<io::BufferedSink>(stdout);
+		}
+
+		if (output) {
+			outputs.push_back(output);
+		}
+
+		machine->io->uart->setSink([&run, &options, output](uint8_t value) {
+			if (output) {
+				output->put(value);
+			}
+
+			if (!options.untilUART.empty() && !run.matched) {
+				run.sent.push_back(value);
+				if (run.sent.size() > options.untilUART.size()) {
+					run.sent.erase(run.sent.begin());
+				}
+
+				run.matched = (run.sent == options.untilUART);
+			}
+		});
+
+		if (options.screenshot) {
+			machine->io->ppu->setSink([&run](const io::Frame &frame) {
+				run.frame = frame;
+			});
+		}
+
+		for (uint32_t address : options.untilPC) {
+			machine->cpu.breakpoints.add(address);
+		}
+
+		if (options.differential) {
+			run.differential = std::make_unique<Differential>(*machine, options.differentialEngine, options.differentialInterval);
+		}
 
-	FILE* f = fopen(fileName, "rb");
-	if(!f) {
-		fprintf(stderr, "bad file: %s", fileName);
-		exit(1);
+		runner.add(*machine);
 	}
 
-	fseek(f, 0, SEEK_END);
-	size_t fileSize = ftell(f);
-	fseek(f, 0, SEEK_SET);
+	auto start = std::chrono::steady_clock::now();
+
+	runner.run([&](Machine &machine) {
+		CPU &cpu = machine.cpu;
+		HeadlessRun &run = runs.at(&machine);
+		if (options.maxInstructions && run.executed >= options.maxInstructions) {
+			return false;
+		}
+
+		uint64_t slice = HEADLESS_SLICE;
+		if (options.maxInstructions) {
+			slice = std::min(slice, options.maxInstructions - run.executed);
+		}
+
+		run.executed += run.differential ? run.differential->run(slice) : cpu.run(slice);
+
+		if (run.differential && run.differential->diverged()) {
+			run.reason = "engines diverged";
+			run.status = 1;
+			return false;
+		}
+
+		if (run.matched) {
+			run.reason = "UART pattern sent";
+			run.status = 0;
+			return false;
+		}
+
+		if (cpu.breakpoints.contains(cpu.pc)) {
+			run.reason = "PC reached";
+			run.status = 0;
+			return false;
+		}
+
+		return true;
+	});
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	for (const auto &output : outputs) {
+		output->flush();
+	}
 
-	if(fread(result->memory.data() + offset, 1, fileSize, f) != fileSize)
-		fprintf(stderr, "WARNING: Bad firmware\n");
+	int status = 0;
+	uint64_t executed = 0;
+	for (size_t i = 0; i < machines.size(); ++i) {
+		CPU &cpu = machines[i]->cpu;
+		const HeadlessRun &run = runs.at(machines[i].get());
+		executed += run.executed;
 
-	fclose(f);
+		if (machines.size() == 1) {
+			fprintf(stderr, "%s at PC %08X after %llu instructions (%.3fs, %.1f MIPS)\n",
+					run.reason, cpu.pc, (unsigned long long) run.executed, elapsed.count(), run.executed / elapsed.count() / 1e6);
+		} else {
+			fprintf(stderr, "machine %zu: %s at PC %08X after %llu instructions\n",
+					i, run.reason, cpu.pc, (unsigned long long) run.executed);
+		}
 
-	return result;
+		status |= run.status;
+		if (options.saveState) {
+			// Every machine gets its own file when there are several
+			std::string path = machine_path(options.saveState, i, machines.size());
+			if (!savestate_save(cpu, path.c_str())) {
+				status = 1;
+			}
+		}
+
+		if (options.screenshot) {
+			// Frames are drawn on another thread, the last ones may not have come out yet
+			machines[i]->io->ppu->flush();
+
+			std::string path = machine_path(options.screenshot, i, machines.size());
+			if (run.frame.pixels.empty()) {
+				fprintf(stderr, "%s: no frame was drawn\n", path.c_str());
+				status = 1;
+			} else if (!png_save(path.c_str(), run.frame.pixels.data(), run.frame.width, run.frame.height)) {
+				status = 1;
+			}
+		}
+	}
+
+	if (machines.size() > 1) {
+		fprintf(stderr, "%zu machines, %llu instructions (%.3fs, %.1f MIPS)\n",
+				machines.size(), (unsigned long long) executed, elapsed.count(), executed / elapsed.count() / 1e6);
+	}
+
+	return status;
 }
 
-int main() {
-	CPU cpu;
+int main(int argc, char *argv[]) {
+	CPU::Engine engine = CPU::Engine::CACHED;
+	bool lockstep = false;
+	bool skipIdle = true;
+	HeadlessOptions headless;
+	const char *loadState = nullptr;
+	const char *uartInput = nullptr;
+	const char *trace = nullptr;
+	size_t traceRing = 0;
+
+	// Last of the differential testing options given, which only headless runs use
+	const char *differentialOption = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *value;
+		if ((value = option(argv[i], "--engine=")) && parse_engine(value, engine)) {
+			continue;
+		} else if ((value = option(argv[i], "--differential=")) && parse_engine(value, headless.differentialEngine)) {
+			headless.differential = true;
+			differentialOption = "--differential";
+		} else if ((value = option(argv[i], "--differential-interval="))) {
+			headless.differentialInterval = strtoul(value, nullptr, 0);
+			differentialOption = "--differential-interval";
+		} else if (!strcmp(argv[i], "--lockstep")) {
+			lockstep = true;
+		} else if (!strcmp(argv[i], "--no-idle-skip")) {
+			skipIdle = false;
+		} else if (!strcmp(argv[i], "--headless")) {
+			headless.enabled = true;
+		} else if ((value = option(argv[i], "--instances="))) {
+			headless.instances = std::max(1ul, strtoul(value, nullptr, 0));
+		} else if ((value = option(argv[i], "--threads="))) {
+			headless.threads = strtoul(value, nullptr, 0);
+		} else if ((value = option(argv[i], "--max-instructions="))) {
+			headless.maxInstructions = strtoull(value, nullptr, 0);
+		} else if ((value = option(argv[i], "--until-pc="))) {
+			headless.untilPC.push_back(strtoul(value, nullptr, 16));
+		} else if ((value = option(argv[i], "--until-uart="))) {
+			headless.untilUART = value;
+		} else if ((value = option(argv[i], "--save-state="))) {
+			headless.saveState = value;
+		} else if ((value = option(argv[i], "--load-state="))) {
+			loadState = value;
+		} else if ((value = option(argv[i], "--uart-input="))) {
+			uartInput = value;
+		} else if ((value = option(argv[i], "--uart-output="))) {
+			headless.uartOutput = value;
+		} else if ((value = option(argv[i], "--screenshot="))) {
+			headless.screenshot = value;
+		} else if ((value = option(argv[i], "--trace="))) {
+			trace = value;
+		} else if ((value = option(argv[i], "--trace-ring="))) {
+			traceRing = strtoull(value, nullptr, 0) << 20;
+		} else {
+			fprintf(stderr, "usage: %s [--engine=interpreter|cached|jit] [--lockstep] [--no-idle-skip] [--load-state=FILE]\n"
+							"       [--uart-input=FILE] [--uart-output=FILE] [--trace=FILE [--trace-ring=MIB]]\n"
+							"       [--headless [--instances=N] [--threads=N] [--max-instructions=N] [--until-pc=ADDRESS]... [--until-uart=TEXT]\n"
+							"                   [--save-state=FILE] [--screenshot=FILE] [--differential=interpreter|cached|jit [--differential-interval=N]]]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// The debugger runs a single machine, with nothing following it
+	if (differentialOption && !headless.enabled) {
+		fprintf(stderr, "%s needs --headless\n", differentialOption);
+		return 1;
+	}
+
+	// Both journal the MIU of the machine they follow, and only one journal fits
+	if (trace && headless.differential) {
+		fprintf(stderr, "--trace and --differential cannot be used together\n");
+		return 1;
+	}
 
-	cpu.miu = std::make_shared<memory::SegmentedMemoryRegion<8, 24>>();
-	auto firmware = createFileMemoryRegion("roms/hsfirmware.bin");
-	auto dram = std::make_shared<memory::ArrayMemoryRegion<24>>();
-	auto mmio = std::make_shared<io::IOMemoryRegion>();
+	std::vector<std::unique_ptr<Machine>> machines;
+	machines.push_back(std::make_unique<Machine>());
 
-	cpu.miu->setRegion(0x9E, firmware);
-	cpu.miu->setRegion(0x9F, firmware);
+	Machine &machine = *machines.front();
+	machine.cpu.engine = engine;
+	machine.cpu.jit.lockstep = lockstep;
+	machine.cpu.skipIdle = skipIdle;
+
+	if (loadState && !savestate_load(machine.cpu, loadState)) {
+		return 1;
+	}
 
-	cpu.miu->setRegion(0x80, dram);
-	cpu.miu->setRegion(0xA0, dram);
+	// Queued after loading, so it comes on top of whatever the state had pending
+	if (uartInput && !uart_receive_file(*machine.io->uart, uartInput)) {
+		return 1;
+	}
 
-	cpu.miu->setRegion(0x08, mmio);
-	cpu.miu->setRegion(0x88, mmio);
+	while (headless.enabled && machines.size() < headless.instances) {
+		machines.push_back(machine.fork());
+	}
 
-	// XXX: Debug control register
-	cpu.cr29 = 0x20000000;
+	if (trace) {
+		for (size_t i = 0; i < machines.size(); ++i) {
+			tracers.push_back(std::make_unique<Tracer>(machine_path(trace, i, machines.size()).c_str(), traceRing));
+			machines[i]->cpu.tracer = tracers.back().get();
+		}
+	}
 
-	// Firmware entry point
-	cpu.pc = 0x9F000000;
+	if (headless.enabled) {
+		return run_headless(machines, headless);
+	}
 
-//	// ISO "entry point"
-//	cpu.pc = 0xA0091000;
+	if (headless.uartOutput) {
+		auto output = std::make_shared<io::BufferedSink>(headless.uartOutput);
+		machine.io->uart->setSink([output](uint8_t value) {
+			output->put(value);
+		});
+	}
 
-	debugger_enable();
+	debugger_enable(machine.debugger);
 	while (true) {
-		debugger_loop(cpu);
-		cpu.step();
+		if (debugger_attached(machine.debugger)) {
+			debugger_loop(machine.debugger, machine.cpu);
+			machine.cpu.step();
+		} else {
+			machine.cpu.run(SLICE);
+			debugger_loop(machine.debugger, machine.cpu);
+		}
 	}
 }
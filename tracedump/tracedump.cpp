@@ -0,0 +1,92 @@
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "hyperscan/cpu.h"
+#include "hyperscan/debugger.h"
+#include "hyperscan/disasm.h"
+#include "hyperscan/tracer.h"
+
+using namespace hyperscan;
+
+/**
+ * Disassembles the instruction fetched as word from pc, the way the CPU picks it
+ */
+static void disassemble(uint32_t pc, uint32_t word, const TraceState &before) {
+	CPU::InstructionDecoder instruction = word;
+
+	// Fetches from half-word addresses have the instruction in the low half
+	if (pc & 2) {
+		return disasm16(instruction.low, pc);
+	}
+
+	if (instruction.p0) {
+		return disasm32((instruction.high << 15) | instruction.low, pc);
+	}
+
+	// Parallel pairs run the half T selects
+	if (instruction.p1) {
+		bool T = (before.cr[1] >> 4) & 1;
+		return disasm16(T ? instruction.low : instruction.high, pc);
+	}
+
+	disasm16(instruction.low, pc);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s TRACE [MAPPING]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc > 2) {
+		debugger_load_mapping(argv[2]);
+	}
+
+	TraceReader reader(argv[1]);
+	TraceReader::Record record;
+	uint64_t count = 0;
+	while (reader.next(record)) {
+		if (record.keyframe && count) {
+			printf("--- state changed outside of an instruction\n");
+		}
+
+		std::string alias = debugger_get_alias(record.pc);
+		if (!alias.empty()) {
+			printf("%s:\n", alias.c_str());
+		}
+
+		printf("%08X: %08X  ", record.pc, record.word);
+		disassemble(record.pc, record.word, record.before);
+
+		const TraceState &state = record.state;
+		for (unsigned i = 0; i < 32; ++i) {
+			if (record.changedR & (1u << i)) {
+				printf("  r%u=%08X", i, state.r[i]);
+			}
+		}
+		for (unsigned i = 0; i < 32; ++i) {
+			if (record.changedCR & (1u << i)) {
+				printf("  cr%u=%08X", i, state.cr[i]);
+			}
+		}
+		for (unsigned i = 0; i < 3; ++i) {
+			if (record.changedSR & (1 << i)) {
+				printf("  sr%u=%08X", i, state.sr[i]);
+			}
+		}
+		if (record.changedSR & (1 << 3)) {
+			printf("  CE=%016" PRIX64, state.CE);
+		}
+		for (const TraceReader::Write &write : record.writes) {
+			printf("  [%08X]=%08X", write.address, write.value);
+		}
+
+		printf("\n");
+		++count;
+	}
+
+	fprintf(stderr, "%" PRIu64 " instructions\n", count);
+	return 0;
+}